@@ -0,0 +1,247 @@
+#include "kinect_burst.h"
+#include <iostream>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "kinect_registration.h"
+
+// Every stream starts on its own cache line
+static const size_t BURST_ALIGNMENT = 64;
+
+// Explicit huge page size (MAP_HUGETLB without a size flag uses the default)
+static const size_t HUGE_PAGE_BYTES = 2 * 1024 * 1024;
+
+// Frames the arena is sized for; compressed color is decoded to this size
+static const int BURST_COLOR_WIDTH = 1920;
+static const int BURST_COLOR_HEIGHT = 1080;
+
+static size_t alignUp(size_t bytes, size_t alignment)
+{
+    return (bytes + alignment - 1) / alignment * alignment;
+}
+
+static BurstStream missingStream()
+{
+    BurstStream stream = {BURST_NO_FRAME, 0, 0, 0, 0};
+    return stream;
+}
+
+BurstCapture::BurstCapture()
+    : arena(nullptr), arena_bytes(0), used(0), explicit_huge_pages(false), max_frames(0), frame_types(0)
+{
+}
+
+BurstCapture::~BurstCapture()
+{
+    unmap();
+}
+
+void BurstCapture::unmap()
+{
+    if (arena)
+        munmap(arena, arena_bytes);
+    arena = nullptr;
+    arena_bytes = 0;
+    explicit_huge_pages = false;
+    max_frames = 0;
+    sets.clear();
+    used = 0;
+}
+
+bool BurstCapture::reserve(int num_frames, unsigned int frame_types, const ColorOutput &rgb_format, bool huge_pages)
+{
+    unmap();
+
+    size_t set_bytes = 0;
+    if (frame_types & libfreenect2::Frame::Color)
+        set_bytes += alignUp(colorOutputBytes(BURST_COLOR_WIDTH, BURST_COLOR_HEIGHT, rgb_format), BURST_ALIGNMENT);
+    if (frame_types & libfreenect2::Frame::Depth)
+        set_bytes += alignUp(DEPTH_WIDTH * DEPTH_HEIGHT, BURST_ALIGNMENT);
+    if (frame_types & libfreenect2::Frame::Ir)
+        set_bytes += alignUp(DEPTH_WIDTH * DEPTH_HEIGHT, BURST_ALIGNMENT);
+
+    if (num_frames <= 0 || set_bytes == 0)
+    {
+        std::cout << "Nothing to reserve for the burst" << std::endl;
+        return false;
+    }
+
+    size_t bytes = set_bytes * num_frames;
+    void *mapped = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+    if (huge_pages)
+    {
+        size_t huge_bytes = alignUp(bytes, HUGE_PAGE_BYTES);
+        mapped = mmap(nullptr, huge_bytes, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+        if (mapped != MAP_FAILED)
+        {
+            bytes = huge_bytes;
+            explicit_huge_pages = true;
+        }
+        else
+        {
+            std::cout << "No huge pages reserved, using transparent huge pages" << std::endl;
+        }
+    }
+#endif
+
+    if (mapped == MAP_FAILED)
+    {
+        mapped = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mapped == MAP_FAILED)
+        {
+            std::cout << "Could not map a " << bytes / (1024 * 1024) << " MB burst arena" << std::endl;
+            return false;
+        }
+
+#ifdef MADV_HUGEPAGE
+        if (huge_pages)
+            madvise(mapped, bytes, MADV_HUGEPAGE);
+#endif
+
+        // Fault every page in now rather than during the burst
+        long page_bytes = sysconf(_SC_PAGESIZE);
+        for (size_t offset = 0; offset < bytes; offset += page_bytes)
+        {
+            ((volatile unsigned char *)mapped)[offset] = 0;
+        }
+    }
+
+    arena = (unsigned char *)mapped;
+    arena_bytes = bytes;
+    max_frames = num_frames;
+    this->frame_types = frame_types;
+    this->rgb_format = rgb_format;
+    sets.reserve(num_frames);
+    return true;
+}
+
+void BurstCapture::clear()
+{
+    sets.clear();
+    used = 0;
+}
+
+unsigned char *BurstCapture::claim(size_t bytes, size_t &offset)
+{
+    offset = alignUp(used, BURST_ALIGNMENT);
+    if (offset + bytes > arena_bytes)
+        return nullptr;
+    used = offset + bytes;
+    return arena + offset;
+}
+
+bool BurstCapture::add(const FrameLease &lease)
+{
+    if (full())
+        return false;
+
+    FrameView none = frameView(nullptr);
+    FrameView rgb = none, depth = none, ir = none;
+    if (frame_types & libfreenect2::Frame::Color)
+    {
+        rgb = lease.color();
+        if (rgb.compressed())
+            rgb = frameView(jpeg_decoder.decode(rgb));
+    }
+    if (frame_types & libfreenect2::Frame::Depth)
+        depth = lease.depth();
+    if (frame_types & libfreenect2::Frame::Ir)
+        ir = lease.ir();
+
+    if (!rgb.valid() && !depth.valid() && !ir.valid())
+        return true;
+
+    if (sets.empty())
+        start_time = std::chrono::steady_clock::now();
+
+    BurstFrameSet set;
+    set.rgb = set.depth = set.ir = missingStream();
+    set.host_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_time).count();
+
+    size_t used_before = used;
+    unsigned char *rgb_out = nullptr, *depth_out = nullptr, *ir_out = nullptr;
+    bool fits = true;
+    if (rgb.valid())
+    {
+        rgb_out = claim(colorOutputBytes(rgb.width, rgb.height, rgb_format), set.rgb.offset);
+        set.rgb.width = colorOutputWidth(rgb.width, rgb_format);
+        set.rgb.height = colorOutputHeight(rgb.height, rgb_format);
+        set.rgb.timestamp = rgb.timestamp;
+        set.rgb.sequence = rgb.sequence;
+        fits = fits && rgb_out;
+    }
+    if (depth.valid())
+    {
+        depth_out = claim((size_t)depth.width * depth.height, set.depth.offset);
+        set.depth.width = depth.width;
+        set.depth.height = depth.height;
+        set.depth.timestamp = depth.timestamp;
+        set.depth.sequence = depth.sequence;
+        fits = fits && depth_out;
+    }
+    if (ir.valid())
+    {
+        ir_out = claim((size_t)ir.width * ir.height, set.ir.offset);
+        set.ir.width = ir.width;
+        set.ir.height = ir.height;
+        set.ir.timestamp = ir.timestamp;
+        set.ir.sequence = ir.sequence;
+        fits = fits && ir_out;
+    }
+
+    // Only frames larger than the ones the arena was sized for get here
+    if (!fits)
+    {
+        used = used_before;
+        std::cout << "Burst arena is full" << std::endl;
+        return false;
+    }
+
+    convertViews(rgb, rgb_out, rgb_format, depth, depth_out, ir, ir_out, ir_normalizer);
+    sets.push_back(set);
+    return true;
+}
+
+int BurstCapture::capture(FrameSource &source, int timeout_ms)
+{
+    if (!arena || !source.select_streams(frame_types))
+        return 0;
+
+    FrameLease lease;
+    int captured = 0;
+    while (!full())
+    {
+        if (!lease.acquire(source, timeout_ms))
+        {
+            if (!source.finished())
+                std::cout << "Timeout waiting for frames!" << std::endl;
+            break;
+        }
+        if (!add(lease))
+            break;
+        captured++;
+    }
+    return captured;
+}
+
+FrameCapture BurstCapture::frame(int i) const
+{
+    const BurstFrameSet &set = sets[i];
+    FrameCapture capture = {};
+    if (set.rgb.offset != BURST_NO_FRAME)
+        capture.rgb_data = arena + set.rgb.offset;
+    capture.rgb_width = set.rgb.width;
+    capture.rgb_height = set.rgb.height;
+    if (set.depth.offset != BURST_NO_FRAME)
+        capture.depth_data = arena + set.depth.offset;
+    capture.depth_width = set.depth.width;
+    capture.depth_height = set.depth.height;
+    if (set.ir.offset != BURST_NO_FRAME)
+        capture.ir_data = arena + set.ir.offset;
+    capture.ir_width = set.ir.width;
+    capture.ir_height = set.ir.height;
+    return capture;
+}
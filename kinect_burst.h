@@ -0,0 +1,104 @@
+#ifndef KINECT_BURST_H
+#define KINECT_BURST_H
+
+#include <chrono>
+#include <cstddef>
+#include <stdint.h>
+#include <vector>
+
+#include "kinect_capture.h"
+#include "kinect_frame.h"
+#include "kinect_jpeg.h"
+
+// Offset of a stream missing from a frame set
+const size_t BURST_NO_FRAME = (size_t)-1;
+
+// Where one converted stream of a burst frame set lives in the arena
+struct BurstStream
+{
+    size_t offset; // BURST_NO_FRAME when the set did not hold this stream
+    int width, height;
+    uint32_t timestamp; // device clock, 0.1 ms ticks
+    uint32_t sequence;
+};
+
+struct BurstFrameSet
+{
+    BurstStream rgb, depth, ir;
+    double host_ms; // host time since the burst started
+};
+
+// Captures a burst of frame sets into one contiguous arena reserved up front,
+// converted the same way as getFrame and laid out back to back: RGB, depth
+// and IR of set 0, then of set 1, and so on, each stream 64-byte aligned. The
+// index gives every stream's offset and timestamps, so batch processing after
+// the burst reads the arena front to back at streaming bandwidth.
+//
+// The arena is mapped and prefaulted by reserve(), so capturing neither
+// allocates nor page-faults. With huge pages it asks for explicit 2 MB pages
+// (MAP_HUGETLB, which needs pages reserved in /proc/sys/vm/nr_hugepages) and
+// falls back to transparent huge pages.
+class BurstCapture
+{
+public:
+    BurstCapture();
+    ~BurstCapture();
+
+    // Reserve room for `num_frames` sets of `frame_types`
+    // (libfreenect2::Frame::Type bits), dropping any previous burst. Color
+    // is converted to `rgb_format`. Returns false if the arena cannot be mapped.
+    bool reserve(int num_frames, unsigned int frame_types, const ColorOutput &rgb_format = ColorOutput(),
+                 bool huge_pages = false);
+
+    // Fill the rest of the arena from `source`, selecting the reserved
+    // streams first. Stops early on a timeout or when a recording runs out.
+    // Returns the number of sets captured by this call.
+    int capture(FrameSource &source, int timeout_ms = 10 * 1000);
+
+    // Append one frame set. Returns false when the arena is full.
+    bool add(const FrameLease &lease);
+
+    // Forget the captured sets but keep the arena
+    void clear();
+
+    int frame_count() const { return (int)sets.size(); }
+    int capacity() const { return max_frames; }
+    bool full() const { return frame_count() >= max_frames; }
+
+    const BurstFrameSet &index(int i) const { return sets[i]; }
+
+    // Set `i` as a FrameCapture pointing into the arena; missing streams are null
+    FrameCapture frame(int i) const;
+
+    unsigned char *data() const { return arena; }
+    size_t used_bytes() const { return used; }
+    size_t reserved_bytes() const { return arena_bytes; }
+    bool huge_pages() const { return explicit_huge_pages; }
+
+    // Scales each IR frame by its own max unless reuse_previous_max is set,
+    // as for pooled frames
+    IRNormalizer ir_normalizer;
+
+private:
+    BurstCapture(const BurstCapture &) = delete;
+    BurstCapture &operator=(const BurstCapture &) = delete;
+
+    void unmap();
+
+    // Claim `bytes` at the end of the arena; null if they do not fit
+    unsigned char *claim(size_t bytes, size_t &offset);
+
+    unsigned char *arena;
+    size_t arena_bytes;
+    size_t used;
+    bool explicit_huge_pages;
+
+    int max_frames;
+    unsigned int frame_types;
+    ColorOutput rgb_format;
+    std::vector<BurstFrameSet> sets;
+    std::chrono::steady_clock::time_point start_time;
+    JpegDecoder jpeg_decoder;
+};
+
+#endif
@@ -1,68 +1,444 @@
 #include "kinect_capture.h"
+#include "kinect_convert.h"
+#include "kinect_ply.h"
+#include "kinect_profile.h"
+#include "kinect_thread_pool.h"
 #include <iostream>
-#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <mutex>
 
-FrameCapture getFrame(libfreenect2::Freenect2Device *dev, libfreenect2::SyncMultiFrameListener &listener)
+FrameBuffer::FrameBuffer() : owner(nullptr), ptr(nullptr), bytes(0) {}
+
+FrameBuffer::FrameBuffer(FrameBufferPool *owner, unsigned char *ptr, size_t bytes)
+    : owner(owner), ptr(ptr), bytes(bytes) {}
+
+FrameBuffer::FrameBuffer(FrameBuffer &&other) : owner(other.owner), ptr(other.ptr), bytes(other.bytes)
 {
-    libfreenect2::FrameMap frames;
-    FrameCapture capture = {};
+    other.owner = nullptr;
+    other.ptr = nullptr;
+    other.bytes = 0;
+}
 
-    if (!listener.waitForNewFrame(frames, 10 * 1000))
+FrameBuffer &FrameBuffer::operator=(FrameBuffer &&other)
+{
+    if (this != &other)
     {
-        std::cout << "Timeout waiting for frames!" << std::endl;
-        return capture;
+        release();
+        owner = other.owner;
+        ptr = other.ptr;
+        bytes = other.bytes;
+        other.owner = nullptr;
+        other.ptr = nullptr;
+        other.bytes = 0;
+    }
+    return *this;
+}
+
+FrameBuffer::~FrameBuffer()
+{
+    release();
+}
+
+void FrameBuffer::release()
+{
+    if (owner)
+        owner->give_back(ptr, bytes);
+    owner = nullptr;
+    ptr = nullptr;
+    bytes = 0;
+}
+
+FrameBufferPool::FrameBufferPool(size_t max_free_buffers)
+    : max_free_buffers(max_free_buffers), allocations(0) {}
+
+FrameBufferPool::~FrameBufferPool()
+{
+    for (size_t i = 0; i < free_buffers.size(); i++)
+    {
+        delete[] free_buffers[i].ptr;
+    }
+}
+
+FrameBuffer FrameBufferPool::acquire(size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    // Take the smallest free buffer that fits
+    int best = -1;
+    for (size_t i = 0; i < free_buffers.size(); i++)
+    {
+        if (free_buffers[i].bytes >= bytes &&
+            (best < 0 || free_buffers[i].bytes < free_buffers[best].bytes))
+        {
+            best = (int)i;
+        }
+    }
+
+    if (best >= 0)
+    {
+        FreeBuffer buffer = free_buffers[best];
+        free_buffers[best] = free_buffers.back();
+        free_buffers.pop_back();
+        return FrameBuffer(this, buffer.ptr, buffer.bytes);
+    }
+
+    allocations++;
+    return FrameBuffer(this, new unsigned char[bytes], bytes);
+}
+
+size_t FrameBufferPool::allocation_count()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return allocations;
+}
+
+size_t FrameBufferPool::free_count()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return free_buffers.size();
+}
+
+void FrameBufferPool::give_back(unsigned char *ptr, size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (free_buffers.size() >= max_free_buffers)
+    {
+        delete[] ptr;
+        return;
     }
 
-    libfreenect2::Frame *rgb = frames[libfreenect2::Frame::Color];
-    libfreenect2::Frame *depth = frames[libfreenect2::Frame::Depth];
-    libfreenect2::Frame *ir = frames[libfreenect2::Frame::Ir];
+    FreeBuffer buffer = {ptr, bytes};
+    free_buffers.push_back(buffer);
+}
+
+// Keep an existing lease if it is big enough, otherwise swap it for a new one
+static unsigned char *leaseBuffer(FrameBufferPool &pool, FrameBuffer &buffer, size_t bytes)
+{
+    if (buffer.size() < bytes)
+        buffer = pool.acquire(bytes);
+    return buffer.data();
+}
+
+// Each conversion holds on to the pool it started with, so replacing the
+// pool mid-conversion only retires the old one once that conversion is done
+static std::mutex conversion_pool_mutex;
+static std::shared_ptr<ThreadPool> conversion_pool;
 
-    // Convert RGB (BGRX -> RGB)
-    capture.rgb_width = rgb->width;
-    capture.rgb_height = rgb->height;
-    capture.rgb_data = new unsigned char[rgb->width * rgb->height * 3];
-    for (size_t i = 0; i < rgb->width * rgb->height; i++)
+static std::shared_ptr<ThreadPool> conversionPool()
+{
+    std::lock_guard<std::mutex> lock(conversion_pool_mutex);
+    if (!conversion_pool)
+        conversion_pool = std::make_shared<ThreadPool>(0);
+    return conversion_pool;
+}
+
+void setConversionThreads(int num_threads)
+{
+    std::shared_ptr<ThreadPool> pool = std::make_shared<ThreadPool>(num_threads);
+    std::lock_guard<std::mutex> lock(conversion_pool_mutex);
+    conversion_pool.swap(pool);
+}
+
+int conversionThreads()
+{
+    return conversionPool()->thread_count();
+}
+
+// Color as BGRX pixels: compressed frames are decoded with `decoder`, and
+// come out empty if that fails
+static FrameView colorPixels(const FrameView &color, JpegDecoder &decoder)
+{
+    return color.compressed() ? frameView(decoder.decode(color)) : color;
+}
+
+PROFILE_STAGE(convert_stage, "convert");
+PROFILE_STAGE(unproject_stage, "unproject");
+
+// Everything the row bands of one convertFrames call need
+struct ConvertJob
+{
+    const FrameView *rgb;
+    unsigned char *rgb_out;
+    ColorOutput rgb_format;
+    int rows_per_band_row;
+
+    const FrameView *depth;
+    unsigned char *depth_out;
+
+    const FrameView *ir;
+    unsigned char *ir_out;
+    bool ir_single_pass;
+    float scale_max;
+    float max_ir; // max over the bands, guarded by max_mutex
+    std::mutex max_mutex;
+};
+
+static void convertColorRows(void *context, int row_begin, int row_end)
+{
+    ConvertJob &job = *(ConvertJob *)context;
+    convertBGRX(job.rgb->data, job.rgb->width, job.rgb->height, job.rgb_out, job.rgb_format,
+                row_begin * job.rows_per_band_row, row_end * job.rows_per_band_row);
+}
+
+static void convertDepthRows(void *context, int row_begin, int row_end)
+{
+    ConvertJob &job = *(ConvertJob *)context;
+    size_t offset = row_begin * job.depth->width;
+    convertDepthToBytes(job.depth->floats() + offset, job.depth_out + offset,
+                        (row_end - row_begin) * job.depth->width);
+}
+
+static void maxIRRows(void *context, int row_begin, int row_end)
+{
+    ConvertJob &job = *(ConvertJob *)context;
+    size_t offset = row_begin * job.ir->width;
+    size_t count = (row_end - row_begin) * job.ir->width;
+    const float *ir_float = job.ir->floats() + offset;
+    float band_max = job.ir_single_pass ? scaleIR(ir_float, job.ir_out + offset, count, job.scale_max)
+                                        : maxIR(ir_float, count);
+
+    std::lock_guard<std::mutex> lock(job.max_mutex);
+    job.max_ir = std::max(job.max_ir, band_max);
+}
+
+static void scaleIRRows(void *context, int row_begin, int row_end)
+{
+    ConvertJob &job = *(ConvertJob *)context;
+    size_t offset = row_begin * job.ir->width;
+    scaleIR(job.ir->floats() + offset, job.ir_out + offset, (row_end - row_begin) * job.ir->width, job.max_ir);
+}
+
+// Convert whichever frames have an output buffer, split into row bands on the
+// conversion pool. Color, depth and IR go into one batch so they run together.
+// `rgb_format` and `ir_normalizer` are only used when converting color and IR.
+static void convertFrames(const FrameView *rgb, unsigned char *rgb_out, const ColorOutput &rgb_format,
+                          const FrameView *depth, unsigned char *depth_out,
+                          const FrameView *ir, unsigned char *ir_out, IRNormalizer *ir_normalizer)
+{
+    PROFILE_SCOPE(convert_stage);
+    std::shared_ptr<ThreadPool> pool = conversionPool();
+    RowBatch batch(*pool);
+
+    ConvertJob job;
+    job.rgb = rgb;
+    job.rgb_out = rgb_out;
+    job.rgb_format = rgb_format;
+    // Bands are in output rows; NV12 rows go in pairs that share a UV row
+    job.rows_per_band_row = rgb_format.layout == COLOR_LAYOUT_NV12 ? 2 : 1;
+    job.depth = depth;
+    job.depth_out = depth_out;
+    job.ir = ir;
+    job.ir_out = ir_out;
+    // IR needs the max of the whole image: each band folds its own max in
+    // (and scales in the same pass when reusing the previous frame's max)
+    job.ir_single_pass = ir_out && ir_normalizer->reuse_previous_max && ir_normalizer->previous_max >= 0;
+    job.scale_max = ir_out ? ir_normalizer->previous_max : 0.0f;
+    job.max_ir = 0.0f;
+
+    if (rgb_out)
     {
-        capture.rgb_data[i * 3 + 0] = rgb->data[i * 4 + 2]; // R
-        capture.rgb_data[i * 3 + 1] = rgb->data[i * 4 + 1]; // G
-        capture.rgb_data[i * 3 + 2] = rgb->data[i * 4 + 0]; // B
+        int rows = colorOutputHeight(rgb->height, rgb_format);
+        batch.add((rows + job.rows_per_band_row - 1) / job.rows_per_band_row, convertColorRows, &job);
     }
+    if (depth_out)
+        batch.add(depth->height, convertDepthRows, &job);
+    if (ir_out)
+        batch.add(ir->height, maxIRRows, &job);
+
+    batch.run();
 
-    // Convert depth (normalize to 0-255)
-    capture.depth_width = depth->width;
-    capture.depth_height = depth->height;
-    capture.depth_data = new unsigned char[depth->width * depth->height];
-    float *depth_float = (float *)depth->data;
-    for (size_t i = 0; i < depth->width * depth->height; i++)
+    if (!ir_out)
+        return;
+
+    if (!job.ir_single_pass)
     {
-        float val = depth_float[i] / 4500.0f; // normalize to 0-4.5m
-        capture.depth_data[i] = (unsigned char)(val * 255.0f);
+        batch.add(ir->height, scaleIRRows, &job);
+        batch.run();
     }
+    ir_normalizer->previous_max = job.max_ir;
+}
 
-    // Convert IR (normalize to 0-255)
-    capture.ir_width = ir->width;
-    capture.ir_height = ir->height;
-    capture.ir_data = new unsigned char[ir->width * ir->height];
-    float *ir_float = (float *)ir->data;
+// Per-call state of unprojectParallel; each band records its point count
+// and end row at the index of its first row
+struct UnprojectJob
+{
+    RegistrationContext *registration;
+    const DepthRange *range;
+    float *points;
+    unsigned char *colors;
+    int band_points[DEPTH_HEIGHT];
+    int band_end[DEPTH_HEIGHT];
+};
+
+static void unprojectRows(void *context, int row_begin, int row_end)
+{
+    UnprojectJob &job = *(UnprojectJob *)context;
+    size_t offset = (size_t)row_begin * CLOUD_ROW_STRIDE;
+    job.band_points[row_begin] = unprojectDepthRows(job.registration->rays(), job.registration->undistorted(),
+                                                    job.registration->registered(), *job.range, row_begin,
+                                                    row_end, job.points + offset, job.colors + offset);
+    job.band_end[row_begin] = row_end;
+}
 
-    // Find max value for normalization
-    float max_ir = 0;
-    for (size_t i = 0; i < ir->width * ir->height; i++)
+// Unproject the context's last applied frame. Each row band fills its own
+// region of the output (CLOUD_ROW_STRIDE per row) and the bands are then
+// slid down behind each other.
+static int unprojectParallel(RegistrationContext &registration, const DepthRange &range,
+                             float *points, unsigned char *colors)
+{
+    PROFILE_SCOPE(unproject_stage);
+    UnprojectJob job;
+    job.registration = &registration;
+    job.range = &range;
+    job.points = points;
+    job.colors = colors;
+
+    std::shared_ptr<ThreadPool> pool = conversionPool();
+    RowBatch batch(*pool);
+    batch.add(DEPTH_HEIGHT, unprojectRows, &job);
+    batch.run();
+
+    int num_points = 0;
+    for (int row = 0; row < DEPTH_HEIGHT; row = job.band_end[row])
     {
-        if (ir_float[i] > max_ir)
-            max_ir = ir_float[i];
+        size_t offset = (size_t)row * CLOUD_ROW_STRIDE;
+        if (offset != (size_t)num_points * 3)
+        {
+            memmove(points + num_points * 3, points + offset, job.band_points[row] * 3 * sizeof(float));
+            memmove(colors + num_points * 3, colors + offset, job.band_points[row] * 3);
+        }
+        num_points += job.band_points[row];
     }
+    return num_points;
+}
+
+void convertRGBView(const FrameView &color, FrameBufferPool &pool, PooledRGBFrame &out)
+{
+    FrameView rgb = colorPixels(color, out.jpeg_decoder);
+    out.frame.width = colorOutputWidth(rgb.width, out.format);
+    out.frame.height = colorOutputHeight(rgb.height, out.format);
+    out.frame.data = leaseBuffer(pool, out.buffer, colorOutputBytes(rgb.width, rgb.height, out.format));
+    convertFrames(&rgb, out.frame.data, out.format, nullptr, nullptr, nullptr, nullptr, nullptr);
+}
+
+void convertDepthView(const FrameView &depth, FrameBufferPool &pool, PooledDepthFrame &out)
+{
+    out.frame.width = depth.width;
+    out.frame.height = depth.height;
+    out.frame.data = leaseBuffer(pool, out.buffer, depth.width * depth.height);
+    convertFrames(nullptr, nullptr, ColorOutput(), &depth, out.frame.data, nullptr, nullptr, nullptr);
+}
+
+void convertIRView(const FrameView &ir, FrameBufferPool &pool, PooledIRFrame &out)
+{
+    out.frame.width = ir.width;
+    out.frame.height = ir.height;
+    out.frame.data = leaseBuffer(pool, out.buffer, ir.width * ir.height);
+    convertFrames(nullptr, nullptr, ColorOutput(), nullptr, nullptr, &ir, out.frame.data, &out.ir_normalizer);
+}
 
-    for (size_t i = 0; i < ir->width * ir->height; i++)
+void convertLease(const FrameLease &lease, FrameBufferPool &pool, PooledFrameCapture &out)
+{
+    FrameView rgb = colorPixels(lease.color(), out.jpeg_decoder);
+    FrameView depth = lease.depth();
+    FrameView ir = lease.ir();
+
+    // Streams missing from the frame set (e.g. a recording without IR) come out empty
+    FrameCapture &capture = out.capture;
+    capture.rgb_width = colorOutputWidth(rgb.width, out.rgb_format);
+    capture.rgb_height = colorOutputHeight(rgb.height, out.rgb_format);
+    capture.rgb_data = rgb.valid() ? leaseBuffer(pool, out.rgb_buffer, colorOutputBytes(rgb.width, rgb.height, out.rgb_format))
+                                   : nullptr;
+    capture.depth_width = depth.width;
+    capture.depth_height = depth.height;
+    capture.depth_data = depth.valid() ? leaseBuffer(pool, out.depth_buffer, depth.width * depth.height) : nullptr;
+    capture.ir_width = ir.width;
+    capture.ir_height = ir.height;
+    capture.ir_data = ir.valid() ? leaseBuffer(pool, out.ir_buffer, ir.width * ir.height) : nullptr;
+
+    convertFrames(&rgb, capture.rgb_data, out.rgb_format, &depth, capture.depth_data, &ir, capture.ir_data,
+                  &out.ir_normalizer);
+}
+
+void unprojectLease(const FrameLease &lease, RegistrationContext &registration,
+                    FrameBufferPool &pool, PooledPointCloud &out, const DepthRange &range)
+{
+    // Size for the worst case so the buffers can be reused for every frame
+    out.cloud.points = (float *)leaseBuffer(pool, out.points_buffer, CLOUD_POINTS_FLOATS * sizeof(float));
+    out.cloud.colors = leaseBuffer(pool, out.colors_buffer, CLOUD_COLORS_BYTES);
+    out.cloud.num_points = 0;
+
+    libfreenect2::Frame *color = out.jpeg_decoder.color_frame(lease);
+    if (!color)
+        return;
+
+    registration.apply(color, lease.frame(libfreenect2::Frame::Depth));
+    out.cloud.num_points = unprojectParallel(registration, range, out.cloud.points, out.cloud.colors);
+}
+
+void convertViews(const FrameView &rgb, unsigned char *rgb_out, const ColorOutput &rgb_format,
+                  const FrameView &depth, unsigned char *depth_out,
+                  const FrameView &ir, unsigned char *ir_out, IRNormalizer &ir_normalizer)
+{
+    convertFrames(&rgb, rgb_out, rgb_format, &depth, depth_out, &ir, ir_out, &ir_normalizer);
+}
+
+// Select just the streams a getter uses, so the source does no work for the
+// others, then wait for them. Changing the selection restarts a live device.
+static bool acquireStreams(FrameLease &lease, FrameSource &source, unsigned int frame_types)
+{
+    return source.select_streams(frame_types) && lease.acquire(source);
+}
+
+FrameCapture getFrame(FrameSource &source)
+{
+    FrameLease lease;
+    FrameCapture capture = {};
+
+    if (!acquireStreams(lease, source, libfreenect2::Frame::Color | libfreenect2::Frame::Depth | libfreenect2::Frame::Ir))
     {
-        float val = ir_float[i] / max_ir;
-        capture.ir_data[i] = (unsigned char)(val * 255.0f);
+        std::cout << "Timeout waiting for frames!" << std::endl;
+        return capture;
     }
 
-    listener.release(frames);
+    JpegDecoder decoder;
+    FrameView rgb = colorPixels(lease.color(), decoder);
+    FrameView depth = lease.depth();
+    FrameView ir = lease.ir();
+
+    // RGB (BGRX -> RGB), depth and IR (normalized to 0-255)
+    capture.rgb_width = rgb.width;
+    capture.rgb_height = rgb.height;
+    capture.rgb_data = new unsigned char[rgb.width * rgb.height * 3];
+    capture.depth_width = depth.width;
+    capture.depth_height = depth.height;
+    capture.depth_data = new unsigned char[depth.width * depth.height];
+    capture.ir_width = ir.width;
+    capture.ir_height = ir.height;
+    capture.ir_data = new unsigned char[ir.width * ir.height];
+
+    IRNormalizer ir_normalizer;
+    convertFrames(&rgb, capture.rgb_data, ColorOutput(), &depth, capture.depth_data, &ir, capture.ir_data, &ir_normalizer);
+
     return capture;
 }
 
+bool getFrame(FrameSource &source, FrameBufferPool &pool, PooledFrameCapture &out)
+{
+    FrameLease lease;
+
+    if (!acquireStreams(lease, source, libfreenect2::Frame::Color | libfreenect2::Frame::Depth | libfreenect2::Frame::Ir))
+    {
+        std::cout << "Timeout waiting for frames!" << std::endl;
+        return false;
+    }
+
+    convertLease(lease, pool, out);
+    return true;
+}
+
 void freeFrameCapture(FrameCapture &capture)
 {
     delete[] capture.rgb_data;
@@ -70,93 +446,111 @@ void freeFrameCapture(FrameCapture &capture)
     delete[] capture.ir_data;
 }
 
-RGBFrame getRGBFrame(libfreenect2::Freenect2Device *dev, libfreenect2::SyncMultiFrameListener &listener)
+RGBFrame getRGBFrame(FrameSource &source)
 {
-    libfreenect2::FrameMap frames;
+    FrameLease lease;
     RGBFrame frame = {};
 
-    if (!listener.waitForNewFrame(frames, 10 * 1000))
+    if (!acquireStreams(lease, source, libfreenect2::Frame::Color))
     {
         std::cout << "Timeout waiting for RGB frame!" << std::endl;
         return frame;
     }
 
-    libfreenect2::Frame *rgb = frames[libfreenect2::Frame::Color];
+    JpegDecoder decoder;
+    FrameView rgb = colorPixels(lease.color(), decoder);
+
+    frame.width = rgb.width;
+    frame.height = rgb.height;
+    frame.data = new unsigned char[rgb.width * rgb.height * 3];
+    convertFrames(&rgb, frame.data, ColorOutput(), nullptr, nullptr, nullptr, nullptr, nullptr);
+
+    return frame;
+}
+
+bool getRGBFrame(FrameSource &source, FrameBufferPool &pool, PooledRGBFrame &out)
+{
+    FrameLease lease;
 
-    frame.width = rgb->width;
-    frame.height = rgb->height;
-    frame.data = new unsigned char[rgb->width * rgb->height * 3];
-    for (size_t i = 0; i < rgb->width * rgb->height; i++)
+    if (!acquireStreams(lease, source, libfreenect2::Frame::Color))
     {
-        frame.data[i * 3 + 0] = rgb->data[i * 4 + 2]; // R
-        frame.data[i * 3 + 1] = rgb->data[i * 4 + 1]; // G
-        frame.data[i * 3 + 2] = rgb->data[i * 4 + 0]; // B
+        std::cout << "Timeout waiting for RGB frame!" << std::endl;
+        return false;
     }
 
-    listener.release(frames);
-    return frame;
+    convertRGBView(lease.color(), pool, out);
+    return true;
 }
 
-DepthFrame getDepthFrame(libfreenect2::Freenect2Device *dev, libfreenect2::SyncMultiFrameListener &listener)
+DepthFrame getDepthFrame(FrameSource &source)
 {
-    libfreenect2::FrameMap frames;
+    FrameLease lease;
     DepthFrame frame = {};
 
-    if (!listener.waitForNewFrame(frames, 10 * 1000))
+    if (!acquireStreams(lease, source, libfreenect2::Frame::Depth))
     {
         std::cout << "Timeout waiting for depth frame!" << std::endl;
         return frame;
     }
 
-    libfreenect2::Frame *depth = frames[libfreenect2::Frame::Depth];
+    FrameView depth = lease.depth();
 
-    frame.width = depth->width;
-    frame.height = depth->height;
-    frame.data = new unsigned char[depth->width * depth->height];
-    float *depth_float = (float *)depth->data;
-    for (size_t i = 0; i < depth->width * depth->height; i++)
+    frame.width = depth.width;
+    frame.height = depth.height;
+    frame.data = new unsigned char[depth.width * depth.height];
+    convertFrames(nullptr, nullptr, ColorOutput(), &depth, frame.data, nullptr, nullptr, nullptr);
+
+    return frame;
+}
+
+bool getDepthFrame(FrameSource &source, FrameBufferPool &pool, PooledDepthFrame &out)
+{
+    FrameLease lease;
+
+    if (!acquireStreams(lease, source, libfreenect2::Frame::Depth))
     {
-        float val = depth_float[i] / 4500.0f;
-        frame.data[i] = (unsigned char)(val * 255.0f);
+        std::cout << "Timeout waiting for depth frame!" << std::endl;
+        return false;
     }
 
-    listener.release(frames);
-    return frame;
+    convertDepthView(lease.depth(), pool, out);
+    return true;
 }
 
-IRFrame getIRFrame(libfreenect2::Freenect2Device *dev, libfreenect2::SyncMultiFrameListener &listener)
+IRFrame getIRFrame(FrameSource &source)
 {
-    libfreenect2::FrameMap frames;
+    FrameLease lease;
     IRFrame frame = {};
 
-    if (!listener.waitForNewFrame(frames, 10 * 1000))
+    if (!acquireStreams(lease, source, libfreenect2::Frame::Ir))
     {
         std::cout << "Timeout waiting for IR frame!" << std::endl;
         return frame;
     }
 
-    libfreenect2::Frame *ir = frames[libfreenect2::Frame::Ir];
+    FrameView ir = lease.ir();
 
-    frame.width = ir->width;
-    frame.height = ir->height;
-    frame.data = new unsigned char[ir->width * ir->height];
-    float *ir_float = (float *)ir->data;
+    frame.width = ir.width;
+    frame.height = ir.height;
+    frame.data = new unsigned char[ir.width * ir.height];
+    IRNormalizer ir_normalizer;
+    convertFrames(nullptr, nullptr, ColorOutput(), nullptr, nullptr, &ir, frame.data, &ir_normalizer);
 
-    float max_ir = 0;
-    for (size_t i = 0; i < ir->width * ir->height; i++)
-    {
-        if (ir_float[i] > max_ir)
-            max_ir = ir_float[i];
-    }
+    return frame;
+}
 
-    for (size_t i = 0; i < ir->width * ir->height; i++)
+bool getIRFrame(FrameSource &source, FrameBufferPool &pool, PooledIRFrame &out)
+{
+    FrameLease lease;
+
+    if (!acquireStreams(lease, source, libfreenect2::Frame::Ir))
     {
-        float val = ir_float[i] / max_ir;
-        frame.data[i] = (unsigned char)(val * 255.0f);
+        std::cout << "Timeout waiting for IR frame!" << std::endl;
+        return false;
     }
 
-    listener.release(frames);
-    return frame;
+    convertIRView(lease.ir(), pool, out);
+    return true;
 }
 
 void freeRGBFrame(RGBFrame &frame)
@@ -174,75 +568,48 @@ void freeIRFrame(IRFrame &frame)
     delete[] frame.data;
 }
 
-PointCloudData getPointCloud(libfreenect2::Freenect2Device *dev,
-                             libfreenect2::SyncMultiFrameListener &listener,
-                             libfreenect2::Registration *registration)
+PointCloudData getPointCloud(FrameSource &source,
+                             RegistrationContext &registration,
+                             const DepthRange &range)
 {
-    libfreenect2::FrameMap frames;
+    FrameLease lease;
     PointCloudData cloud = {};
 
-    if (!listener.waitForNewFrame(frames, 10 * 1000))
+    if (!acquireStreams(lease, source, libfreenect2::Frame::Color | libfreenect2::Frame::Depth))
     {
         std::cout << "Timeout waiting for frames!" << std::endl;
         return cloud;
     }
 
-    libfreenect2::Frame *rgb = frames[libfreenect2::Frame::Color];
-    libfreenect2::Frame *depth = frames[libfreenect2::Frame::Depth];
+    JpegDecoder decoder;
+    libfreenect2::Frame *color = decoder.color_frame(lease);
+    if (!color)
+        return cloud;
 
-    // Create undistorted and registered frames
-    libfreenect2::Frame undistorted(512, 424, 4);
-    libfreenect2::Frame registered(512, 424, 4);
+    registration.apply(color, lease.frame(libfreenect2::Frame::Depth));
 
-    registration->apply(rgb, depth, &undistorted, &registered);
+    // Single pass into worst-case sized buffers; pages past the last point are never touched
+    cloud.points = new float[CLOUD_POINTS_FLOATS];
+    cloud.colors = new unsigned char[CLOUD_COLORS_BYTES];
+    cloud.num_points = unprojectParallel(registration, range, cloud.points, cloud.colors);
 
-    // Count valid points (depth > 0)
-    float *depth_data = (float *)undistorted.data;
-    int valid_count = 0;
-    for (int i = 0; i < 512 * 424; i++)
-    {
-        if (depth_data[i] > 0 && depth_data[i] < 4500)
-        {
-            valid_count++;
-        }
-    }
+    return cloud;
+}
 
-    cloud.num_points = valid_count;
-    cloud.points = new float[valid_count * 3];
-    cloud.colors = new unsigned char[valid_count * 3];
+bool getPointCloud(FrameSource &source,
+                   RegistrationContext &registration,
+                   FrameBufferPool &pool, PooledPointCloud &out, const DepthRange &range)
+{
+    FrameLease lease;
 
-    int point_idx = 0;
-    for (int y = 0; y < 424; y++)
+    if (!acquireStreams(lease, source, libfreenect2::Frame::Color | libfreenect2::Frame::Depth))
     {
-        for (int x = 0; x < 512; x++)
-        {
-            int idx = y * 512 + x;
-            float d = depth_data[idx];
-
-            // Skip invalid depth
-            if (d <= 0 || d >= 4500)
-                continue;
-
-            // Get 3D point using registration
-            float px, py, pz;
-            registration->getPointXYZ(&undistorted, y, x, px, py, pz);
-
-            cloud.points[point_idx * 3 + 0] = px;
-            cloud.points[point_idx * 3 + 1] = py;
-            cloud.points[point_idx * 3 + 2] = pz;
-
-            // Get color from registered RGB frame
-            unsigned char *rgb_data = registered.data;
-            cloud.colors[point_idx * 3 + 0] = rgb_data[idx * 4 + 2]; // R
-            cloud.colors[point_idx * 3 + 1] = rgb_data[idx * 4 + 1]; // G
-            cloud.colors[point_idx * 3 + 2] = rgb_data[idx * 4 + 0]; // B
-
-            point_idx++;
-        }
+        std::cout << "Timeout waiting for frames!" << std::endl;
+        return false;
     }
 
-    listener.release(frames);
-    return cloud;
+    unprojectLease(lease, registration, pool, out, range);
+    return true;
 }
 
 void freePointCloud(PointCloudData &cloud)
@@ -253,39 +620,10 @@ void freePointCloud(PointCloudData &cloud)
 
 void savePointCloudPLY(const char *filename, const PointCloudData &cloud)
 {
-    std::ofstream file(filename, std::ios::binary);
-
-    // Write PLY header
-    std::string header =
-        "ply\n"
-        "format binary_little_endian 1.0\n"
-        "element vertex " +
-        std::to_string(cloud.num_points) + "\n"
-                                           "property float x\n"
-                                           "property float y\n"
-                                           "property float z\n"
-                                           "property uchar red\n"
-                                           "property uchar green\n"
-                                           "property uchar blue\n"
-                                           "end_header\n";
-
-    file.write(header.c_str(), header.size());
-
-    // Write points in binary
-    for (int i = 0; i < cloud.num_points; i++)
+    if (!writePointCloudPLY(filename, cloud.points, cloud.colors, cloud.num_points))
     {
-        float x = cloud.points[i * 3 + 0];
-        float y = cloud.points[i * 3 + 1];
-        float z = cloud.points[i * 3 + 2];
-
-        file.write((char *)&x, sizeof(float));
-        file.write((char *)&y, sizeof(float));
-        file.write((char *)&z, sizeof(float));
-        file.write((char *)&cloud.colors[i * 3 + 0], 1);
-        file.write((char *)&cloud.colors[i * 3 + 1], 1);
-        file.write((char *)&cloud.colors[i * 3 + 2], 1);
+        std::cout << "Failed to write point cloud to " << filename << std::endl;
+        return;
     }
-
-    file.close();
     std::cout << "Saved point cloud with " << cloud.num_points << " points to " << filename << std::endl;
-}
\ No newline at end of file
+}
@@ -5,6 +5,14 @@
 #include <libfreenect2/frame_listener_impl.h>
 #include <libfreenect2/packet_pipeline.h>
 #include <libfreenect2/registration.h>
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+#include "kinect_convert.h"
+#include "kinect_frame.h"
+#include "kinect_jpeg.h"
+#include "kinect_registration.h"
 
 struct FrameCapture
 {
@@ -41,23 +49,162 @@ struct PointCloudData
     int num_points;
 };
 
+class FrameBufferPool;
+
+// Buffer leased from a FrameBufferPool. Moving transfers the lease and
+// destruction hands the memory back to the pool.
+class FrameBuffer
+{
+public:
+    FrameBuffer();
+    FrameBuffer(FrameBuffer &&other);
+    FrameBuffer &operator=(FrameBuffer &&other);
+    ~FrameBuffer();
+
+    unsigned char *data() const { return ptr; }
+    size_t size() const { return bytes; }
+    void release();
+
+private:
+    friend class FrameBufferPool;
+    FrameBuffer(FrameBufferPool *owner, unsigned char *ptr, size_t bytes);
+    FrameBuffer(const FrameBuffer &) = delete;
+    FrameBuffer &operator=(const FrameBuffer &) = delete;
+
+    FrameBufferPool *owner;
+    unsigned char *ptr;
+    size_t bytes;
+};
+
+// Recycles frame-sized buffers so steady-state capture does no heap allocation.
+// The pool must outlive every buffer leased from it. Thread-safe.
+class FrameBufferPool
+{
+public:
+    FrameBufferPool(size_t max_free_buffers = 16);
+    ~FrameBufferPool();
+
+    // Lease a buffer of at least `bytes` bytes, reusing a free one when possible
+    FrameBuffer acquire(size_t bytes);
+
+    // Number of heap allocations the pool has made so far
+    size_t allocation_count();
+    size_t free_count();
+
+private:
+    friend class FrameBuffer;
+    void give_back(unsigned char *ptr, size_t bytes);
+
+    struct FreeBuffer
+    {
+        unsigned char *ptr;
+        size_t bytes;
+    };
+
+    std::vector<FreeBuffer> free_buffers;
+    size_t max_free_buffers;
+    size_t allocations;
+    std::mutex mutex;
+};
+
+// Frames backed by pooled buffers. The structs point into the leased buffers,
+// which are reused in place when the same object is passed to the next capture.
+// Set ir_normalizer.reuse_previous_max for single-pass IR conversion, and the
+// color format for a downscaled, planar or NV12 image instead of full-size
+// RGB (width and height are then those of the output).
+struct PooledFrameCapture
+{
+    FrameCapture capture;
+    FrameBuffer rgb_buffer, depth_buffer, ir_buffer;
+    IRNormalizer ir_normalizer;
+    ColorOutput rgb_format;
+    JpegDecoder jpeg_decoder; // for compressed color, see FrameView::compressed
+};
+
+struct PooledRGBFrame
+{
+    RGBFrame frame;
+    FrameBuffer buffer;
+    ColorOutput format;
+    JpegDecoder jpeg_decoder;
+};
+
+struct PooledDepthFrame
+{
+    DepthFrame frame;
+    FrameBuffer buffer;
+};
+
+struct PooledIRFrame
+{
+    IRFrame frame;
+    FrameBuffer buffer;
+    IRNormalizer ir_normalizer;
+};
+
+// Point buffers are sized for the worst case (see unprojectDepth)
+struct PooledPointCloud
+{
+    PointCloudData cloud;
+    FrameBuffer points_buffer, colors_buffer;
+    JpegDecoder jpeg_decoder;
+};
+
+// Conversions are split into row bands on a shared pool of worker threads.
+// Defaults to one thread per core. Changing it while other threads convert
+// is safe; conversions already running finish on the old pool.
+void setConversionThreads(int num_threads);
+int conversionThreads();
+
+// Conversions on top of a FrameLease. Nothing is converted until one of these
+// is called, so consumers that read the raw views pay only for what they use.
+// Compressed color is decoded here too, and only here.
+void convertRGBView(const FrameView &rgb, FrameBufferPool &pool, PooledRGBFrame &out);
+void convertDepthView(const FrameView &depth, FrameBufferPool &pool, PooledDepthFrame &out);
+void convertIRView(const FrameView &ir, FrameBufferPool &pool, PooledIRFrame &out);
+void convertLease(const FrameLease &lease, FrameBufferPool &pool, PooledFrameCapture &out);
+void unprojectLease(const FrameLease &lease, RegistrationContext &registration,
+                    FrameBufferPool &pool, PooledPointCloud &out, const DepthRange &range = DepthRange());
+
+// Convert views into caller-owned memory (e.g. a BurstCapture arena) instead
+// of pooled buffers. Streams with a null output are skipped; the outputs must
+// hold colorOutputBytes of the color view and width * height bytes of depth
+// and IR. Color must already be decoded.
+void convertViews(const FrameView &rgb, unsigned char *rgb_out, const ColorOutput &rgb_format,
+                  const FrameView &depth, unsigned char *depth_out,
+                  const FrameView &ir, unsigned char *ir_out, IRNormalizer &ir_normalizer);
+
+// The get* functions select just the streams they return on the source
+// before waiting (see FrameSource::select_streams), so alternating between
+// them restarts a live device each time.
+
 // Get all three frames
-FrameCapture getFrame(libfreenect2::Freenect2Device *dev, libfreenect2::SyncMultiFrameListener &listener);
+FrameCapture getFrame(FrameSource &source);
 void freeFrameCapture(FrameCapture &capture);
 
 // Get individual frames
-RGBFrame getRGBFrame(libfreenect2::Freenect2Device *dev, libfreenect2::SyncMultiFrameListener &listener);
-DepthFrame getDepthFrame(libfreenect2::Freenect2Device *dev, libfreenect2::SyncMultiFrameListener &listener);
-IRFrame getIRFrame(libfreenect2::Freenect2Device *dev, libfreenect2::SyncMultiFrameListener &listener);
+RGBFrame getRGBFrame(FrameSource &source);
+DepthFrame getDepthFrame(FrameSource &source);
+IRFrame getIRFrame(FrameSource &source);
+
+// Pooled variants fill leased buffers in place. Return false on timeout or
+// when a recording has run out.
+bool getFrame(FrameSource &source, FrameBufferPool &pool, PooledFrameCapture &out);
+bool getRGBFrame(FrameSource &source, FrameBufferPool &pool, PooledRGBFrame &out);
+bool getDepthFrame(FrameSource &source, FrameBufferPool &pool, PooledDepthFrame &out);
+bool getIRFrame(FrameSource &source, FrameBufferPool &pool, PooledIRFrame &out);
 
 void freeRGBFrame(RGBFrame &frame);
 void freeDepthFrame(DepthFrame &frame);
 void freeIRFrame(IRFrame &frame);
 
 // Point cloud functions
-PointCloudData getPointCloud(libfreenect2::Freenect2Device *dev,
-                             libfreenect2::SyncMultiFrameListener &listener,
-                             libfreenect2::Registration *registration);
+PointCloudData getPointCloud(FrameSource &source,
+                             RegistrationContext &registration,
+                             const DepthRange &range = DepthRange());
+bool getPointCloud(FrameSource &source,
+                   RegistrationContext &registration,
+                   FrameBufferPool &pool, PooledPointCloud &out, const DepthRange &range = DepthRange());
 void freePointCloud(PointCloudData &cloud);
 void savePointCloudPLY(const char *filename, const PointCloudData &cloud);
 
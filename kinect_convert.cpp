@@ -0,0 +1,699 @@
+#include "kinect_convert.h"
+#include <algorithm>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define KINECT_CONVERT_X86 1
+#include <immintrin.h>
+#endif
+
+static void bgrxToRGBScalar(const unsigned char *bgrx, unsigned char *rgb, size_t num_pixels)
+{
+    for (size_t i = 0; i < num_pixels; i++)
+    {
+        rgb[i * 3 + 0] = bgrx[i * 4 + 2]; // R
+        rgb[i * 3 + 1] = bgrx[i * 4 + 1]; // G
+        rgb[i * 3 + 2] = bgrx[i * 4 + 0]; // B
+    }
+}
+
+static float maxIRScalar(const float *ir, size_t num_pixels)
+{
+    float max_ir = 0;
+    for (size_t i = 0; i < num_pixels; i++)
+    {
+        if (ir[i] > max_ir)
+            max_ir = ir[i];
+    }
+    return max_ir;
+}
+
+static float scaleIRScalar(const float *ir, unsigned char *out, size_t num_pixels, float scale)
+{
+    float max_ir = 0;
+    for (size_t i = 0; i < num_pixels; i++)
+    {
+        max_ir = std::max(max_ir, ir[i]);
+        float val = std::min(std::max(ir[i] * scale, 0.0f), 255.0f);
+        out[i] = (unsigned char)val;
+    }
+    return max_ir;
+}
+
+// Average each `scale` x `scale` box of the BGRX rows starting at `row` into
+// one BGRX pixel, rounding to nearest. `scale` is 2 or 4.
+static void boxFilterRowScalar(const unsigned char *row, size_t stride, int out_width, int scale, unsigned char *out)
+{
+    const int shift = scale == 4 ? 4 : 2;
+    for (int x = 0; x < out_width; x++)
+    {
+        unsigned int sum[4] = {0, 0, 0, 0};
+        for (int dy = 0; dy < scale; dy++)
+        {
+            const unsigned char *src = row + dy * stride + (size_t)x * scale * 4;
+            for (int dx = 0; dx < scale * 4; dx += 4)
+            {
+                sum[0] += src[dx + 0];
+                sum[1] += src[dx + 1];
+                sum[2] += src[dx + 2];
+                sum[3] += src[dx + 3];
+            }
+        }
+        for (int c = 0; c < 4; c++)
+        {
+            out[x * 4 + c] = (unsigned char)((sum[c] + (1u << (shift - 1))) >> shift);
+        }
+    }
+}
+
+#ifdef KINECT_CONVERT_X86
+
+// 2x2 boxes: 8 source pixels from each of 2 rows -> 4 output pixels
+__attribute__((target("sse2"))) static void boxFilterRow2SSE2(const unsigned char *row, size_t stride, int out_width,
+                                                              unsigned char *out)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i round = _mm_set1_epi16(2);
+    const unsigned char *row1 = row + stride;
+    int x = 0;
+
+    for (; x + 4 <= out_width; x += 4)
+    {
+        const unsigned char *a = row + x * 8;
+        const unsigned char *b = row1 + x * 8;
+        __m128i a0 = _mm_loadu_si128((const __m128i *)a);
+        __m128i a1 = _mm_loadu_si128((const __m128i *)(a + 16));
+        __m128i b0 = _mm_loadu_si128((const __m128i *)b);
+        __m128i b1 = _mm_loadu_si128((const __m128i *)(b + 16));
+
+        // Vertical sums as 16-bit lanes, two source pixels per register
+        __m128i p01 = _mm_add_epi16(_mm_unpacklo_epi8(a0, zero), _mm_unpacklo_epi8(b0, zero));
+        __m128i p23 = _mm_add_epi16(_mm_unpackhi_epi8(a0, zero), _mm_unpackhi_epi8(b0, zero));
+        __m128i p45 = _mm_add_epi16(_mm_unpacklo_epi8(a1, zero), _mm_unpacklo_epi8(b1, zero));
+        __m128i p67 = _mm_add_epi16(_mm_unpackhi_epi8(a1, zero), _mm_unpackhi_epi8(b1, zero));
+
+        // Horizontal pairs: {p0, p2} + {p1, p3}
+        __m128i o01 = _mm_add_epi16(_mm_unpacklo_epi64(p01, p23), _mm_unpackhi_epi64(p01, p23));
+        __m128i o23 = _mm_add_epi16(_mm_unpacklo_epi64(p45, p67), _mm_unpackhi_epi64(p45, p67));
+        o01 = _mm_srli_epi16(_mm_add_epi16(o01, round), 2);
+        o23 = _mm_srli_epi16(_mm_add_epi16(o23, round), 2);
+        _mm_storeu_si128((__m128i *)(out + x * 4), _mm_packus_epi16(o01, o23));
+    }
+
+    boxFilterRowScalar(row + x * 8, stride, out_width - x, 2, out + x * 4);
+}
+
+// 4x4 boxes: 16 source pixels from each of 4 rows -> 4 output pixels
+__attribute__((target("sse2"))) static void boxFilterRow4SSE2(const unsigned char *row, size_t stride, int out_width,
+                                                              unsigned char *out)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i round = _mm_set1_epi16(8);
+    int x = 0;
+
+    for (; x + 4 <= out_width; x += 4)
+    {
+        // One output pixel per 16 source bytes: sum the 4 rows, then fold the
+        // 4 pixels down to the low 64 bits
+        __m128i folded[4];
+        for (int k = 0; k < 4; k++)
+        {
+            __m128i lo = zero, hi = zero;
+            for (int dy = 0; dy < 4; dy++)
+            {
+                __m128i px = _mm_loadu_si128((const __m128i *)(row + dy * stride + x * 16 + k * 16));
+                lo = _mm_add_epi16(lo, _mm_unpacklo_epi8(px, zero));
+                hi = _mm_add_epi16(hi, _mm_unpackhi_epi8(px, zero));
+            }
+            folded[k] = _mm_add_epi16(lo, hi);
+        }
+
+        __m128i o01 = _mm_add_epi16(_mm_unpacklo_epi64(folded[0], folded[1]), _mm_unpackhi_epi64(folded[0], folded[1]));
+        __m128i o23 = _mm_add_epi16(_mm_unpacklo_epi64(folded[2], folded[3]), _mm_unpackhi_epi64(folded[2], folded[3]));
+        o01 = _mm_srli_epi16(_mm_add_epi16(o01, round), 4);
+        o23 = _mm_srli_epi16(_mm_add_epi16(o23, round), 4);
+        _mm_storeu_si128((__m128i *)(out + x * 4), _mm_packus_epi16(o01, o23));
+    }
+
+    boxFilterRowScalar(row + x * 16, stride, out_width - x, 4, out + x * 4);
+}
+
+// Shuffle 4 BGRX pixels into 12 RGB bytes at the bottom of the register.
+// The top 4 bytes are zeroed and get overwritten by the next store.
+#define BGRX_TO_RGB_SHUFFLE 2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1
+
+__attribute__((target("ssse3"))) static void bgrxToRGBSSSE3(const unsigned char *bgrx, unsigned char *rgb,
+                                                             size_t num_pixels)
+{
+    const __m128i shuffle = _mm_setr_epi8(BGRX_TO_RGB_SHUFFLE);
+    size_t i = 0;
+
+    // Each store writes 16 bytes but only advances 12, so keep 2 spare pixels of room
+    for (; i + 6 <= num_pixels; i += 4)
+    {
+        __m128i px = _mm_loadu_si128((const __m128i *)(bgrx + i * 4));
+        _mm_storeu_si128((__m128i *)(rgb + i * 3), _mm_shuffle_epi8(px, shuffle));
+    }
+
+    bgrxToRGBScalar(bgrx + i * 4, rgb + i * 3, num_pixels - i);
+}
+
+__attribute__((target("avx2"))) static void bgrxToRGBAVX2(const unsigned char *bgrx, unsigned char *rgb,
+                                                           size_t num_pixels)
+{
+    const __m256i shuffle = _mm256_setr_epi8(BGRX_TO_RGB_SHUFFLE, BGRX_TO_RGB_SHUFFLE);
+    // Pack the two 12-byte lane results into the low 24 bytes
+    const __m256i pack = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+    size_t i = 0;
+
+    // Each store writes 32 bytes but only advances 24, so keep 3 spare pixels of room
+    for (; i + 11 <= num_pixels; i += 8)
+    {
+        __m256i px = _mm256_loadu_si256((const __m256i *)(bgrx + i * 4));
+        __m256i out = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(px, shuffle), pack);
+        _mm256_storeu_si256((__m256i *)(rgb + i * 3), out);
+    }
+
+    bgrxToRGBSSSE3(bgrx + i * 4, rgb + i * 3, num_pixels - i);
+}
+
+__attribute__((target("sse2"))) static float maxIRSSE2(const float *ir, size_t num_pixels)
+{
+    __m128 max0 = _mm_setzero_ps(), max1 = max0;
+    size_t i = 0;
+
+    for (; i + 8 <= num_pixels; i += 8)
+    {
+        max0 = _mm_max_ps(max0, _mm_loadu_ps(ir + i));
+        max1 = _mm_max_ps(max1, _mm_loadu_ps(ir + i + 4));
+    }
+
+    float lanes[4];
+    _mm_storeu_ps(lanes, _mm_max_ps(max0, max1));
+    float max_ir = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+    return std::max(max_ir, maxIRScalar(ir + i, num_pixels - i));
+}
+
+__attribute__((target("sse2"))) static float scaleIRSSE2(const float *ir, unsigned char *out, size_t num_pixels,
+                                                          float scale)
+{
+    const __m128 scale4 = _mm_set1_ps(scale);
+    const __m128 lo = _mm_setzero_ps();
+    const __m128 hi = _mm_set1_ps(255.0f);
+    __m128 max4 = _mm_setzero_ps();
+    size_t i = 0;
+
+    // 16 pixels per iteration: scale, clamp, truncate and pack down to bytes
+    for (; i + 16 <= num_pixels; i += 16)
+    {
+        __m128 a = _mm_loadu_ps(ir + i);
+        __m128 b = _mm_loadu_ps(ir + i + 4);
+        __m128 c = _mm_loadu_ps(ir + i + 8);
+        __m128 d = _mm_loadu_ps(ir + i + 12);
+        max4 = _mm_max_ps(max4, _mm_max_ps(_mm_max_ps(a, b), _mm_max_ps(c, d)));
+
+        __m128i ia = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(a, scale4), lo), hi));
+        __m128i ib = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(b, scale4), lo), hi));
+        __m128i ic = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(c, scale4), lo), hi));
+        __m128i id = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_mul_ps(d, scale4), lo), hi));
+        __m128i bytes = _mm_packus_epi16(_mm_packs_epi32(ia, ib), _mm_packs_epi32(ic, id));
+        _mm_storeu_si128((__m128i *)(out + i), bytes);
+    }
+
+    float lanes[4];
+    _mm_storeu_ps(lanes, max4);
+    float max_ir = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+    return std::max(max_ir, scaleIRScalar(ir + i, out + i, num_pixels - i, scale));
+}
+
+__attribute__((target("avx2"))) static float maxIRAVX2(const float *ir, size_t num_pixels)
+{
+    __m256 max0 = _mm256_setzero_ps(), max1 = max0;
+    size_t i = 0;
+
+    for (; i + 16 <= num_pixels; i += 16)
+    {
+        max0 = _mm256_max_ps(max0, _mm256_loadu_ps(ir + i));
+        max1 = _mm256_max_ps(max1, _mm256_loadu_ps(ir + i + 8));
+    }
+
+    max0 = _mm256_max_ps(max0, max1);
+    __m128 max4 = _mm_max_ps(_mm256_castps256_ps128(max0), _mm256_extractf128_ps(max0, 1));
+    float lanes[4];
+    _mm_storeu_ps(lanes, max4);
+    float max_ir = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+    return std::max(max_ir, maxIRSSE2(ir + i, num_pixels - i));
+}
+
+__attribute__((target("avx2"))) static float scaleIRAVX2(const float *ir, unsigned char *out, size_t num_pixels,
+                                                          float scale)
+{
+    const __m256 scale8 = _mm256_set1_ps(scale);
+    const __m256 lo = _mm256_setzero_ps();
+    const __m256 hi = _mm256_set1_ps(255.0f);
+    // Undo the per-lane interleave of the two pack steps
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    __m256 max8 = _mm256_setzero_ps();
+    size_t i = 0;
+
+    for (; i + 32 <= num_pixels; i += 32)
+    {
+        __m256 a = _mm256_loadu_ps(ir + i);
+        __m256 b = _mm256_loadu_ps(ir + i + 8);
+        __m256 c = _mm256_loadu_ps(ir + i + 16);
+        __m256 d = _mm256_loadu_ps(ir + i + 24);
+        max8 = _mm256_max_ps(max8, _mm256_max_ps(_mm256_max_ps(a, b), _mm256_max_ps(c, d)));
+
+        __m256i ia = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(a, scale8), lo), hi));
+        __m256i ib = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(b, scale8), lo), hi));
+        __m256i ic = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(c, scale8), lo), hi));
+        __m256i id = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(d, scale8), lo), hi));
+        __m256i bytes = _mm256_packus_epi16(_mm256_packs_epi32(ia, ib), _mm256_packs_epi32(ic, id));
+        _mm256_storeu_si256((__m256i *)(out + i), _mm256_permutevar8x32_epi32(bytes, order));
+    }
+
+    __m128 max4 = _mm_max_ps(_mm256_castps256_ps128(max8), _mm256_extractf128_ps(max8, 1));
+    float lanes[4];
+    _mm_storeu_ps(lanes, max4);
+    float max_ir = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+    return std::max(max_ir, scaleIRSSE2(ir + i, out + i, num_pixels - i, scale));
+}
+
+#endif
+
+static bool kernelSupported(ConvertKernel kernel)
+{
+#ifdef KINECT_CONVERT_X86
+    if (kernel == CONVERT_AVX2)
+        return __builtin_cpu_supports("avx2");
+    if (kernel == CONVERT_SSSE3)
+        return __builtin_cpu_supports("ssse3");
+#endif
+    return kernel == CONVERT_SCALAR;
+}
+
+static ConvertKernel detectConvertKernel()
+{
+    if (kernelSupported(CONVERT_AVX2))
+        return CONVERT_AVX2;
+    if (kernelSupported(CONVERT_SSSE3))
+        return CONVERT_SSSE3;
+    return CONVERT_SCALAR;
+}
+
+ConvertKernel activeConvertKernel()
+{
+    static const ConvertKernel kernel = detectConvertKernel();
+    return kernel;
+}
+
+const char *convertKernelName(ConvertKernel kernel)
+{
+    switch (kernel)
+    {
+    case CONVERT_AVX2:
+        return "avx2";
+    case CONVERT_SSSE3:
+        return "ssse3";
+    default:
+        return "scalar";
+    }
+}
+
+void convertBGRXToRGB(const unsigned char *bgrx, unsigned char *rgb, size_t num_pixels)
+{
+    convertBGRXToRGB(bgrx, rgb, num_pixels, activeConvertKernel());
+}
+
+void convertBGRXToRGB(const unsigned char *bgrx, unsigned char *rgb, size_t num_pixels, ConvertKernel kernel)
+{
+    if (!kernelSupported(kernel))
+        kernel = CONVERT_SCALAR;
+
+#ifdef KINECT_CONVERT_X86
+    if (kernel == CONVERT_AVX2)
+    {
+        bgrxToRGBAVX2(bgrx, rgb, num_pixels);
+        return;
+    }
+    if (kernel == CONVERT_SSSE3)
+    {
+        bgrxToRGBSSSE3(bgrx, rgb, num_pixels);
+        return;
+    }
+#endif
+    bgrxToRGBScalar(bgrx, rgb, num_pixels);
+}
+
+static int colorScale(const ColorOutput &format)
+{
+    return format.scale == 2 || format.scale == 4 ? format.scale : 1;
+}
+
+int colorOutputWidth(int width, const ColorOutput &format)
+{
+    return width / colorScale(format);
+}
+
+int colorOutputHeight(int height, const ColorOutput &format)
+{
+    return height / colorScale(format);
+}
+
+size_t colorOutputBytes(int width, int height, const ColorOutput &format)
+{
+    size_t w = colorOutputWidth(width, format);
+    size_t h = colorOutputHeight(height, format);
+    if (format.layout == COLOR_LAYOUT_NV12)
+        return w * h + ((w + 1) / 2) * ((h + 1) / 2) * 2;
+    return w * h * 3;
+}
+
+// Output row `y` as BGRX: the source row itself at full size, otherwise box
+// filtered into `buffer`
+static const unsigned char *filteredRow(const unsigned char *bgrx, size_t stride, int y, int out_width, int scale,
+                                        ConvertKernel kernel, unsigned char *buffer)
+{
+    const unsigned char *row = bgrx + (size_t)y * scale * stride;
+    if (scale == 1)
+        return row;
+
+#ifdef KINECT_CONVERT_X86
+    if (kernel != CONVERT_SCALAR)
+    {
+        if (scale == 2)
+            boxFilterRow2SSE2(row, stride, out_width, buffer);
+        else
+            boxFilterRow4SSE2(row, stride, out_width, buffer);
+        return buffer;
+    }
+#endif
+    boxFilterRowScalar(row, stride, out_width, scale, buffer);
+    return buffer;
+}
+
+static void writePlanarRowScalar(const unsigned char *bgrx, unsigned char *r, unsigned char *g, unsigned char *b,
+                                 int width)
+{
+    for (int x = 0; x < width; x++)
+    {
+        r[x] = bgrx[x * 4 + 2];
+        g[x] = bgrx[x * 4 + 1];
+        b[x] = bgrx[x * 4 + 0];
+    }
+}
+
+// BT.601 limited range, as video encoders expect
+static void writeLumaRowScalar(const unsigned char *bgrx, unsigned char *y_out, int width)
+{
+    for (int x = 0; x < width; x++)
+    {
+        int b = bgrx[x * 4 + 0], g = bgrx[x * 4 + 1], r = bgrx[x * 4 + 2];
+        y_out[x] = (unsigned char)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+    }
+}
+
+#ifdef KINECT_CONVERT_X86
+
+// 16 pixels per iteration: gather each pixel's R, G, B and X into 32-bit
+// lanes, then transpose the four registers into R, G and B rows
+__attribute__((target("ssse3"))) static void writePlanarRowSSSE3(const unsigned char *bgrx, unsigned char *r,
+                                                                 unsigned char *g, unsigned char *b, int width)
+{
+    const __m128i shuffle = _mm_setr_epi8(2, 6, 10, 14, 1, 5, 9, 13, 0, 4, 8, 12, 3, 7, 11, 15);
+    int x = 0;
+
+    for (; x + 16 <= width; x += 16)
+    {
+        __m128i p0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(bgrx + x * 4)), shuffle);
+        __m128i p1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(bgrx + x * 4 + 16)), shuffle);
+        __m128i p2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(bgrx + x * 4 + 32)), shuffle);
+        __m128i p3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(bgrx + x * 4 + 48)), shuffle);
+
+        __m128i rg01 = _mm_unpacklo_epi32(p0, p1);
+        __m128i rg23 = _mm_unpacklo_epi32(p2, p3);
+        __m128i bx01 = _mm_unpackhi_epi32(p0, p1);
+        __m128i bx23 = _mm_unpackhi_epi32(p2, p3);
+        _mm_storeu_si128((__m128i *)(r + x), _mm_unpacklo_epi64(rg01, rg23));
+        _mm_storeu_si128((__m128i *)(g + x), _mm_unpackhi_epi64(rg01, rg23));
+        _mm_storeu_si128((__m128i *)(b + x), _mm_unpacklo_epi64(bx01, bx23));
+    }
+
+    writePlanarRowScalar(bgrx + x * 4, r + x, g + x, b + x, width - x);
+}
+
+// Weighted sums of 4 pixels' B, G, R: multiply-add as 16-bit pairs, then add the pairs
+__attribute__((target("ssse3"))) static inline __m128i weightedSums(__m128i px, __m128i coefficients)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(px, zero), coefficients);
+    __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(px, zero), coefficients);
+    return _mm_hadd_epi32(lo, hi);
+}
+
+__attribute__((target("ssse3"))) static void writeLumaRowSSSE3(const unsigned char *bgrx, unsigned char *y_out,
+                                                               int width)
+{
+    const __m128i coefficients = _mm_setr_epi16(25, 129, 66, 0, 25, 129, 66, 0);
+    const __m128i round = _mm_set1_epi32(128);
+    const __m128i offset = _mm_set1_epi16(16);
+    int x = 0;
+
+    for (; x + 8 <= width; x += 8)
+    {
+        __m128i y0 = weightedSums(_mm_loadu_si128((const __m128i *)(bgrx + x * 4)), coefficients);
+        __m128i y1 = weightedSums(_mm_loadu_si128((const __m128i *)(bgrx + x * 4 + 16)), coefficients);
+        y0 = _mm_srai_epi32(_mm_add_epi32(y0, round), 8);
+        y1 = _mm_srai_epi32(_mm_add_epi32(y1, round), 8);
+        __m128i y = _mm_add_epi16(_mm_packs_epi32(y0, y1), offset);
+        _mm_storel_epi64((__m128i *)(y_out + x), _mm_packus_epi16(y, y));
+    }
+
+    writeLumaRowScalar(bgrx + x * 4, y_out + x, width - x);
+}
+
+#endif
+
+static void writePlanarRow(const unsigned char *bgrx, unsigned char *r, unsigned char *g, unsigned char *b, int width,
+                           ConvertKernel kernel)
+{
+#ifdef KINECT_CONVERT_X86
+    if (kernel != CONVERT_SCALAR)
+    {
+        writePlanarRowSSSE3(bgrx, r, g, b, width);
+        return;
+    }
+#endif
+    writePlanarRowScalar(bgrx, r, g, b, width);
+}
+
+static void writeLumaRow(const unsigned char *bgrx, unsigned char *y_out, int width, ConvertKernel kernel)
+{
+#ifdef KINECT_CONVERT_X86
+    if (kernel != CONVERT_SCALAR)
+    {
+        writeLumaRowSSSE3(bgrx, y_out, width);
+        return;
+    }
+#endif
+    writeLumaRowScalar(bgrx, y_out, width);
+}
+
+// UV pixels [cx_begin, (width + 1) / 2) of a row, each from the 2x2 average of
+// two BGRX rows
+static void writeChromaRowScalar(const unsigned char *top, const unsigned char *bottom, unsigned char *uv, int width,
+                                 int cx_begin)
+{
+    for (int cx = cx_begin; cx < (width + 1) / 2; cx++)
+    {
+        int x0 = cx * 2 * 4;
+        int x1 = std::min(cx * 2 + 1, width - 1) * 4;
+        int b = (top[x0 + 0] + top[x1 + 0] + bottom[x0 + 0] + bottom[x1 + 0] + 2) >> 2;
+        int g = (top[x0 + 1] + top[x1 + 1] + bottom[x0 + 1] + bottom[x1 + 1] + 2) >> 2;
+        int r = (top[x0 + 2] + top[x1 + 2] + bottom[x0 + 2] + bottom[x1 + 2] + 2) >> 2;
+        uv[cx * 2 + 0] = (unsigned char)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+        uv[cx * 2 + 1] = (unsigned char)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+    }
+}
+
+#ifdef KINECT_CONVERT_X86
+
+// Interleaved UV from already averaged BGRX pixels, 8 per iteration
+__attribute__((target("ssse3"))) static int writeChromaSSSE3(const unsigned char *averaged, unsigned char *uv,
+                                                             int num_pixels)
+{
+    const __m128i u_coefficients = _mm_setr_epi16(112, -74, -38, 0, 112, -74, -38, 0);
+    const __m128i v_coefficients = _mm_setr_epi16(-18, -94, 112, 0, -18, -94, 112, 0);
+    const __m128i round = _mm_set1_epi32(128);
+    const __m128i offset = _mm_set1_epi16(128);
+    int x = 0;
+
+    for (; x + 8 <= num_pixels; x += 8)
+    {
+        __m128i p0 = _mm_loadu_si128((const __m128i *)(averaged + x * 4));
+        __m128i p1 = _mm_loadu_si128((const __m128i *)(averaged + x * 4 + 16));
+        __m128i u0 = _mm_srai_epi32(_mm_add_epi32(weightedSums(p0, u_coefficients), round), 8);
+        __m128i u1 = _mm_srai_epi32(_mm_add_epi32(weightedSums(p1, u_coefficients), round), 8);
+        __m128i v0 = _mm_srai_epi32(_mm_add_epi32(weightedSums(p0, v_coefficients), round), 8);
+        __m128i v1 = _mm_srai_epi32(_mm_add_epi32(weightedSums(p1, v_coefficients), round), 8);
+        __m128i u = _mm_add_epi16(_mm_packs_epi32(u0, u1), offset);
+        __m128i v = _mm_add_epi16(_mm_packs_epi32(v0, v1), offset);
+
+        // [u0..u7, v0..v7] -> u0 v0 u1 v1 ...
+        __m128i packed = _mm_packus_epi16(u, v);
+        _mm_storeu_si128((__m128i *)(uv + x * 2), _mm_unpacklo_epi8(packed, _mm_srli_si128(packed, 8)));
+    }
+    return x;
+}
+
+#endif
+
+// One UV row from two BGRX rows. `buffer` holds width / 2 BGRX pixels.
+static void writeChromaRow(const unsigned char *top, const unsigned char *bottom, unsigned char *uv, int width,
+                           ConvertKernel kernel, unsigned char *buffer)
+{
+    int cx = 0;
+#ifdef KINECT_CONVERT_X86
+    if (kernel != CONVERT_SCALAR)
+    {
+        // Both rows live in one buffer (or the source image), bottom at or after top
+        boxFilterRow2SSE2(top, bottom - top, width / 2, buffer);
+        cx = writeChromaSSSE3(buffer, uv, width / 2);
+    }
+#endif
+    writeChromaRowScalar(top, bottom, uv, width, cx);
+}
+
+void convertBGRX(const unsigned char *bgrx, int width, int height, unsigned char *out, const ColorOutput &format,
+                 int row_begin, int row_end)
+{
+    convertBGRX(bgrx, width, height, out, format, row_begin, row_end, activeConvertKernel());
+}
+
+void convertBGRX(const unsigned char *bgrx, int width, int height, unsigned char *out, const ColorOutput &format,
+                 int row_begin, int row_end, ConvertKernel kernel)
+{
+    if (!kernelSupported(kernel))
+        kernel = CONVERT_SCALAR;
+
+    const int scale = colorScale(format);
+    const int out_width = colorOutputWidth(width, format);
+    const int out_height = colorOutputHeight(height, format);
+    const size_t stride = (size_t)width * 4;
+    const size_t plane = (size_t)out_width * out_height;
+    row_end = std::min(row_end, out_height);
+    if (row_begin >= row_end)
+        return;
+
+    // Full-size packed RGB is one swizzle over the contiguous rows
+    if (scale == 1 && format.layout == COLOR_LAYOUT_RGB)
+    {
+        convertBGRXToRGB(bgrx + row_begin * stride, out + (size_t)row_begin * out_width * 3,
+                         (size_t)(row_end - row_begin) * out_width, kernel);
+        return;
+    }
+
+    // Filtered rows are small enough to stay in cache until they are written out
+    static thread_local std::vector<unsigned char> row_buffers;
+    if (row_buffers.size() < (size_t)out_width * 10)
+        row_buffers.resize((size_t)out_width * 10);
+    unsigned char *top_buffer = row_buffers.data();
+    unsigned char *bottom_buffer = top_buffer + out_width * 4;
+    unsigned char *chroma_buffer = bottom_buffer + out_width * 4;
+
+    if (format.layout == COLOR_LAYOUT_NV12)
+    {
+        // Rows go in pairs that share a row of UV
+        for (int y = row_begin; y < row_end; y += 2)
+        {
+            const unsigned char *top = filteredRow(bgrx, stride, y, out_width, scale, kernel, top_buffer);
+            const unsigned char *bottom = top;
+            writeLumaRow(top, out + (size_t)y * out_width, out_width, kernel);
+            if (y + 1 < out_height)
+            {
+                bottom = filteredRow(bgrx, stride, y + 1, out_width, scale, kernel, bottom_buffer);
+                writeLumaRow(bottom, out + (size_t)(y + 1) * out_width, out_width, kernel);
+            }
+            writeChromaRow(top, bottom, out + plane + (size_t)(y / 2) * ((out_width + 1) / 2) * 2, out_width, kernel,
+                           chroma_buffer);
+        }
+        return;
+    }
+
+    for (int y = row_begin; y < row_end; y++)
+    {
+        const unsigned char *row = filteredRow(bgrx, stride, y, out_width, scale, kernel, top_buffer);
+        if (format.layout == COLOR_LAYOUT_PLANAR)
+        {
+            size_t offset = (size_t)y * out_width;
+            writePlanarRow(row, out + offset, out + plane + offset, out + plane * 2 + offset, out_width, kernel);
+        }
+        else
+        {
+            convertBGRXToRGB(row, out + (size_t)y * out_width * 3, out_width, kernel);
+        }
+    }
+}
+
+void convertDepthToBytes(const float *depth, unsigned char *out, size_t num_pixels)
+{
+    for (size_t i = 0; i < num_pixels; i++)
+    {
+        float val = depth[i] / 4500.0f; // normalize to 0-4.5m
+        out[i] = (unsigned char)(val * 255.0f);
+    }
+}
+
+float maxIR(const float *ir, size_t num_pixels)
+{
+    return maxIR(ir, num_pixels, activeConvertKernel());
+}
+
+float maxIR(const float *ir, size_t num_pixels, ConvertKernel kernel)
+{
+    if (!kernelSupported(kernel))
+        kernel = CONVERT_SCALAR;
+
+#ifdef KINECT_CONVERT_X86
+    if (kernel == CONVERT_AVX2)
+        return maxIRAVX2(ir, num_pixels);
+    if (kernel == CONVERT_SSSE3)
+        return maxIRSSE2(ir, num_pixels);
+#endif
+    return maxIRScalar(ir, num_pixels);
+}
+
+float scaleIR(const float *ir, unsigned char *out, size_t num_pixels, float max_ir)
+{
+    return scaleIR(ir, out, num_pixels, max_ir, activeConvertKernel());
+}
+
+float scaleIR(const float *ir, unsigned char *out, size_t num_pixels, float max_ir, ConvertKernel kernel)
+{
+    if (!kernelSupported(kernel))
+        kernel = CONVERT_SCALAR;
+    float scale = max_ir > 0 ? 255.0f / max_ir : 0.0f;
+
+#ifdef KINECT_CONVERT_X86
+    if (kernel == CONVERT_AVX2)
+        return scaleIRAVX2(ir, out, num_pixels, scale);
+    if (kernel == CONVERT_SSSE3)
+        return scaleIRSSE2(ir, out, num_pixels, scale);
+#endif
+    return scaleIRScalar(ir, out, num_pixels, scale);
+}
+
+IRNormalizer::IRNormalizer(bool reuse_previous_max)
+    : reuse_previous_max(reuse_previous_max), previous_max(-1.0f) {}
+
+void IRNormalizer::normalize(const float *ir, unsigned char *out, size_t num_pixels)
+{
+    if (reuse_previous_max && previous_max >= 0)
+    {
+        previous_max = scaleIR(ir, out, num_pixels, previous_max);
+        return;
+    }
+
+    previous_max = maxIR(ir, num_pixels);
+    scaleIR(ir, out, num_pixels, previous_max);
+}
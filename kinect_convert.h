@@ -0,0 +1,87 @@
+#ifndef KINECT_CONVERT_H
+#define KINECT_CONVERT_H
+
+#include <cstddef>
+
+// Pixel conversion kernels shared by the capture functions.
+// SIMD variants are picked at runtime based on what the CPU supports.
+
+enum ConvertKernel
+{
+    CONVERT_SCALAR,
+    CONVERT_SSSE3,
+    CONVERT_AVX2
+};
+
+// Kernel used by the dispatching functions below
+ConvertKernel activeConvertKernel();
+const char *convertKernelName(ConvertKernel kernel);
+
+// BGRX (4 bytes per pixel) -> packed RGB (3 bytes per pixel)
+void convertBGRXToRGB(const unsigned char *bgrx, unsigned char *rgb, size_t num_pixels);
+
+// Force a specific kernel (falls back to scalar if the CPU lacks support)
+void convertBGRXToRGB(const unsigned char *bgrx, unsigned char *rgb, size_t num_pixels, ConvertKernel kernel);
+
+// Layouts the color conversion can write
+enum ColorLayout
+{
+    COLOR_LAYOUT_RGB,    // packed RGB, 3 bytes per pixel
+    COLOR_LAYOUT_PLANAR, // R plane, then G plane, then B plane
+    COLOR_LAYOUT_NV12    // BT.601 limited-range Y plane, then interleaved UV at half size
+};
+
+// Output of the color conversion: downscale factor (1, 2 or 4, box filtered)
+// and layout
+struct ColorOutput
+{
+    ColorOutput(int scale = 1, ColorLayout layout = COLOR_LAYOUT_RGB) : scale(scale), layout(layout) {}
+
+    int scale;
+    ColorLayout layout;
+};
+
+// Output size of a `width` x `height` image. Edge pixels that do not fill a
+// whole box are dropped.
+int colorOutputWidth(int width, const ColorOutput &format);
+int colorOutputHeight(int height, const ColorOutput &format);
+size_t colorOutputBytes(int width, int height, const ColorOutput &format);
+
+// BGRX -> `format` in one pass over the source. Writes output rows
+// [row_begin, row_end) of the whole `out` image so bands can run in parallel;
+// for NV12 row_begin must be even.
+void convertBGRX(const unsigned char *bgrx, int width, int height, unsigned char *out, const ColorOutput &format,
+                 int row_begin, int row_end);
+void convertBGRX(const unsigned char *bgrx, int width, int height, unsigned char *out, const ColorOutput &format,
+                 int row_begin, int row_end, ConvertKernel kernel);
+
+// Depth in mm -> 0-255 over 0-4.5m
+void convertDepthToBytes(const float *depth, unsigned char *out, size_t num_pixels);
+
+// Largest value in an IR image
+float maxIR(const float *ir, size_t num_pixels);
+
+// Scale IR to 0-255 by `max_ir` using a single reciprocal multiply. Values
+// above `max_ir` clamp to 255 and a non-positive `max_ir` gives a black image.
+// Returns this image's own max, computed in the same pass.
+float scaleIR(const float *ir, unsigned char *out, size_t num_pixels, float max_ir);
+
+// Force a specific kernel, as for convertBGRXToRGB
+float maxIR(const float *ir, size_t num_pixels, ConvertKernel kernel);
+float scaleIR(const float *ir, unsigned char *out, size_t num_pixels, float max_ir, ConvertKernel kernel);
+
+// Normalizes IR images to 0-255 by their max. By default each image is scaled
+// by its own max (a max pass, then a scale pass). With reuse_previous_max set,
+// images are scaled by the previous image's max so conversion is one pass.
+class IRNormalizer
+{
+public:
+    IRNormalizer(bool reuse_previous_max = false);
+
+    void normalize(const float *ir, unsigned char *out, size_t num_pixels);
+
+    bool reuse_previous_max;
+    float previous_max; // negative until the first image has been seen
+};
+
+#endif
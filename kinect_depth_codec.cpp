@@ -0,0 +1,398 @@
+#include "kinect_depth_codec.h"
+#include "kinect_profile.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define KINECT_DEPTH_CODEC_X86 1
+#include <immintrin.h>
+#endif
+
+static const char DEPTH_CODEC_MAGIC[4] = {'K', 'D', 'Z', '1'};
+static const size_t DEPTH_CODEC_HEADER_BYTES = 12; // magic, width, height
+
+// Residuals per Rice block, and the 4-bit block codes: a Rice parameter of
+// 0 to RICE_MAX_K, or a block of nothing but zeros
+static const int RICE_BLOCK = 32;
+static const int RICE_MAX_K = 13;
+static const uint32_t RICE_ZERO_BLOCK = 15;
+
+// Quotients from this on are escaped: the unary zeros, then the raw 16 bits
+static const uint32_t RICE_ESCAPE = 16;
+
+PROFILE_STAGE(depth_encode_stage, "depth_encode");
+PROFILE_STAGE(depth_decode_stage, "depth_decode");
+
+// Signed residuals interleaved into unsigned: 0, -1, 1, -2, 2...
+static inline uint16_t zigzag(uint16_t residual)
+{
+    return (uint16_t)((residual << 1) ^ (0 - (residual >> 15)));
+}
+
+static inline uint16_t unzigzag(uint16_t z)
+{
+    return (uint16_t)((z >> 1) ^ (0 - (z & 1)));
+}
+
+// LSB-first bit packing into 32-bit little-endian words
+class BitWriter
+{
+public:
+    BitWriter(unsigned char *out) : out(out), bits(0), count(0) {}
+
+    // Up to 32 bits at a time
+    void put(uint32_t value, int num_bits)
+    {
+        bits |= (uint64_t)value << count;
+        count += num_bits;
+        if (count >= 32)
+        {
+            uint32_t word = (uint32_t)bits;
+            memcpy(out, &word, 4);
+            out += 4;
+            bits >>= 32;
+            count -= 32;
+        }
+    }
+
+    unsigned char *finish()
+    {
+        uint32_t word = (uint32_t)bits;
+        memcpy(out, &word, 4);
+        return out + (count + 7) / 8;
+    }
+
+private:
+    unsigned char *out;
+    uint64_t bits;
+    int count;
+};
+
+class BitReader
+{
+public:
+    BitReader(const unsigned char *data, const unsigned char *end)
+        : data(data), end(end), available((size_t)(end - data) * 8), consumed(0), bits(0), count(0) {}
+
+    // Make at least 33 bits available; past the end they read as zeros
+    void refill()
+    {
+        while (count <= 32)
+        {
+            uint32_t word = 0;
+            size_t n = std::min<size_t>(4, end - data);
+            memcpy(&word, data, n);
+            data += n;
+            bits |= (uint64_t)word << count;
+            count += 32;
+        }
+    }
+
+    uint32_t peek() const { return (uint32_t)bits; }
+
+    void skip(int num_bits)
+    {
+        bits >>= num_bits;
+        count -= num_bits;
+        consumed += num_bits;
+    }
+
+    uint32_t take(int num_bits)
+    {
+        uint32_t value = (uint32_t)bits & (uint32_t)((1ull << num_bits) - 1);
+        skip(num_bits);
+        return value;
+    }
+
+    // True once more bits were taken than the data held
+    bool overran() const { return consumed > available; }
+
+private:
+    const unsigned char *data;
+    const unsigned char *end;
+    size_t available, consumed;
+    uint64_t bits;
+    int count;
+};
+
+static void depthToMillimetersScalar(const float *depth_mm, uint16_t *out, size_t begin, size_t end)
+{
+    for (size_t i = begin; i < end; i++)
+    {
+        float d = depth_mm[i];
+        if (!(d > 0.0f))
+            d = 0.0f;
+        if (d > 65535.0f)
+            d = 65535.0f;
+        out[i] = (uint16_t)lrintf(d);
+    }
+}
+
+// Residuals of one row against the pixel to the left
+static void rowResidualsScalar(const uint16_t *row, uint16_t *out, int begin, int end)
+{
+    for (int x = begin; x < end; x++)
+    {
+        out[x] = zigzag((uint16_t)(row[x] - row[x - 1]));
+    }
+}
+
+#ifdef KINECT_DEPTH_CODEC_X86
+
+// Clamp as floats (max_ps returns 0 for NaN), round to nearest even like
+// lrintf, then pack with unsigned saturation via the signed pack
+__attribute__((target("sse2"))) static size_t depthToMillimetersSSE2(const float *depth_mm, uint16_t *out,
+                                                                       size_t num_pixels)
+{
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 max_mm = _mm_set1_ps(65535.0f);
+    const __m128i bias = _mm_set1_epi32(32768);
+    const __m128i unbias = _mm_set1_epi16((short)0x8000);
+
+    size_t i = 0;
+    for (; i + 8 <= num_pixels; i += 8)
+    {
+        __m128 a = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(depth_mm + i), zero), max_mm);
+        __m128 b = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(depth_mm + i + 4), zero), max_mm);
+        __m128i ia = _mm_sub_epi32(_mm_cvtps_epi32(a), bias);
+        __m128i ib = _mm_sub_epi32(_mm_cvtps_epi32(b), bias);
+        _mm_storeu_si128((__m128i *)(out + i), _mm_xor_si128(_mm_packs_epi32(ia, ib), unbias));
+    }
+    return i;
+}
+
+__attribute__((target("sse2"))) static int rowResidualsSSE2(const uint16_t *row, uint16_t *out, int begin, int end)
+{
+    int x = begin;
+    for (; x + 8 <= end; x += 8)
+    {
+        __m128i r = _mm_sub_epi16(_mm_loadu_si128((const __m128i *)(row + x)),
+                                  _mm_loadu_si128((const __m128i *)(row + x - 1)));
+        __m128i z = _mm_xor_si128(_mm_slli_epi16(r, 1), _mm_srai_epi16(r, 15));
+        _mm_storeu_si128((__m128i *)(out + x), z);
+    }
+    return x;
+}
+
+#endif
+
+void depthToMillimeters(const float *depth_mm, uint16_t *out, size_t num_pixels)
+{
+    size_t done = 0;
+#ifdef KINECT_DEPTH_CODEC_X86
+    done = depthToMillimetersSSE2(depth_mm, out, num_pixels);
+#endif
+    depthToMillimetersScalar(depth_mm, out, done, num_pixels);
+}
+
+size_t depthCodecMaxBytes(int width, int height)
+{
+    size_t pixels = (size_t)width * height;
+    size_t blocks = (pixels + RICE_BLOCK - 1) / RICE_BLOCK;
+
+    // A block code and 32 bits per escaped residual, plus the last partial word
+    return DEPTH_CODEC_HEADER_BYTES + (blocks * 4 + pixels * 32 + 7) / 8 + 4;
+}
+
+// Bits a block costs with Rice parameter k
+static size_t riceBlockBits(const uint16_t *z, int count, int k)
+{
+    size_t bits = 4;
+    for (int i = 0; i < count; i++)
+    {
+        uint32_t q = z[i] >> k;
+        bits += q < RICE_ESCAPE ? q + 1 + k : RICE_ESCAPE + 16;
+    }
+    return bits;
+}
+
+// The cost falls and then rises with k, so walk up from 0 until it rises.
+// (An estimate from the block's mean would be thrown off by one escaped
+// residual at the edge of an invalid region.)
+static int riceParameter(const uint16_t *z, int count)
+{
+    int best = 0;
+    size_t best_bits = riceBlockBits(z, count, 0);
+    for (int k = 1; k <= RICE_MAX_K; k++)
+    {
+        size_t bits = riceBlockBits(z, count, k);
+        if (bits >= best_bits)
+            break;
+        best = k;
+        best_bits = bits;
+    }
+    return best;
+}
+
+static void encodeBlocks(const uint16_t *z, size_t count, BitWriter &writer)
+{
+    for (size_t begin = 0; begin < count; begin += RICE_BLOCK)
+    {
+        int n = (int)std::min<size_t>(RICE_BLOCK, count - begin);
+        const uint16_t *block = z + begin;
+
+        uint32_t sum = 0;
+        for (int i = 0; i < n; i++)
+        {
+            sum += block[i];
+        }
+        if (sum == 0)
+        {
+            writer.put(RICE_ZERO_BLOCK, 4);
+            continue;
+        }
+
+        int k = riceParameter(block, n);
+        writer.put(k, 4);
+        uint32_t mask = (1u << k) - 1;
+        for (int i = 0; i < n; i++)
+        {
+            uint32_t q = block[i] >> k;
+            if (q < RICE_ESCAPE)
+            {
+                // q zeros, a one, then the low k bits
+                writer.put((1u << q) | ((block[i] & mask) << (q + 1)), q + 1 + k);
+            }
+            else
+            {
+                writer.put(0, RICE_ESCAPE);
+                writer.put(block[i], 16);
+            }
+        }
+    }
+}
+
+static bool decodeBlocks(BitReader &reader, uint16_t *z, size_t count)
+{
+    for (size_t begin = 0; begin < count; begin += RICE_BLOCK)
+    {
+        int n = (int)std::min<size_t>(RICE_BLOCK, count - begin);
+        uint16_t *block = z + begin;
+
+        reader.refill();
+        uint32_t k = reader.take(4);
+        if (k == RICE_ZERO_BLOCK)
+        {
+            memset(block, 0, n * sizeof(uint16_t));
+            continue;
+        }
+        if (k > (uint32_t)RICE_MAX_K)
+            return false;
+
+        for (int i = 0; i < n; i++)
+        {
+            reader.refill();
+            uint32_t window = reader.peek() & ((1u << RICE_ESCAPE) - 1);
+            if (window == 0)
+            {
+                reader.skip(RICE_ESCAPE);
+                block[i] = (uint16_t)reader.take(16);
+                continue;
+            }
+            int q = __builtin_ctz(window);
+            reader.skip(q + 1);
+            block[i] = (uint16_t)(((uint32_t)q << k) | reader.take(k));
+        }
+    }
+    return !reader.overran();
+}
+
+// Header, then the residuals of the whole frame as one run of blocks
+size_t encodeDepth16(const uint16_t *depth, int width, int height, unsigned char *out)
+{
+    PROFILE_SCOPE(depth_encode_stage);
+    thread_local std::vector<uint16_t> residuals;
+    size_t pixels = (size_t)width * height;
+    residuals.resize(pixels);
+
+    for (int y = 0; y < height; y++)
+    {
+        const uint16_t *row = depth + (size_t)y * width;
+        uint16_t *z = &residuals[(size_t)y * width];
+        if (width == 0)
+            break;
+
+        // The first column is predicted from above (the very first pixel from 0)
+        z[0] = zigzag((uint16_t)(row[0] - (y > 0 ? row[-width] : 0)));
+        int x = 1;
+#ifdef KINECT_DEPTH_CODEC_X86
+        x = rowResidualsSSE2(row, z, 1, width);
+#endif
+        rowResidualsScalar(row, z, x, width);
+    }
+
+    uint32_t size[2] = {(uint32_t)width, (uint32_t)height};
+    memcpy(out, DEPTH_CODEC_MAGIC, 4);
+    memcpy(out + 4, size, 8);
+
+    BitWriter writer(out + DEPTH_CODEC_HEADER_BYTES);
+    encodeBlocks(residuals.data(), pixels, writer);
+    return writer.finish() - out;
+}
+
+size_t encodeDepth(const float *depth_mm, int width, int height, unsigned char *out)
+{
+    thread_local std::vector<uint16_t> millimeters;
+    millimeters.resize((size_t)width * height);
+    depthToMillimeters(depth_mm, millimeters.data(), millimeters.size());
+    return encodeDepth16(millimeters.data(), width, height, out);
+}
+
+bool depthCodecDimensions(const unsigned char *data, size_t bytes, int &width, int &height)
+{
+    if (bytes < DEPTH_CODEC_HEADER_BYTES || memcmp(data, DEPTH_CODEC_MAGIC, 4) != 0)
+        return false;
+
+    uint32_t size[2];
+    memcpy(size, data + 4, 8);
+    if (size[0] > 65535 || size[1] > 65535)
+        return false;
+    width = (int)size[0];
+    height = (int)size[1];
+    return true;
+}
+
+bool decodeDepth16(const unsigned char *data, size_t bytes, uint16_t *out, int width, int height)
+{
+    PROFILE_SCOPE(depth_decode_stage);
+    int stored_width, stored_height;
+    if (!depthCodecDimensions(data, bytes, stored_width, stored_height) || stored_width != width ||
+        stored_height != height)
+    {
+        return false;
+    }
+
+    // Residuals straight into the output, then undone row by row in place
+    BitReader reader(data + DEPTH_CODEC_HEADER_BYTES, data + bytes);
+    if (!decodeBlocks(reader, out, (size_t)width * height))
+        return false;
+
+    for (int y = 0; y < height && width > 0; y++)
+    {
+        uint16_t *row = out + (size_t)y * width;
+        uint16_t previous = y > 0 ? row[-width] : 0;
+        for (int x = 0; x < width; x++)
+        {
+            previous = (uint16_t)(previous + unzigzag(row[x]));
+            row[x] = previous;
+        }
+    }
+    return true;
+}
+
+bool decodeDepth(const unsigned char *data, size_t bytes, float *out, int width, int height)
+{
+    thread_local std::vector<uint16_t> millimeters;
+    size_t pixels = (size_t)width * height;
+    millimeters.resize(pixels);
+    if (!decodeDepth16(data, bytes, millimeters.data(), width, height))
+        return false;
+
+    for (size_t i = 0; i < pixels; i++)
+    {
+        out[i] = millimeters[i];
+    }
+    return true;
+}
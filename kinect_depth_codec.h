@@ -0,0 +1,34 @@
+#ifndef KINECT_DEPTH_CODEC_H
+#define KINECT_DEPTH_CODEC_H
+
+#include <cstddef>
+#include <stdint.h>
+
+// Lossless codec for depth frames as 16-bit millimeters. Each pixel is
+// predicted from its left neighbour (the first column from the pixel above),
+// the residuals are zigzag mapped and Rice coded in blocks of 32, each block
+// with its own parameter; blocks of zero residuals take 4 bits. Every frame
+// is coded on its own, so a recording can be decoded from any frame.
+//
+// Float depth is rounded to whole millimeters first, which is the sensor's
+// own resolution; the uint16 variants are exact.
+
+// Largest encoded size of a width x height frame
+size_t depthCodecMaxBytes(int width, int height);
+
+// Encode into `out` (depthCodecMaxBytes big); returns the bytes written
+size_t encodeDepth16(const uint16_t *depth, int width, int height, unsigned char *out);
+size_t encodeDepth(const float *depth_mm, int width, int height, unsigned char *out);
+
+// Frame size stored in an encoded frame; false if it is not one
+bool depthCodecDimensions(const unsigned char *data, size_t bytes, int &width, int &height);
+
+// Decode a width x height frame. Returns false if the data is not a
+// complete frame of that size.
+bool decodeDepth16(const unsigned char *data, size_t bytes, uint16_t *out, int width, int height);
+bool decodeDepth(const unsigned char *data, size_t bytes, float *out, int width, int height);
+
+// Round depth to whole millimeters, clamped to 0-65535 (NaN becomes 0)
+void depthToMillimeters(const float *depth_mm, uint16_t *out, size_t num_pixels);
+
+#endif
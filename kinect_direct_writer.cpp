@@ -0,0 +1,501 @@
+#include "kinect_direct_writer.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#if defined(__linux__) && defined(__NR_io_uring_setup) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define KINECT_DIRECT_WRITER_IO_URING
+#endif
+#endif
+
+// O_DIRECT needs the buffer address, file offset and length aligned to the
+// device's logical block size; a page covers every common one
+static const size_t DIRECT_ALIGNMENT = 4096;
+
+static bool pwriteAll(int fd, const unsigned char *data, size_t bytes, uint64_t offset)
+{
+    while (bytes > 0)
+    {
+        ssize_t n = pwrite(fd, data, bytes, offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        data += n;
+        bytes -= n;
+        offset += n;
+    }
+    return true;
+}
+
+#ifdef KINECT_DIRECT_WRITER_IO_URING
+
+// The submission and completion rings shared with the kernel, used through
+// the raw system calls so there is no liburing to install
+struct IoUring
+{
+    int fd;
+    void *sq_map, *cq_map;
+    size_t sq_map_bytes, cq_map_bytes;
+    io_uring_sqe *sqes;
+    size_t sqes_bytes;
+
+    unsigned *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    io_uring_cqe *cqes;
+
+    // IORING_OP_WRITEV (Linux 5.1) rather than IORING_OP_WRITE (5.6), so the
+    // vector of each buffer's write lives here until it completes
+    std::vector<iovec> iovecs; // by buffer
+};
+
+bool DirectFileWriter::start_io_uring(int num_buffers)
+{
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int ring_fd = syscall(__NR_io_uring_setup, num_buffers, &params);
+    if (ring_fd < 0)
+        return false;
+
+    ring = new IoUring();
+    ring->fd = ring_fd;
+    ring->iovecs.resize(num_buffers);
+    ring->sq_map_bytes = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_map_bytes = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+#ifdef IORING_FEAT_SINGLE_MMAP
+    bool single_map = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+#else
+    bool single_map = false; // headers older than Linux 5.4
+#endif
+    if (single_map)
+        ring->sq_map_bytes = ring->cq_map_bytes = std::max(ring->sq_map_bytes, ring->cq_map_bytes);
+    ring->sqes_bytes = params.sq_entries * sizeof(io_uring_sqe);
+
+    ring->sq_map = mmap(nullptr, ring->sq_map_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd,
+                        IORING_OFF_SQ_RING);
+    ring->cq_map = single_map ? ring->sq_map
+                              : mmap(nullptr, ring->cq_map_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                     ring_fd, IORING_OFF_CQ_RING);
+    ring->sqes = (io_uring_sqe *)mmap(nullptr, ring->sqes_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                      ring_fd, IORING_OFF_SQES);
+    if (ring->sq_map == MAP_FAILED || ring->cq_map == MAP_FAILED || ring->sqes == MAP_FAILED)
+    {
+        stop_io_uring();
+        return false;
+    }
+
+    unsigned char *sq = (unsigned char *)ring->sq_map;
+    unsigned char *cq = (unsigned char *)ring->cq_map;
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (io_uring_cqe *)(cq + params.cq_off.cqes);
+    return true;
+}
+
+void DirectFileWriter::stop_io_uring()
+{
+    if (!ring)
+        return;
+    if (ring->sqes != MAP_FAILED)
+        munmap(ring->sqes, ring->sqes_bytes);
+    if (ring->cq_map != MAP_FAILED && ring->cq_map != ring->sq_map)
+        munmap(ring->cq_map, ring->cq_map_bytes);
+    if (ring->sq_map != MAP_FAILED)
+        munmap(ring->sq_map, ring->sq_map_bytes);
+    ::close(ring->fd);
+    delete ring;
+    ring = nullptr;
+}
+
+void DirectFileWriter::submit_io_uring(const PendingWrite &pending)
+{
+    // At most one write per buffer is in flight and the ring has an entry
+    // per buffer, so there is always a free submission entry
+    unsigned tail = *ring->sq_tail;
+    unsigned slot = tail & *ring->sq_mask;
+    io_uring_sqe &sqe = ring->sqes[slot];
+    iovec &vec = ring->iovecs[pending.buffer];
+    vec.iov_base = buffers[pending.buffer] + pending.done;
+    vec.iov_len = pending.bytes - pending.done;
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode = IORING_OP_WRITEV;
+    sqe.fd = fd;
+    sqe.addr = (uint64_t)(uintptr_t)&vec;
+    sqe.len = 1;
+    sqe.off = pending.offset + pending.done;
+    sqe.user_data = pending.buffer;
+    ring->sq_array[slot] = slot;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    in_ring[pending.buffer] = pending;
+    ring_in_flight++;
+    while (syscall(__NR_io_uring_enter, ring->fd, 1, 0, 0, nullptr, 0) < 0)
+    {
+        if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+        {
+            // Never submitted, so it will not complete either
+            failed = true;
+            ring_in_flight--;
+            free_buffers.push_back(pending.buffer);
+            break;
+        }
+    }
+}
+
+// Collect finished writes, waiting for at least one if `wait` is set.
+// Returns false if the ring itself failed, in which case nothing more will
+// complete.
+bool DirectFileWriter::reap_io_uring(bool wait)
+{
+    unsigned head = *ring->cq_head;
+    if (wait && head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+    {
+        if (syscall(__NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0) < 0 && errno != EINTR)
+        {
+            failed = true;
+            return false;
+        }
+    }
+
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; head++)
+    {
+        const io_uring_cqe &cqe = ring->cqes[head & *ring->cq_mask];
+        PendingWrite &pending = in_ring[cqe.user_data];
+        ring_in_flight--;
+
+        if (cqe.res <= 0)
+        {
+            failed = true;
+            free_buffers.push_back(pending.buffer);
+            continue;
+        }
+
+        pending.done += cqe.res;
+        if (pending.done < pending.bytes && direct_io)
+        {
+            // The rest would start off a block boundary, which O_DIRECT
+            // refuses; a regular file only writes short when the disk is full
+            failed = true;
+            free_buffers.push_back(pending.buffer);
+            continue;
+        }
+        if (pending.done < pending.bytes)
+        {
+            // Short write (e.g. a signal); queue the rest after this loop
+            // has moved past the entry
+            __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+            submit_io_uring(pending);
+            tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+            continue;
+        }
+        free_buffers.push_back(pending.buffer);
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    return true;
+}
+
+#else
+
+struct IoUring
+{
+};
+
+bool DirectFileWriter::start_io_uring(int)
+{
+    return false;
+}
+
+void DirectFileWriter::stop_io_uring()
+{
+}
+
+void DirectFileWriter::submit_io_uring(const PendingWrite &)
+{
+}
+
+bool DirectFileWriter::reap_io_uring(bool)
+{
+    return false;
+}
+
+#endif
+
+DirectFileWriter::DirectFileWriter(const char *filename, uint64_t preallocate_bytes, size_t buffer_bytes,
+                                   int num_buffers, bool use_io_uring)
+    : fd(-1), mode(WriterThread), direct_io(true), failed(false), preallocated(0), current(-1), fill(0), file_offset(0),
+      stall_count(0), stall_seconds(0), ring(nullptr), ring_in_flight(0), thread_in_flight(0), thread_failed(false),
+      stopping(false)
+{
+    this->buffer_bytes = std::max((buffer_bytes + DIRECT_ALIGNMENT - 1) / DIRECT_ALIGNMENT * DIRECT_ALIGNMENT,
+                                  DIRECT_ALIGNMENT);
+    num_buffers = std::max(num_buffers, 2);
+
+    fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+    if (fd < 0 && errno == EINVAL)
+    {
+        std::cout << "No O_DIRECT on this filesystem, writing through the page cache" << std::endl;
+        direct_io = false;
+        fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    }
+    if (fd < 0)
+        return;
+
+    // Keep the size at 0 so readers only see what has been written; close()
+    // releases whatever was reserved beyond the end
+    if (preallocate_bytes > 0 && fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, preallocate_bytes) == 0)
+        preallocated = preallocate_bytes;
+
+    for (int i = 0; i < num_buffers; i++)
+    {
+        void *buffer = nullptr;
+        if (posix_memalign(&buffer, DIRECT_ALIGNMENT, this->buffer_bytes) != 0)
+        {
+            std::cout << "Could not allocate write buffers" << std::endl;
+            close();
+            return;
+        }
+        memset(buffer, 0, this->buffer_bytes); // fault the pages in now
+        buffers.push_back((unsigned char *)buffer);
+        free_buffers.push_back(i);
+    }
+
+    if (use_io_uring && start_io_uring(num_buffers))
+    {
+        mode = IoUringQueue;
+        in_ring.resize(num_buffers);
+    }
+    else
+    {
+        if (use_io_uring)
+            std::cout << "io_uring unavailable, writing from a thread" << std::endl;
+        thread = std::thread(&DirectFileWriter::worker, this);
+    }
+}
+
+DirectFileWriter::~DirectFileWriter()
+{
+    close();
+}
+
+void DirectFileWriter::worker()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        queued_cv.wait(lock, [this]
+                       { return !queue.empty() || stopping; });
+        if (queue.empty())
+            break;
+
+        PendingWrite pending = queue.front();
+        queue.pop_front();
+        lock.unlock();
+        bool ok = pwriteAll(fd, buffers[pending.buffer], pending.bytes, pending.offset);
+        lock.lock();
+
+        if (!ok)
+            thread_failed = true;
+        free_buffers.push_back(pending.buffer);
+        thread_in_flight--;
+        done_cv.notify_all();
+    }
+}
+
+int DirectFileWriter::acquire_buffer()
+{
+    auto start = std::chrono::steady_clock::now();
+    bool stalled = false;
+    int buffer = -1;
+    if (ring)
+    {
+        reap_io_uring(false);
+        while (free_buffers.empty())
+        {
+            stalled = true;
+            if (!reap_io_uring(true))
+                break;
+        }
+        if (!free_buffers.empty())
+        {
+            buffer = free_buffers.back();
+            free_buffers.pop_back();
+        }
+    }
+    else
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (free_buffers.empty())
+        {
+            stalled = true;
+            done_cv.wait(lock, [this]
+                         { return !free_buffers.empty(); });
+        }
+        buffer = free_buffers.back();
+        free_buffers.pop_back();
+        failed = failed || thread_failed;
+    }
+
+    if (stalled)
+    {
+        stall_count++;
+        stall_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    if (failed && buffer >= 0)
+    {
+        // Keep the buffer for close() to free, but write nothing more
+        if (ring)
+            free_buffers.push_back(buffer);
+        else
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            free_buffers.push_back(buffer);
+        }
+        return -1;
+    }
+    return buffer;
+}
+
+void DirectFileWriter::queue_buffer(int buffer, size_t bytes)
+{
+    PendingWrite pending = {buffer, file_offset, bytes, 0};
+    if (ring)
+    {
+        submit_io_uring(pending);
+    }
+    else
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.push_back(pending);
+        thread_in_flight++;
+        queued_cv.notify_one();
+    }
+}
+
+void DirectFileWriter::drain()
+{
+    if (ring)
+    {
+        // The kernel may still be reading buffers of failed writes, so
+        // everything in flight has to come back before they are freed
+        while (ring_in_flight > 0)
+        {
+            if (!reap_io_uring(true))
+                break;
+        }
+    }
+    else
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        done_cv.wait(lock, [this]
+                     { return thread_in_flight == 0; });
+        failed = failed || thread_failed;
+    }
+}
+
+bool DirectFileWriter::write(const void *data, size_t bytes)
+{
+    const unsigned char *src = (const unsigned char *)data;
+    while (bytes > 0 && fd >= 0)
+    {
+        if (current < 0)
+        {
+            current = acquire_buffer();
+            fill = 0;
+            if (current < 0)
+                return false;
+        }
+
+        size_t n = std::min(bytes, buffer_bytes - fill);
+        memcpy(buffers[current] + fill, src, n);
+        fill += n;
+        src += n;
+        bytes -= n;
+
+        if (fill == buffer_bytes)
+        {
+            queue_buffer(current, fill);
+            file_offset += fill;
+            current = -1;
+            fill = 0;
+        }
+    }
+    return fd >= 0 && !failed;
+}
+
+void DirectFileWriter::patch(uint64_t offset, const void *data, size_t bytes)
+{
+    Patch patch;
+    patch.offset = offset;
+    patch.data.assign((const unsigned char *)data, (const unsigned char *)data + bytes);
+    patches.push_back(patch);
+}
+
+bool DirectFileWriter::close()
+{
+    if (fd < 0)
+        return false;
+
+    drain();
+    if (ring)
+    {
+        stop_io_uring();
+    }
+    else if (thread.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        queued_cv.notify_one();
+        thread.join();
+    }
+
+    // The last partial buffer and the patches are not block sized, so they
+    // go through the page cache
+    if (direct_io)
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+    if (current >= 0 && fill > 0 && !failed)
+    {
+        failed = !pwriteAll(fd, buffers[current], fill, file_offset);
+        file_offset += fill;
+    }
+    current = -1;
+    fill = 0;
+
+    for (size_t i = 0; i < patches.size() && !failed; i++)
+    {
+        const Patch &patch = patches[i];
+        if (patch.offset + patch.data.size() <= file_offset)
+            failed = !pwriteAll(fd, patch.data.data(), patch.data.size(), patch.offset);
+    }
+    patches.clear();
+
+    // Give back the blocks reserved past the end
+    if (preallocated > file_offset && ftruncate(fd, file_offset) != 0)
+        failed = true;
+
+    if (::close(fd) != 0)
+        failed = true;
+    fd = -1;
+
+    for (size_t i = 0; i < buffers.size(); i++)
+        free(buffers[i]);
+    buffers.clear();
+    free_buffers.clear();
+    return !failed;
+}
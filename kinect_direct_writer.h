@@ -0,0 +1,124 @@
+#ifndef KINECT_DIRECT_WRITER_H
+#define KINECT_DIRECT_WRITER_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+struct IoUring;
+
+// Appends to a file at disk bandwidth without going through the page cache,
+// so the caller never stalls behind a writeback flush. Data is copied into a
+// fixed set of page-aligned buffers; each full buffer is written with
+// O_DIRECT while the next one fills. The writes are queued on io_uring where
+// the kernel allows it, otherwise a writer thread issues them, so write()
+// only blocks when every buffer is still on its way to disk.
+//
+// Filesystems without O_DIRECT (and kernels before 5.1, without io_uring)
+// still work, through the page cache and the writer thread respectively.
+class DirectFileWriter
+{
+public:
+    enum Backend
+    {
+        IoUringQueue,
+        WriterThread
+    };
+
+    // `preallocate_bytes` reserves the expected size on disk up front so the
+    // filesystem does not allocate blocks while writing; the file still only
+    // grows as it is written. `num_buffers` of `buffer_bytes` each bound the
+    // memory use and how far the disk may fall behind.
+    DirectFileWriter(const char *filename, uint64_t preallocate_bytes = 0, size_t buffer_bytes = 4 * 1024 * 1024,
+                     int num_buffers = 8, bool use_io_uring = true);
+    ~DirectFileWriter();
+
+    bool is_open() const { return fd >= 0; }
+    Backend backend() const { return mode; }
+    bool direct() const { return direct_io; }
+
+    // Append `bytes`. Returns false once any write has failed.
+    bool write(const void *data, size_t bytes);
+
+    // Overwrite `bytes` at `offset` of the data when the file is closed,
+    // e.g. to fill in a count in a header written before it was known
+    void patch(uint64_t offset, const void *data, size_t bytes);
+
+    // Finish all writes and close the file; false if any write failed
+    bool close();
+
+    uint64_t bytes_written() const { return file_offset + fill; }
+
+    // How often, and for how long in total, write() waited for a buffer
+    int stalls() const { return stall_count; }
+    double stall_ms() const { return stall_seconds * 1000.0; }
+
+private:
+    DirectFileWriter(const DirectFileWriter &) = delete;
+    DirectFileWriter &operator=(const DirectFileWriter &) = delete;
+
+    struct Patch
+    {
+        uint64_t offset;
+        std::vector<unsigned char> data;
+    };
+
+    // A buffer on its way to disk
+    struct PendingWrite
+    {
+        int buffer;
+        uint64_t offset;
+        size_t bytes;
+        size_t done;
+    };
+
+    bool start_io_uring(int num_buffers);
+    void stop_io_uring();
+    void submit_io_uring(const PendingWrite &pending);
+    bool reap_io_uring(bool wait);
+
+    void worker();
+
+    // Index of a free buffer, waiting for one if needed; -1 after a failure
+    int acquire_buffer();
+    void queue_buffer(int buffer, size_t bytes);
+    void drain();
+
+    int fd;
+    Backend mode;
+    bool direct_io;
+    bool failed;
+    uint64_t preallocated;
+
+    size_t buffer_bytes;
+    std::vector<unsigned char *> buffers;
+    std::vector<int> free_buffers;
+    int current; // buffer being filled, -1 if none
+    size_t fill;
+    uint64_t file_offset; // where the current buffer goes
+    std::vector<Patch> patches;
+
+    int stall_count;
+    double stall_seconds;
+
+    // io_uring backend
+    IoUring *ring;
+    std::vector<PendingWrite> in_ring; // by buffer
+    int ring_in_flight;
+
+    // Writer thread backend
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable queued_cv;
+    std::condition_variable done_cv;
+    std::deque<PendingWrite> queue;
+    int thread_in_flight;
+    bool thread_failed;
+    bool stopping;
+};
+
+#endif
@@ -0,0 +1,217 @@
+#include "kinect_frame.h"
+#include "kinect_profile.h"
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+
+PROFILE_STAGE(wait_stage, "wait_for_frames");
+
+FrameLease::FrameLease() : source(nullptr) {}
+
+FrameLease::FrameLease(FrameLease &&other) : source(other.source)
+{
+    frames.swap(other.frames);
+    other.source = nullptr;
+}
+
+FrameLease &FrameLease::operator=(FrameLease &&other)
+{
+    if (this != &other)
+    {
+        release();
+        source = other.source;
+        frames.swap(other.frames);
+        other.source = nullptr;
+    }
+    return *this;
+}
+
+FrameLease::~FrameLease()
+{
+    release();
+}
+
+bool FrameLease::acquire(FrameSource &source, int timeout_ms)
+{
+    release();
+
+    {
+        PROFILE_SCOPE(wait_stage);
+        if (!source.wait_for_frames(frames, timeout_ms))
+            return false;
+    }
+    this->source = &source;
+    source.frame_stats().observe(frames);
+    return true;
+}
+
+void FrameLease::release()
+{
+    if (source)
+        source->release(frames);
+    source = nullptr;
+    frames.clear();
+}
+
+libfreenect2::Frame *FrameLease::frame(libfreenect2::Frame::Type type) const
+{
+    libfreenect2::FrameMap::const_iterator it = frames.find(type);
+    return it == frames.end() ? nullptr : it->second;
+}
+
+FrameView FrameLease::view(libfreenect2::Frame::Type type) const
+{
+    return frameView(frame(type));
+}
+
+FrameView frameView(const libfreenect2::Frame *f)
+{
+    FrameView view = {};
+    if (!f)
+        return view;
+
+    view.data = f->data;
+    view.width = (int)f->width;
+    view.height = (int)f->height;
+    view.bytes_per_pixel = (int)f->bytes_per_pixel;
+    view.format = f->format;
+    view.timestamp = f->timestamp;
+    view.sequence = f->sequence;
+    return view;
+}
+
+// Device timestamps count 0.1 ms ticks
+static const double TIMESTAMP_MS = 0.1;
+
+FrameStatsTracker::FrameStatsTracker(double late_threshold_ms) : late_threshold_ms(late_threshold_ms)
+{
+    reset();
+}
+
+void FrameStatsTracker::reset()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    StreamState empty = {};
+    color = depth = ir = empty;
+    skew_samples = 0;
+    skew_sum = skew_min = skew_max = 0;
+}
+
+void FrameStatsTracker::observe_stream(StreamState &state, const libfreenect2::Frame *frame, double host_ms)
+{
+    double delay_ms = host_ms - frame->timestamp * TIMESTAMP_MS;
+    int32_t step = (int32_t)(frame->sequence - state.last_sequence);
+
+    // First frame, or the sequence went backwards (device restart, replay loop)
+    if (!state.seen || step <= 0)
+    {
+        state.seen = true;
+        state.last_sequence = frame->sequence;
+        state.last_timestamp = frame->timestamp;
+        state.min_delay_ms = delay_ms;
+        state.frames++;
+        return;
+    }
+
+    state.frames++;
+    state.dropped += step - 1;
+
+    // Interval per frame, so a gap doesn't read as jitter
+    double interval = (uint32_t)(frame->timestamp - state.last_timestamp) * TIMESTAMP_MS / step;
+    state.intervals++;
+    double delta = interval - state.interval_mean;
+    state.interval_mean += delta / state.intervals;
+    state.interval_m2 += delta * (interval - state.interval_mean);
+
+    if (delay_ms < state.min_delay_ms)
+        state.min_delay_ms = delay_ms;
+    else if (delay_ms - state.min_delay_ms > late_threshold_ms)
+        state.late++;
+
+    state.last_sequence = frame->sequence;
+    state.last_timestamp = frame->timestamp;
+}
+
+void FrameStatsTracker::observe(const libfreenect2::FrameMap &frames)
+{
+    double host_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now().time_since_epoch()).count();
+
+    libfreenect2::FrameMap::const_iterator rgb = frames.find(libfreenect2::Frame::Color);
+    libfreenect2::FrameMap::const_iterator d = frames.find(libfreenect2::Frame::Depth);
+    libfreenect2::FrameMap::const_iterator i = frames.find(libfreenect2::Frame::Ir);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (rgb != frames.end())
+        observe_stream(color, rgb->second, host_ms);
+    if (d != frames.end())
+        observe_stream(depth, d->second, host_ms);
+    if (i != frames.end())
+        observe_stream(ir, i->second, host_ms);
+
+    if (rgb != frames.end() && d != frames.end())
+    {
+        double skew = (int32_t)(rgb->second->timestamp - d->second->timestamp) * TIMESTAMP_MS;
+        if (skew_samples == 0 || skew < skew_min)
+            skew_min = skew;
+        if (skew_samples == 0 || skew > skew_max)
+            skew_max = skew;
+        skew_sum += skew;
+        skew_samples++;
+    }
+}
+
+StreamStats FrameStatsTracker::summarize(const StreamState &state)
+{
+    StreamStats stats = {};
+    stats.frames = state.frames;
+    stats.dropped = state.dropped;
+    stats.late = state.late;
+    stats.interval_ms = state.interval_mean;
+    stats.jitter_ms = state.intervals > 1 ? std::sqrt(state.interval_m2 / (state.intervals - 1)) : 0;
+    return stats;
+}
+
+FrameStats FrameStatsTracker::stats()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    FrameStats stats;
+    stats.color = summarize(color);
+    stats.depth = summarize(depth);
+    stats.ir = summarize(ir);
+    stats.skew_samples = skew_samples;
+    stats.skew_mean_ms = skew_samples ? skew_sum / skew_samples : 0;
+    stats.skew_min_ms = skew_min;
+    stats.skew_max_ms = skew_max;
+    return stats;
+}
+
+static void printStream(std::ostream &out, const char *name, const StreamStats &s)
+{
+    if (s.frames == 0)
+        return;
+    out << "  " << std::left << std::setw(8) << name << std::right << s.frames << " frames, " << s.dropped
+        << " dropped, " << s.late << " late, interval " << s.interval_ms << " ms, jitter " << s.jitter_ms << " ms"
+        << std::endl;
+}
+
+void FrameStatsTracker::print(std::ostream &out)
+{
+    FrameStats s = stats();
+
+    std::ios::fmtflags flags = out.flags();
+    std::streamsize precision = out.precision();
+    out << std::fixed << std::setprecision(2);
+
+    out << "Frame delivery:" << std::endl;
+    printStream(out, "color", s.color);
+    printStream(out, "depth", s.depth);
+    printStream(out, "ir", s.ir);
+    if (s.skew_samples > 0)
+    {
+        out << "  color-depth skew: mean " << s.skew_mean_ms << " ms, range " << s.skew_min_ms << " to "
+            << s.skew_max_ms << " ms" << std::endl;
+    }
+
+    out.flags(flags);
+    out.precision(precision);
+}
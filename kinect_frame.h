@@ -0,0 +1,160 @@
+#ifndef KINECT_FRAME_H
+#define KINECT_FRAME_H
+
+#include <libfreenect2/libfreenect2.hpp>
+#include <libfreenect2/frame_listener_impl.h>
+#include <cstddef>
+#include <mutex>
+#include <ostream>
+#include <stdint.h>
+
+// Read-only view of one libfreenect2 frame. Points straight into the
+// listener's buffer, so it is only valid while its FrameLease is held.
+struct FrameView
+{
+    const unsigned char *data;
+    int width, height;
+    int bytes_per_pixel;
+    libfreenect2::Frame::Format format;
+    uint32_t timestamp; // device clock, 0.1 ms ticks
+    uint32_t sequence;
+
+    bool valid() const { return data != nullptr; }
+    size_t size() const { return (size_t)width * height * bytes_per_pixel; }
+
+    // Depth (mm) and IR frames are Float
+    const float *floats() const { return (const float *)data; }
+
+    // Color straight from the camera with a PassthroughColorPipeline: one
+    // JPEG of size() bytes (width and height are 1, bytes_per_pixel is the
+    // JPEG length). See JpegDecoder.
+    bool compressed() const { return format == libfreenect2::Frame::Raw; }
+};
+
+// View of any frame; empty for null
+FrameView frameView(const libfreenect2::Frame *frame);
+
+// Delivery statistics of one stream, from device sequence numbers and timestamps
+struct StreamStats
+{
+    uint64_t frames;
+    uint64_t dropped;   // sequence numbers that never reached us
+    uint64_t late;      // handed over late_threshold_ms later than the stream's quickest delivery
+    double interval_ms; // mean device time between frames
+    double jitter_ms;   // standard deviation of that interval
+};
+
+struct FrameStats
+{
+    StreamStats color, depth, ir;
+
+    // Color minus depth device timestamp, over frame sets holding both
+    uint64_t skew_samples;
+    double skew_mean_ms;
+    double skew_min_ms, skew_max_ms;
+};
+
+// Watches every frame set a FrameSource hands out. Sequence gaps count as
+// drops (a slow consumer makes the listener discard frames). Lateness is
+// measured against the quickest device-to-host delay seen so far, since the
+// two clocks are not synchronized. Thread-safe.
+class FrameStatsTracker
+{
+public:
+    FrameStatsTracker(double late_threshold_ms = 16.0);
+
+    void observe(const libfreenect2::FrameMap &frames);
+    FrameStats stats();
+    void reset();
+    void print(std::ostream &out);
+
+private:
+    struct StreamState
+    {
+        bool seen;
+        uint32_t last_sequence;
+        uint32_t last_timestamp;
+        double min_delay_ms;
+        uint64_t frames, dropped, late;
+        uint64_t intervals;
+        double interval_mean, interval_m2; // running mean / sum of squares (Welford)
+    };
+
+    void observe_stream(StreamState &state, const libfreenect2::Frame *frame, double host_ms);
+    static StreamStats summarize(const StreamState &state);
+
+    double late_threshold_ms;
+    StreamState color, depth, ir;
+    uint64_t skew_samples;
+    double skew_sum, skew_min, skew_max;
+    std::mutex mutex;
+};
+
+// Anything that produces sets of libfreenect2 frames: a live device or a
+// recording (see kinect_source.h). Frames are handed out through FrameLease.
+class FrameSource
+{
+public:
+    virtual ~FrameSource() {}
+
+    virtual bool is_open() const = 0;
+
+    // Fill `frames` with the next frame set. Returns false on timeout or
+    // when a recording has run out.
+    virtual bool wait_for_frames(libfreenect2::FrameMap &frames, int timeout_ms) = 0;
+    virtual void release(libfreenect2::FrameMap &frames) = 0;
+
+    // Calibration of the camera that produced the frames
+    virtual libfreenect2::Freenect2Device::IrCameraParams ir_params() = 0;
+    virtual libfreenect2::Freenect2Device::ColorCameraParams color_params() = 0;
+
+    // Deliver only these streams (libfreenect2::Frame::Type bits) from the
+    // next frame set on. Must not be called while a lease is held.
+    virtual bool select_streams(unsigned int frame_types) = 0;
+    virtual unsigned int selected_streams() const = 0;
+
+    // True once a recording has run out; live sources never finish
+    virtual bool finished() const { return false; }
+
+    // Fed by FrameLease::acquire
+    FrameStatsTracker &frame_stats() { return stats_tracker; }
+
+private:
+    FrameStatsTracker stats_tracker;
+};
+
+// Holds one frame set from a FrameSource and hands it back when the lease is
+// released or destroyed. Nothing is copied or converted; see the convert*View
+// functions in kinect_capture.h for that.
+class FrameLease
+{
+public:
+    FrameLease();
+    FrameLease(FrameLease &&other);
+    FrameLease &operator=(FrameLease &&other);
+    ~FrameLease();
+
+    // Wait for the next set of frames, releasing any held ones first.
+    // Returns false on timeout or at the end of a recording.
+    bool acquire(FrameSource &source, int timeout_ms = 10 * 1000);
+    void release();
+    bool held() const { return source != nullptr; }
+
+    // Empty view if the stream is not part of this frame set
+    FrameView view(libfreenect2::Frame::Type type) const;
+    FrameView color() const { return view(libfreenect2::Frame::Color); }
+    FrameView depth() const { return view(libfreenect2::Frame::Depth); }
+    FrameView ir() const { return view(libfreenect2::Frame::Ir); }
+
+    // The underlying frame, for libfreenect2 APIs such as Registration
+    libfreenect2::Frame *frame(libfreenect2::Frame::Type type) const;
+
+private:
+    FrameLease(const FrameLease &) = delete;
+    FrameLease &operator=(const FrameLease &) = delete;
+
+    FrameSource *source;
+    libfreenect2::FrameMap frames;
+};
+
+#endif
@@ -0,0 +1,115 @@
+#ifndef KINECT_ICP_H
+#define KINECT_ICP_H
+
+#include <vector>
+#include <limits>
+#include <utility>
+#include <Eigen/Dense>
+#include <Eigen/SVD>
+
+struct ICPStep
+{
+    Eigen::Matrix4f transform; // moves the source points onto the target
+    int correspondences;
+    float total_error; // sum of squared distances of the matched pairs
+};
+
+// One point-to-point ICP iteration on any point type with x/y/z members.
+// Every source point is matched to its nearest target point within 50cm
+// (brute force, stopping at the first match closer than ~3cm), then the rigid
+// transform between the matched sets is solved with an SVD. With fewer than
+// 10 matches the transform is left as identity.
+template <typename PointT>
+ICPStep icpStep(const std::vector<PointT> &source, const std::vector<PointT> &target)
+{
+    ICPStep step;
+    step.transform = Eigen::Matrix4f::Identity();
+    step.total_error = 0;
+
+    std::vector<std::pair<int, int>> correspondences;
+
+    // Find closest points with early termination
+    for (size_t i = 0; i < source.size(); i++)
+    {
+        float min_dist = std::numeric_limits<float>::max();
+        int closest_idx = -1;
+
+        for (size_t j = 0; j < target.size(); j++)
+        {
+            float dx = source[i].x - target[j].x;
+            float dy = source[i].y - target[j].y;
+            float dz = source[i].z - target[j].z;
+            float dist = dx * dx + dy * dy + dz * dz;
+
+            if (dist < min_dist)
+            {
+                min_dist = dist;
+                closest_idx = j;
+            }
+
+            // Early exit if we found a really close match
+            if (dist < 0.001f)
+                break;
+        }
+
+        if (closest_idx >= 0 && min_dist < 0.25f)
+        { // 50cm threshold
+            correspondences.push_back({(int)i, closest_idx});
+            step.total_error += min_dist;
+        }
+    }
+
+    step.correspondences = correspondences.size();
+    if (correspondences.size() < 10)
+        return step;
+
+    // Compute centroids
+    Eigen::Vector3f centroid_source(0, 0, 0);
+    Eigen::Vector3f centroid_target(0, 0, 0);
+
+    for (const auto &pair : correspondences)
+    {
+        centroid_source += Eigen::Vector3f(source[pair.first].x, source[pair.first].y, source[pair.first].z);
+        centroid_target += Eigen::Vector3f(target[pair.second].x, target[pair.second].y, target[pair.second].z);
+    }
+
+    centroid_source /= correspondences.size();
+    centroid_target /= correspondences.size();
+
+    // Compute cross-covariance matrix
+    Eigen::Matrix3f H = Eigen::Matrix3f::Zero();
+
+    for (const auto &pair : correspondences)
+    {
+        Eigen::Vector3f p_source(
+            source[pair.first].x - centroid_source.x(),
+            source[pair.first].y - centroid_source.y(),
+            source[pair.first].z - centroid_source.z());
+        Eigen::Vector3f p_target(
+            target[pair.second].x - centroid_target.x(),
+            target[pair.second].y - centroid_target.y(),
+            target[pair.second].z - centroid_target.z());
+
+        H += p_source * p_target.transpose();
+    }
+
+    // SVD to get rotation
+    Eigen::JacobiSVD<Eigen::Matrix3f> svd(H, Eigen::ComputeFullU | Eigen::ComputeFullV);
+    Eigen::Matrix3f R = svd.matrixV() * svd.matrixU().transpose();
+
+    // Handle reflection case
+    if (R.determinant() < 0)
+    {
+        Eigen::Matrix3f V = svd.matrixV();
+        V.col(2) *= -1;
+        R = V * svd.matrixU().transpose();
+    }
+
+    Eigen::Vector3f t = centroid_target - R * centroid_source;
+
+    step.transform.block<3, 3>(0, 0) = R;
+    step.transform.block<3, 1>(0, 3) = t;
+    return step;
+}
+
+#endif
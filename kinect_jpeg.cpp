@@ -0,0 +1,89 @@
+#include "kinect_jpeg.h"
+#include <iostream>
+#include <turbojpeg.h>
+
+#include "kinect_profile.h"
+
+PROFILE_STAGE(jpeg_decode_stage, "jpeg_decode");
+
+JpegDecoder::JpegDecoder() : handle(nullptr), frame(nullptr) {}
+
+JpegDecoder::JpegDecoder(JpegDecoder &&other) : handle(other.handle), frame(other.frame)
+{
+    other.handle = nullptr;
+    other.frame = nullptr;
+}
+
+JpegDecoder &JpegDecoder::operator=(JpegDecoder &&other)
+{
+    if (this != &other)
+    {
+        reset();
+        handle = other.handle;
+        frame = other.frame;
+        other.handle = nullptr;
+        other.frame = nullptr;
+    }
+    return *this;
+}
+
+JpegDecoder::~JpegDecoder()
+{
+    reset();
+}
+
+void JpegDecoder::reset()
+{
+    if (handle)
+        tjDestroy((tjhandle)handle);
+    delete frame;
+    handle = nullptr;
+    frame = nullptr;
+}
+
+libfreenect2::Frame *JpegDecoder::decode(const FrameView &jpeg)
+{
+    PROFILE_SCOPE(jpeg_decode_stage);
+
+    if (!handle)
+        handle = tjInitDecompress();
+    if (!handle)
+    {
+        std::cout << "Failed to create JPEG decoder" << std::endl;
+        return nullptr;
+    }
+
+    unsigned char *data = (unsigned char *)jpeg.data;
+    int width = 0, height = 0, subsampling = 0;
+    if (!jpeg.valid() || tjDecompressHeader2((tjhandle)handle, data, jpeg.size(), &width, &height, &subsampling) != 0)
+    {
+        std::cout << "Not a JPEG color frame" << std::endl;
+        return nullptr;
+    }
+
+    if (frame && (frame->width != (size_t)width || frame->height != (size_t)height))
+    {
+        delete frame;
+        frame = nullptr;
+    }
+    if (!frame)
+        frame = new libfreenect2::Frame(width, height, 4);
+
+    // Same pixel format and DCT as libfreenect2's TurboJpegRgbPacketProcessor
+    if (tjDecompress2((tjhandle)handle, data, jpeg.size(), frame->data, width, 0, height, TJPF_BGRX, TJFLAG_FASTDCT) != 0)
+    {
+        std::cout << "Failed to decode JPEG: " << tjGetErrorStr() << std::endl;
+        return nullptr;
+    }
+
+    frame->format = libfreenect2::Frame::BGRX;
+    frame->timestamp = jpeg.timestamp;
+    frame->sequence = jpeg.sequence;
+    return frame;
+}
+
+libfreenect2::Frame *JpegDecoder::color_frame(const FrameLease &lease)
+{
+    libfreenect2::Frame *color = lease.frame(libfreenect2::Frame::Color);
+    return color && color->format == libfreenect2::Frame::Raw ? decode(lease.color()) : color;
+}
@@ -0,0 +1,40 @@
+#ifndef KINECT_JPEG_H
+#define KINECT_JPEG_H
+
+#include <libfreenect2/libfreenect2.hpp>
+
+#include "kinect_frame.h"
+
+// Decodes the camera's JPEG color frames (FrameView::compressed) to BGRX, the
+// way libfreenect2's own color processor would. The turbojpeg handle and the
+// output frame are kept between calls, so steady-state decoding does not
+// allocate. Not thread-safe; use one decoder per thread. Moving hands the
+// handle and frame over.
+class JpegDecoder
+{
+public:
+    JpegDecoder();
+    JpegDecoder(JpegDecoder &&other);
+    JpegDecoder &operator=(JpegDecoder &&other);
+    ~JpegDecoder();
+
+    // Decode `jpeg` into a BGRX frame owned by the decoder, valid until the
+    // next call. Returns null (and prints why) if it cannot be decoded.
+    libfreenect2::Frame *decode(const FrameView &jpeg);
+
+    // The lease's color frame as BGRX, e.g. for registration: decoded here
+    // when compressed, otherwise the lease's own frame. Null if the lease has
+    // no color or it cannot be decoded.
+    libfreenect2::Frame *color_frame(const FrameLease &lease);
+
+private:
+    JpegDecoder(const JpegDecoder &) = delete;
+    JpegDecoder &operator=(const JpegDecoder &) = delete;
+
+    void reset();
+
+    void *handle; // tjhandle, created on first use
+    libfreenect2::Frame *frame;
+};
+
+#endif
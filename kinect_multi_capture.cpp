@@ -0,0 +1,312 @@
+#include "kinect_multi_capture.h"
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+
+#include "kinect_source.h"
+
+// How long a capture thread waits for frames before checking for stop()
+static const int MULTI_CAPTURE_POLL_MS = 100;
+
+// Enough free buffers for every device's queued sets to be recycled
+static const size_t MULTI_CAPTURE_POOL_BUFFERS = 64;
+
+// Bytes of converted images in a capture
+static uint64_t captureBytes(const FrameCapture &c, const ColorOutput &color_output)
+{
+    uint64_t bytes = 0;
+    if (c.rgb_data)
+    {
+        uint64_t w = c.rgb_width, h = c.rgb_height;
+        bytes += color_output.layout == COLOR_LAYOUT_NV12 ? w * h + ((w + 1) / 2) * ((h + 1) / 2) * 2 : w * h * 3;
+    }
+    if (c.depth_data)
+        bytes += (uint64_t)c.depth_width * c.depth_height;
+    if (c.ir_data)
+        bytes += (uint64_t)c.ir_width * c.ir_height;
+    return bytes;
+}
+
+static bool receivedBefore(const DeviceFrameSet &a, const DeviceFrameSet &b)
+{
+    return a.received < b.received;
+}
+
+MultiDeviceCapture::MultiDeviceCapture(unsigned int outputs, size_t max_queued_per_device)
+    : outputs(outputs), max_queued(std::max<size_t>(1, max_queued_per_device)), pool(MULTI_CAPTURE_POOL_BUFFERS),
+      running(false), stopping(false), start_time(), stop_time()
+{
+}
+
+MultiDeviceCapture::~MultiDeviceCapture()
+{
+    stop();
+    for (size_t i = 0; i < devices.size(); i++)
+    {
+        delete devices[i]->registration;
+        delete devices[i]->source;
+        delete devices[i];
+    }
+}
+
+int MultiDeviceCapture::open_all_devices(unsigned int frame_types)
+{
+    std::vector<std::string> serials = connectedDeviceSerials();
+    if (serials.empty())
+        std::cout << "No Kinect detected" << std::endl;
+
+    int opened = 0;
+    for (size_t i = 0; i < serials.size(); i++)
+    {
+        LiveFrameSource *source = new LiveFrameSource(frame_types, nullptr, serials[i]);
+        if (!source->is_open())
+        {
+            delete source;
+            continue;
+        }
+        add_source(source, serials[i]);
+        opened++;
+    }
+    return opened;
+}
+
+void MultiDeviceCapture::add_source(FrameSource *source, const std::string &name)
+{
+    Device *device = new Device();
+    device->index = (int)devices.size();
+    device->name = name;
+    device->source = source;
+    device->registration = nullptr;
+    device->queued = 0;
+    device->busy = false;
+    device->finished = false;
+    device->frame_sets = 0;
+    device->timeouts = 0;
+    device->bytes = 0;
+    devices.push_back(device);
+}
+
+bool MultiDeviceCapture::start()
+{
+    if (running)
+        return true;
+    if (devices.empty())
+    {
+        std::cout << "No devices to capture from" << std::endl;
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = false;
+        start_time = std::chrono::steady_clock::now();
+    }
+    for (size_t i = 0; i < devices.size(); i++)
+    {
+        Device *device = devices[i];
+        if ((outputs & MULTI_CAPTURE_POINT_CLOUDS) && !device->registration)
+            device->registration = new RegistrationContext(device->source->ir_params(), device->source->color_params());
+        device->thread = std::thread(&MultiDeviceCapture::capture, this, device);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    running = true;
+    return true;
+}
+
+void MultiDeviceCapture::stop()
+{
+    if (!running)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    slot_free.notify_all();
+    set_ready.notify_all();
+
+    for (size_t i = 0; i < devices.size(); i++)
+    {
+        devices[i]->thread.join();
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (size_t i = 0; i < devices.size(); i++)
+    {
+        devices[i]->queued = 0;
+    }
+    stream.clear();
+    running = false;
+    stop_time = std::chrono::steady_clock::now();
+}
+
+void MultiDeviceCapture::capture(Device *device)
+{
+    DeviceFrameSet work;
+    work.device = device->index;
+    work.frames.rgb_format = color_output;
+
+    FrameLease lease;
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            slot_free.wait(lock, [&]
+                           { return stopping || device->queued < max_queued; });
+            if (stopping)
+                return;
+        }
+
+        if (!lease.acquire(*device->source, MULTI_CAPTURE_POLL_MS))
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (device->source->finished())
+            {
+                device->finished = true;
+                set_ready.notify_all();
+                return;
+            }
+            device->timeouts++;
+            continue;
+        }
+
+        // Stamped under the lock so next() never passes a set that is
+        // still being converted
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            work.received = std::chrono::steady_clock::now();
+            device->busy = true;
+            device->busy_since = work.received;
+        }
+
+        FrameView stamp = lease.depth().valid() ? lease.depth() : lease.color();
+        work.timestamp = stamp.timestamp;
+        work.sequence = stamp.sequence;
+
+        uint64_t bytes = 0;
+        if (outputs & MULTI_CAPTURE_FRAMES)
+        {
+            convertLease(lease, pool, work.frames);
+            bytes += captureBytes(work.frames.capture, color_output);
+        }
+        if (outputs & MULTI_CAPTURE_POINT_CLOUDS)
+        {
+            unprojectLease(lease, *device->registration, pool, work.cloud, depth_range);
+            bytes += (uint64_t)work.cloud.cloud.num_points * (3 * sizeof(float) + 3);
+        }
+        lease.release();
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::deque<DeviceFrameSet>::iterator it = std::upper_bound(stream.begin(), stream.end(), work, receivedBefore);
+            it = stream.insert(it, std::move(work));
+
+            // The decoders' state stays with the device
+            work.frames.jpeg_decoder = std::move(it->frames.jpeg_decoder);
+            work.cloud.jpeg_decoder = std::move(it->cloud.jpeg_decoder);
+
+            device->busy = false;
+            device->queued++;
+            device->frame_sets++;
+            device->bytes += bytes;
+        }
+        set_ready.notify_all();
+    }
+}
+
+bool MultiDeviceCapture::head_ready() const
+{
+    if (stream.empty())
+        return false;
+
+    for (size_t i = 0; i < devices.size(); i++)
+    {
+        if (devices[i]->busy && devices[i]->busy_since < stream.front().received)
+            return false;
+    }
+    return true;
+}
+
+bool MultiDeviceCapture::all_finished() const
+{
+    for (size_t i = 0; i < devices.size(); i++)
+    {
+        if (!devices[i]->finished)
+            return false;
+    }
+    return true;
+}
+
+bool MultiDeviceCapture::next(DeviceFrameSet &out, int timeout_ms)
+{
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!head_ready())
+    {
+        if (!running || stopping || (stream.empty() && all_finished()))
+            return false;
+        if (set_ready.wait_until(lock, deadline) == std::cv_status::timeout && !head_ready())
+            return false;
+    }
+
+    out = std::move(stream.front());
+    stream.pop_front();
+    devices[out.device]->queued--;
+    lock.unlock();
+
+    slot_free.notify_all();
+    return true;
+}
+
+std::vector<DeviceStats> MultiDeviceCapture::stats()
+{
+    double seconds;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::chrono::steady_clock::time_point end = running ? std::chrono::steady_clock::now() : stop_time;
+        seconds = std::chrono::duration<double>(end - start_time).count();
+    }
+
+    std::vector<DeviceStats> result;
+    for (size_t i = 0; i < devices.size(); i++)
+    {
+        Device *device = devices[i];
+        DeviceStats s;
+        s.name = device->name;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            s.frame_sets = device->frame_sets;
+            s.timeouts = device->timeouts;
+            s.frame_sets_per_second = seconds > 0 ? device->frame_sets / seconds : 0;
+            s.megabytes_per_second = seconds > 0 ? device->bytes / (1024.0 * 1024.0) / seconds : 0;
+        }
+        s.delivery = device->source->frame_stats().stats();
+        result.push_back(s);
+    }
+    return result;
+}
+
+void MultiDeviceCapture::print_stats(std::ostream &out)
+{
+    std::vector<DeviceStats> all = stats();
+
+    std::ios::fmtflags flags = out.flags();
+    std::streamsize precision = out.precision();
+    out << std::fixed << std::setprecision(1);
+
+    for (size_t i = 0; i < all.size(); i++)
+    {
+        const DeviceStats &s = all[i];
+        out << "Device " << i << " (" << s.name << "): " << s.frame_sets << " frame sets, "
+            << s.frame_sets_per_second << " sets/s, " << s.megabytes_per_second << " MB/s, "
+            << s.timeouts << " timeouts" << std::endl;
+        out << "  dropped color/depth/ir: " << s.delivery.color.dropped << "/" << s.delivery.depth.dropped << "/"
+            << s.delivery.ir.dropped << ", late: " << s.delivery.color.late << "/" << s.delivery.depth.late << "/"
+            << s.delivery.ir.late << std::endl;
+    }
+
+    out.flags(flags);
+    out.precision(precision);
+}
@@ -0,0 +1,134 @@
+#ifndef KINECT_MULTI_CAPTURE_H
+#define KINECT_MULTI_CAPTURE_H
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "kinect_capture.h"
+#include "kinect_frame.h"
+#include "kinect_registration.h"
+
+// What the capture threads produce for every frame set
+enum MultiCaptureOutput
+{
+    MULTI_CAPTURE_FRAMES = 1,      // 8-bit RGB, depth and IR images (convertLease)
+    MULTI_CAPTURE_POINT_CLOUDS = 2 // colored point cloud from the device's own registration
+};
+
+// One frame set from one device. The buffers are leased from the manager's
+// shared pool and go back to it when the set is destroyed or overwritten, so
+// the manager must outlive it.
+struct DeviceFrameSet
+{
+    int device;         // see MultiDeviceCapture::device_name
+    uint32_t timestamp; // device clock of the depth frame (color if there is none), 0.1 ms ticks
+    uint32_t sequence;
+
+    // Host time the set was received; the stream is ordered by this, as
+    // the devices' clocks are not synchronized with each other
+    std::chrono::steady_clock::time_point received;
+
+    PooledFrameCapture frames;
+    PooledPointCloud cloud;
+};
+
+struct DeviceStats
+{
+    std::string name;
+    uint64_t frame_sets;          // handed to the stream
+    uint64_t timeouts;
+    double frame_sets_per_second; // from start() to now or stop()
+    double megabytes_per_second;  // of converted output
+    FrameStats delivery;          // from the source's frame_stats()
+};
+
+// Captures from several sources at once: every connected Kinect, or replay
+// sources standing in for them. Each source gets its own capture thread and
+// RegistrationContext, all output is leased from one shared FrameBufferPool,
+// and the frame sets are merged into one stream in the order they arrived.
+class MultiDeviceCapture
+{
+public:
+    // `outputs` is a mask of MultiCaptureOutput. Up to
+    // `max_queued_per_device` sets per device wait in the stream; a capture
+    // thread blocks (and its device drops frames) while its share is full.
+    MultiDeviceCapture(unsigned int outputs = MULTI_CAPTURE_FRAMES, size_t max_queued_per_device = 2);
+    ~MultiDeviceCapture();
+
+    // Open every connected Kinect; returns how many were opened
+    int open_all_devices(unsigned int frame_types);
+
+    // Take ownership of a source. Call before start().
+    void add_source(FrameSource *source, const std::string &name);
+
+    int device_count() const { return (int)devices.size(); }
+    const std::string &device_name(int device) const { return devices[device]->name; }
+    FrameSource &source(int device) { return *devices[device]->source; }
+
+    // Start the capture threads, one per source. Fails without sources.
+    bool start();
+
+    // Stop the capture threads and drop every queued frame set
+    void stop();
+
+    // Wait for the next frame set in arrival order. Returns false on
+    // timeout, and once every source has run out and the stream is empty.
+    bool next(DeviceFrameSet &out, int timeout_ms);
+
+    std::vector<DeviceStats> stats();
+    void print_stats(std::ostream &out);
+
+    // Set before start()
+    ColorOutput color_output; // for MULTI_CAPTURE_FRAMES
+    DepthRange depth_range;   // for MULTI_CAPTURE_POINT_CLOUDS
+
+private:
+    MultiDeviceCapture(const MultiDeviceCapture &) = delete;
+    MultiDeviceCapture &operator=(const MultiDeviceCapture &) = delete;
+
+    struct Device
+    {
+        int index;
+        std::string name;
+        FrameSource *source;
+        RegistrationContext *registration;
+        std::thread thread;
+
+        // Guarded by the manager's mutex
+        size_t queued;
+        bool busy; // converting a set received at busy_since
+        bool finished;
+        std::chrono::steady_clock::time_point busy_since;
+        uint64_t frame_sets;
+        uint64_t timeouts;
+        uint64_t bytes;
+    };
+
+    void capture(Device *device);
+
+    // The oldest queued set can go out once no thread is still converting
+    // an older one. Called with the mutex held.
+    bool head_ready() const;
+    bool all_finished() const;
+
+    unsigned int outputs;
+    size_t max_queued;
+    std::vector<Device *> devices;
+    FrameBufferPool pool;
+
+    std::deque<DeviceFrameSet> stream; // sorted by received
+    bool running;
+    bool stopping;
+    std::chrono::steady_clock::time_point start_time, stop_time;
+    std::mutex mutex;
+    std::condition_variable set_ready;
+    std::condition_variable slot_free;
+};
+
+#endif
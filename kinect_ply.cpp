@@ -0,0 +1,123 @@
+#include "kinect_ply.h"
+#include <cstring>
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+
+static const size_t PLY_VERTEX_BYTES = 3 * sizeof(float) + 3;
+
+PLYWriter::PLYWriter(const char *filename, int num_points, size_t block_bytes)
+    : failed(false), block(block_bytes < 64 ? 64 : block_bytes), used(0)
+{
+    fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    std::string header =
+        "ply\n"
+        "format binary_little_endian 1.0\n"
+        "element vertex " +
+        std::to_string(num_points) + "\n"
+                                     "property float x\n"
+                                     "property float y\n"
+                                     "property float z\n"
+                                     "property uchar red\n"
+                                     "property uchar green\n"
+                                     "property uchar blue\n"
+                                     "end_header\n";
+    append(header.data(), header.size());
+}
+
+PLYWriter::~PLYWriter()
+{
+    close();
+}
+
+void PLYWriter::append(const void *data, size_t bytes)
+{
+    const unsigned char *src = (const unsigned char *)data;
+    while (bytes > 0)
+    {
+        if (used == block.size())
+            flush();
+
+        size_t n = bytes < block.size() - used ? bytes : block.size() - used;
+        memcpy(&block[used], src, n);
+        used += n;
+        src += n;
+        bytes -= n;
+    }
+}
+
+void PLYWriter::add(float x, float y, float z, unsigned char r, unsigned char g, unsigned char b)
+{
+    if (block.size() - used < PLY_VERTEX_BYTES)
+        flush();
+
+    unsigned char *out = &block[used];
+    memcpy(out + 0, &x, sizeof(float));
+    memcpy(out + 4, &y, sizeof(float));
+    memcpy(out + 8, &z, sizeof(float));
+    out[12] = r;
+    out[13] = g;
+    out[14] = b;
+    used += PLY_VERTEX_BYTES;
+}
+
+void PLYWriter::add_points(const float *points, const unsigned char *colors, int count)
+{
+    int i = 0;
+    while (i < count)
+    {
+        if (block.size() - used < PLY_VERTEX_BYTES)
+            flush();
+
+        // Fill as many whole vertices as fit in the rest of the block
+        int fit = (int)((block.size() - used) / PLY_VERTEX_BYTES);
+        int end = count - i < fit ? count : i + fit;
+        unsigned char *out = &block[used];
+        for (; i < end; i++)
+        {
+            memcpy(out, points + i * 3, 3 * sizeof(float));
+            memcpy(out + 12, colors + i * 3, 3);
+            out += PLY_VERTEX_BYTES;
+        }
+        used = out - &block[0];
+    }
+}
+
+void PLYWriter::flush()
+{
+    size_t done = 0;
+    while (fd >= 0 && done < used)
+    {
+        ssize_t n = write(fd, &block[done], used - done);
+        if (n <= 0)
+        {
+            failed = true;
+            break;
+        }
+        done += n;
+    }
+    used = 0;
+}
+
+bool PLYWriter::close()
+{
+    if (fd < 0)
+        return false;
+
+    flush();
+    if (::close(fd) != 0)
+        failed = true;
+    fd = -1;
+    return !failed;
+}
+
+bool writePointCloudPLY(const char *filename, const float *points, const unsigned char *colors, int num_points)
+{
+    PLYWriter writer(filename, num_points);
+    if (!writer.is_open())
+        return false;
+
+    writer.add_points(points, colors, num_points);
+    return writer.close();
+}
@@ -0,0 +1,43 @@
+#ifndef KINECT_PLY_H
+#define KINECT_PLY_H
+
+#include <cstddef>
+#include <vector>
+
+// Binary little-endian PLY writer for colored point clouds (float x/y/z and
+// uchar red/green/blue per vertex, 15 bytes). Vertices are packed into a large
+// staging block that is flushed with a handful of big write() calls.
+class PLYWriter
+{
+public:
+    // Opens the file and writes the header for `num_points` vertices
+    PLYWriter(const char *filename, int num_points, size_t block_bytes = 1 << 20);
+    ~PLYWriter();
+
+    bool is_open() const { return fd >= 0; }
+
+    void add(float x, float y, float z, unsigned char r, unsigned char g, unsigned char b);
+
+    // Interleave packed XYZ floats and RGB bytes (3 per point each)
+    void add_points(const float *points, const unsigned char *colors, int count);
+
+    // Flush and close. Returns false if any write failed.
+    bool close();
+
+private:
+    PLYWriter(const PLYWriter &) = delete;
+    PLYWriter &operator=(const PLYWriter &) = delete;
+
+    void append(const void *data, size_t bytes);
+    void flush();
+
+    int fd;
+    bool failed;
+    std::vector<unsigned char> block;
+    size_t used;
+};
+
+// Write a whole cloud in one go. Returns false on I/O failure.
+bool writePointCloudPLY(const char *filename, const float *points, const unsigned char *colors, int num_points);
+
+#endif
@@ -0,0 +1,263 @@
+#include "kinect_png_export.h"
+#include <algorithm>
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+static const char *const STREAM_NAMES[3] = {"rgb", "depth", "ir"};
+
+static double elapsedMs(std::chrono::steady_clock::time_point since)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - since).count();
+}
+
+PngExporter::PngExporter(const std::string &directory, unsigned int frame_types, int num_threads,
+                         int compression_level, int max_queued)
+    : directory(directory), ready(false), num_bursts((std::max(1, max_queued) + BURST_SETS - 1) / BURST_SETS),
+      bursts(nullptr), filling(-1), active_jobs(0), started(false), sets_queued(0), images(0), failed_images(0),
+      raw_total(0), png_total(0), encode_ms(0), wait_ms(0), stopping(false)
+{
+    stbi_write_png_compression_level = compression_level;
+
+    bursts = new Burst[num_bursts];
+    for (int i = 0; i < num_bursts; i++)
+    {
+        if (!bursts[i].capture.reserve(BURST_SETS, frame_types))
+            return;
+    }
+    for (int i = num_bursts - 1; i >= 0; i--)
+    {
+        free_bursts.push_back(i);
+    }
+    ready = true;
+
+    if (num_threads <= 0)
+        num_threads = std::max(1, (int)std::thread::hardware_concurrency());
+    for (int i = 0; i < num_threads; i++)
+    {
+        threads.push_back(std::thread(&PngExporter::encoder, this));
+    }
+}
+
+PngExporter::~PngExporter()
+{
+    finish();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    work_ready.notify_all();
+    for (size_t i = 0; i < threads.size(); i++)
+    {
+        threads[i].join();
+    }
+    delete[] bursts;
+}
+
+size_t PngExporter::reserved_bytes() const
+{
+    size_t bytes = 0;
+    for (int i = 0; i < num_bursts; i++)
+    {
+        bytes += bursts[i].capture.reserved_bytes();
+    }
+    return bytes;
+}
+
+bool PngExporter::add(const FrameLease &lease, int index)
+{
+    if (!ready)
+        return false;
+
+    if (filling < 0)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (!started)
+        {
+            start_time = std::chrono::steady_clock::now();
+            started = true;
+        }
+        if (free_bursts.empty())
+        {
+            std::chrono::steady_clock::time_point wait_start = std::chrono::steady_clock::now();
+            burst_free.wait(lock, [this]
+                            { return !free_bursts.empty(); });
+            wait_ms += elapsedMs(wait_start);
+        }
+        filling = free_bursts.back();
+        free_bursts.pop_back();
+        bursts[filling].capture.clear();
+    }
+
+    Burst &burst = bursts[filling];
+    int set = burst.capture.frame_count();
+    burst.capture.ir_normalizer = ir_normalizer;
+    bool added = burst.capture.add(lease) && burst.capture.frame_count() > set;
+    ir_normalizer = burst.capture.ir_normalizer;
+    if (!added)
+        return false;
+
+    burst.indices[set] = index;
+    if (burst.capture.full())
+        queue_filling();
+    return true;
+}
+
+// Hand the burst being filled to the encoders
+void PngExporter::queue_filling()
+{
+    if (filling < 0)
+        return;
+
+    Burst &burst = bursts[filling];
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        burst.pending = 0;
+        for (int set = 0; set < burst.capture.frame_count(); set++)
+        {
+            FrameCapture capture = burst.capture.frame(set);
+            const unsigned char *data[3] = {capture.rgb_data, capture.depth_data, capture.ir_data};
+            for (int stream = 0; stream < 3; stream++)
+            {
+                if (!data[stream])
+                    continue;
+                Job job = {filling, set, stream};
+                jobs.push_back(job);
+                burst.pending++;
+            }
+        }
+        sets_queued += burst.capture.frame_count();
+        if (burst.pending == 0)
+            free_bursts.push_back(filling);
+    }
+    filling = -1;
+    work_ready.notify_all();
+}
+
+bool PngExporter::encode(const Burst &burst, int set, int stream, size_t &raw_bytes, size_t &png_bytes)
+{
+    FrameCapture capture = burst.capture.frame(set);
+    const unsigned char *data = capture.rgb_data;
+    int width = capture.rgb_width, height = capture.rgb_height, channels = 3;
+    if (stream == 1)
+    {
+        data = capture.depth_data;
+        width = capture.depth_width;
+        height = capture.depth_height;
+        channels = 1;
+    }
+    else if (stream == 2)
+    {
+        data = capture.ir_data;
+        width = capture.ir_width;
+        height = capture.ir_height;
+        channels = 1;
+    }
+
+    std::string filename =
+        directory + "/" + STREAM_NAMES[stream] + "_" + std::to_string(burst.indices[set]) + ".png";
+    raw_bytes = (size_t)width * height * channels;
+    png_bytes = 0;
+
+    int length = 0;
+    unsigned char *png = stbi_write_png_to_mem(data, width * channels, width, height, channels, &length);
+    if (!png)
+    {
+        std::cout << "Failed to encode " << filename << std::endl;
+        return false;
+    }
+
+    FILE *file = fopen(filename.c_str(), "wb");
+    bool ok = file && fwrite(png, 1, length, file) == (size_t)length;
+    if (file && fclose(file) != 0)
+        ok = false;
+    STBIW_FREE(png);
+    if (!ok)
+    {
+        std::cout << "Failed to write " << filename << std::endl;
+        return false;
+    }
+    png_bytes = length;
+    return true;
+}
+
+void PngExporter::encoder()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        work_ready.wait(lock, [this]
+                        { return stopping || !jobs.empty(); });
+        if (jobs.empty())
+            return; // stopping
+
+        Job job = jobs.front();
+        jobs.pop_front();
+        active_jobs++;
+        lock.unlock();
+
+        std::chrono::steady_clock::time_point encode_start = std::chrono::steady_clock::now();
+        size_t raw_bytes, png_bytes;
+        bool ok = encode(bursts[job.burst], job.set, job.stream, raw_bytes, png_bytes);
+        double ms = elapsedMs(encode_start);
+
+        lock.lock();
+        active_jobs--;
+        encode_ms += ms;
+        raw_total += raw_bytes;
+        png_total += png_bytes;
+        if (ok)
+            images++;
+        else
+            failed_images++;
+        last_done = std::chrono::steady_clock::now();
+
+        if (--bursts[job.burst].pending == 0)
+        {
+            free_bursts.push_back(job.burst);
+            burst_free.notify_all();
+        }
+    }
+}
+
+bool PngExporter::finish()
+{
+    queue_filling();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    burst_free.wait(lock, [this]
+                   { return jobs.empty() && active_jobs == 0; });
+    return failed_images == 0;
+}
+
+void PngExporter::print_stats(std::ostream &out)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+
+    std::ios::fmtflags flags = out.flags();
+    std::streamsize precision = out.precision();
+    out << std::fixed << std::setprecision(2);
+
+    double wall_ms = started ? std::chrono::duration<double, std::milli>(last_done - start_time).count() : 0.0;
+    double wall_s = std::max(wall_ms, 1e-3) / 1000.0;
+    double raw_mb = raw_total / (1024.0 * 1024.0);
+    double png_mb = png_total / (1024.0 * 1024.0);
+
+    out << "PNG export (" << threads.size() << " threads, level " << stbi_write_png_compression_level
+        << "):" << std::endl;
+    out << "  " << images << " images from " << sets_queued << " frame sets in " << wall_ms << " ms: "
+        << sets_queued / wall_s << " sets/s, " << raw_mb / wall_s << " MB/s raw" << std::endl;
+    out << "  " << png_mb << " MB written (" << (raw_total ? 100.0 * png_total / raw_total : 0.0)
+        << "% of raw), " << encode_ms / std::max<uint64_t>(1, images + failed_images) << " ms per image, "
+        << raw_mb / std::max(encode_ms / 1000.0, 1e-6) << " MB/s per thread" << std::endl;
+    if (wait_ms > 0)
+        out << "  capture waited " << wait_ms << " ms for a free burst" << std::endl;
+    if (failed_images > 0)
+        out << "  " << failed_images << " images failed" << std::endl;
+
+    out.flags(flags);
+    out.precision(precision);
+}
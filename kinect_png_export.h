@@ -0,0 +1,114 @@
+#ifndef KINECT_PNG_EXPORT_H
+#define KINECT_PNG_EXPORT_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <ostream>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "kinect_burst.h"
+#include "kinect_frame.h"
+
+// Saves frame sets as PNGs (rgb_<n>.png, depth_<n>.png and ir_<n>.png) on a
+// pool of encoder threads, so that capture runs at the device rate while
+// deflate catches up behind it.
+//
+// Frames are captured into a few small BurstCaptures used in turn. add()
+// fills the current one; once it is full it is queued as one encode job
+// per stream of every set, and it is reused as soon as its last PNG is on
+// disk. Memory stays at about `max_queued` frame sets however many are
+// exported. When every burst is still waiting to be encoded, add() waits
+// for one.
+class PngExporter
+{
+public:
+    // Write the `frame_types` streams (libfreenect2::Frame::Type bits) of
+    // each set into `directory`. The compression level is stb's: higher
+    // searches longer for matches, anything below 5 counts as 5 and stb
+    // defaults to 8. It is a global setting, so it applies to every PNG the
+    // process writes. 0 threads = one per hardware core.
+    PngExporter(const std::string &directory, unsigned int frame_types, int num_threads = 0,
+                int compression_level = 8, int max_queued = 30);
+    ~PngExporter();
+
+    // False if the bursts could not be reserved
+    bool is_ready() const { return ready; }
+
+    // Queue the lease's frames as set `index`; call from one thread only.
+    // Returns false if the set had none of the exported streams.
+    bool add(const FrameLease &lease, int index);
+
+    // Queue the sets added so far and wait until they are all on disk;
+    // false if any PNG failed
+    bool finish();
+
+    int thread_count() const { return (int)threads.size(); }
+    int capacity() const { return num_bursts * BURST_SETS; }
+    size_t reserved_bytes() const;
+
+    // Encode throughput so far: wall time from the first add() to the last
+    // PNG written, and the time add() spent waiting for a free burst
+    void print_stats(std::ostream &out);
+
+    // Per-frame IR max unless reuse_previous_max is set; carried from burst
+    // to burst, see BurstCapture::ir_normalizer
+    IRNormalizer ir_normalizer;
+
+private:
+    PngExporter(const PngExporter &) = delete;
+    PngExporter &operator=(const PngExporter &) = delete;
+
+    // Sets per burst; small so that encoding starts soon after capture
+    static const int BURST_SETS = 4;
+
+    struct Burst
+    {
+        BurstCapture capture;
+        int indices[BURST_SETS]; // set index of each captured set
+        int pending;             // PNGs still to encode
+    };
+
+    struct Job
+    {
+        int burst;
+        int set;
+        int stream; // 0 = rgb, 1 = depth, 2 = ir
+    };
+
+    void queue_filling();
+    void encoder();
+    bool encode(const Burst &burst, int set, int stream, size_t &raw_bytes, size_t &png_bytes);
+
+    std::string directory;
+    bool ready;
+    int num_bursts;
+    Burst *bursts;
+    int filling; // burst add() is filling, -1 for none
+
+    // Bursts move from free_bursts to filling in add(), then to jobs, and
+    // back once their last job is done; frame data is only touched outside
+    // the mutex
+    std::vector<int> free_bursts;
+    std::deque<Job> jobs;
+    int active_jobs;
+
+    bool started;
+    std::chrono::steady_clock::time_point start_time, last_done;
+    uint64_t sets_queued, images, failed_images;
+    uint64_t raw_total, png_total;
+    double encode_ms, wait_ms;
+
+    bool stopping;
+    std::mutex mutex;
+    std::condition_variable work_ready;
+    std::condition_variable burst_free;
+    std::vector<std::thread> threads;
+};
+
+#endif
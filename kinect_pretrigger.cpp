@@ -0,0 +1,278 @@
+#include "kinect_pretrigger.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <sys/mman.h>
+
+// Largest frame of each stream; compressed color is always smaller than BGRX
+static const size_t COLOR_SLOT_BYTES = 1920 * 1080 * 4;
+static const size_t DEPTH_SLOT_BYTES = 512 * 424 * sizeof(float);
+
+static const size_t SLOT_ALIGNMENT = 4096;
+
+static size_t alignUp(size_t bytes, size_t alignment)
+{
+    return (bytes + alignment - 1) / alignment * alignment;
+}
+
+PreTriggerRecorder::PreTriggerRecorder(const libfreenect2::Freenect2Device::IrCameraParams &ir_params,
+                                       const libfreenect2::Freenect2Device::ColorCameraParams &color_params,
+                                       unsigned int frame_types, double pre_seconds, double post_seconds,
+                                       bool lossless_depth, double fps)
+    : ir(ir_params), color(color_params), frame_types(frame_types), lossless_depth(lossless_depth),
+      post_frames(std::max(0, (int)std::lround(post_seconds * fps))), arena(nullptr), arena_bytes(0), slot_bytes(0),
+      history_slots(std::max(1, (int)std::lround(pre_seconds * fps))), write_rate(0), head(0), count(0),
+      flush_count(0), state(Armed), post_remaining(0), events(0), event_failed(false), dropped_sets(0),
+      stopping(false)
+{
+    int spare_slots = std::min(post_frames, (int)std::lround(fps));
+    num_slots = history_slots + spare_slots;
+
+    const libfreenect2::Frame::Type types[3] = {libfreenect2::Frame::Color, libfreenect2::Frame::Depth,
+                                                libfreenect2::Frame::Ir};
+    const size_t sizes[3] = {COLOR_SLOT_BYTES, DEPTH_SLOT_BYTES, DEPTH_SLOT_BYTES};
+    for (int i = 0; i < 3; i++)
+    {
+        stream_offsets[i] = slot_bytes;
+        stream_bytes[i] = (frame_types & types[i]) ? sizes[i] : 0;
+        slot_bytes += alignUp(stream_bytes[i], SLOT_ALIGNMENT);
+    }
+    if (slot_bytes == 0)
+    {
+        std::cout << "No streams selected" << std::endl;
+        return;
+    }
+
+    // From the trigger on, the ring only stays ahead of capture if the
+    // writer frees a slot for all but `spare_slots` of the post_frames sets
+    // that arrive in the meantime
+    if (post_frames > spare_slots)
+    {
+        double sets_per_second = fps * (post_frames - spare_slots) / post_frames;
+        write_rate = sets_per_second * (stream_bytes[0] + stream_bytes[1] + stream_bytes[2]);
+    }
+
+    // Populated up front so that neither capture nor the first event faults
+    // pages in
+    size_t bytes = slot_bytes * num_slots;
+    void *mapped = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (mapped == MAP_FAILED)
+    {
+        std::cout << "Could not map a " << bytes / (1024 * 1024) << " MB pre-trigger buffer" << std::endl;
+        return;
+    }
+    arena = (unsigned char *)mapped;
+    arena_bytes = bytes;
+    slots.resize(num_slots);
+
+    thread = std::thread(&PreTriggerRecorder::flusher, this);
+}
+
+PreTriggerRecorder::~PreTriggerRecorder()
+{
+    if (thread.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        work_ready.notify_one();
+        thread.join();
+    }
+    if (arena)
+        munmap(arena, arena_bytes);
+}
+
+static const libfreenect2::Frame::Type STREAM_TYPES[3] = {libfreenect2::Frame::Color, libfreenect2::Frame::Depth,
+                                                          libfreenect2::Frame::Ir};
+
+// The lease has at least one stream that copy_into would keep
+bool PreTriggerRecorder::fits(const FrameLease &lease) const
+{
+    for (int i = 0; i < 3; i++)
+    {
+        FrameView view = lease.view(STREAM_TYPES[i]);
+        if (view.valid() && view.size() <= stream_bytes[i])
+            return true;
+    }
+    return false;
+}
+
+void PreTriggerRecorder::copy_into(Slot &slot, const FrameLease &lease)
+{
+    unsigned char *base = arena + (&slot - &slots[0]) * slot_bytes;
+    for (int i = 0; i < 3; i++)
+    {
+        FrameView view = lease.view(STREAM_TYPES[i]);
+        if (!view.valid() || view.size() > stream_bytes[i])
+        {
+            slot.views[i] = FrameView();
+            continue;
+        }
+
+        unsigned char *dst = base + stream_offsets[i];
+        memcpy(dst, view.data, view.size());
+        slot.views[i] = view;
+        slot.views[i].data = dst;
+    }
+}
+
+bool PreTriggerRecorder::add(const FrameLease &lease)
+{
+    // Checked before the oldest set makes room for this one
+    if (!arena || !fits(lease))
+        return false;
+
+    std::unique_lock<std::mutex> lock(mutex);
+    if (count == num_slots || count - flush_count == history_slots)
+    {
+        // Only the oldest buffered set may go, and only while none of the
+        // ring is being written. A dropped set still counts towards the
+        // seconds after a trigger.
+        if (flush_count > 0)
+        {
+            dropped_sets++;
+            if (state == Triggered && --post_remaining <= 0)
+            {
+                state = Flushing;
+                lock.unlock();
+                work_ready.notify_one();
+            }
+            return false;
+        }
+        head = (head + 1) % num_slots;
+        count--;
+    }
+    Slot &slot = slots[(head + count) % num_slots];
+    lock.unlock();
+
+    copy_into(slot, lease);
+
+    // A trigger while copying makes this the first set after it
+    lock.lock();
+    count++;
+    if (state == Triggered)
+    {
+        flush_count++;
+        if (--post_remaining <= 0)
+            state = Flushing;
+        lock.unlock();
+        work_ready.notify_one();
+    }
+    return true;
+}
+
+bool PreTriggerRecorder::trigger(const std::string &filename)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!arena || state != Armed)
+            return false;
+
+        event_filename = filename;
+        event_failed = false;
+        flush_count = count;
+        post_remaining = post_frames;
+        state = post_remaining > 0 ? Triggered : Flushing;
+    }
+    work_ready.notify_one();
+    return true;
+}
+
+// Writes each event as it comes in: the buffered sets first, then the sets
+// after the trigger as add() queues them
+void PreTriggerRecorder::flusher()
+{
+    FrameSetWriter *writer = nullptr;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        work_ready.wait(lock, [this]
+                        { return stopping || (state != Armed && (flush_count > 0 || state == Flushing)); });
+        if (state == Armed)
+            break; // stopping with nothing to write
+
+        if (!writer)
+        {
+            std::string filename = event_filename;
+            lock.unlock();
+            writer = new FrameSetWriter(filename.c_str(), ir, color, lossless_depth, 2);
+            if (!writer->is_open())
+                std::cout << "Failed to create " << filename << std::endl;
+            lock.lock();
+        }
+
+        if (flush_count > 0)
+        {
+            // Written outside the lock; the slot stays counted until it is done
+            const Slot &slot = slots[head];
+            lock.unlock();
+            writer->write(slot.views[0], slot.views[1], slot.views[2]);
+            lock.lock();
+            head = (head + 1) % num_slots;
+            count--;
+            flush_count--;
+        }
+        else if (state == Flushing)
+        {
+            lock.unlock();
+            bool ok = writer->close();
+            delete writer;
+            writer = nullptr;
+            lock.lock();
+            event_failed = !ok;
+            events++;
+            state = Armed;
+            event_done.notify_all();
+        }
+        else if (stopping)
+        {
+            // Destroyed mid-event: keep what was recorded so far, as finish()
+            state = Flushing;
+        }
+    }
+}
+
+bool PreTriggerRecorder::busy()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return state != Armed;
+}
+
+bool PreTriggerRecorder::wait()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    event_done.wait(lock, [this]
+                    { return state == Armed; });
+    return !event_failed;
+}
+
+bool PreTriggerRecorder::finish()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (state == Triggered)
+            state = Flushing;
+    }
+    work_ready.notify_one();
+    return wait();
+}
+
+int PreTriggerRecorder::buffered()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return count;
+}
+
+int PreTriggerRecorder::events_written()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return events;
+}
+
+uint64_t PreTriggerRecorder::dropped()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return dropped_sets;
+}
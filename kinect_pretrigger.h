@@ -0,0 +1,130 @@
+#ifndef KINECT_PRETRIGGER_H
+#define KINECT_PRETRIGGER_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "kinect_frame.h"
+#include "kinect_source.h"
+
+// Keeps the last few seconds of frames in memory and writes them out only
+// when something happens: trigger() saves the buffered frames plus the next
+// few seconds as a frame recording (see FrameSetWriter), so an event can be
+// replayed from before it started without recording to disk all day.
+//
+// Frames are copied into a fixed ring of slots mapped up front, one slot per
+// frame set and each stream at its largest size, so memory use is known
+// before the first frame and nothing is allocated per frame. After a trigger
+// the same ring is the queue a background thread drains to disk, with up to
+// a second of spare slots to take the sets that arrive while the backlog
+// starts going out; if the disk falls further behind than that, new frames
+// are dropped rather than blocking capture.
+class PreTriggerRecorder
+{
+public:
+    // Buffer `pre_seconds` of the `frame_types` streams
+    // (libfreenect2::Frame::Type bits) and record `post_seconds` after each
+    // trigger. Compressed (JPEG) color fits in a color slot too.
+    PreTriggerRecorder(const libfreenect2::Freenect2Device::IrCameraParams &ir_params,
+                       const libfreenect2::Freenect2Device::ColorCameraParams &color_params,
+                       unsigned int frame_types, double pre_seconds, double post_seconds,
+                       bool lossless_depth = false, double fps = 30.0);
+    ~PreTriggerRecorder();
+
+    // False if the ring could not be mapped
+    bool is_ready() const { return arena != nullptr; }
+
+    // Keep a copy of the lease's frames; call from the capture thread. Never
+    // blocks; returns false if the set was dropped because every slot is
+    // still waiting to be written, or if it had none of the buffered streams
+    // (in which case nothing already buffered is lost).
+    bool add(const FrameLease &lease);
+
+    // Save the buffered frames and the next post_seconds to `filename`.
+    // Safe from any thread (but not a signal handler). Returns false while
+    // the previous event is still being recorded.
+    bool trigger(const std::string &filename);
+
+    // An event is being recorded or written
+    bool busy();
+
+    // Wait until the current event is on disk; false if writing it failed
+    bool wait();
+
+    // End the current event with the sets added so far, then wait for it
+    bool finish();
+
+    int capacity() const { return history_slots; } // sets kept before a trigger
+    size_t reserved_bytes() const { return arena_bytes; }
+
+    // Bytes per second the disk must sustain while an event is written for
+    // none of its sets to be dropped: what the spare slots cannot absorb of
+    // the sets after the trigger. An upper bound, since compressed color and
+    // depth are written smaller than their slots. 0 if the spare slots
+    // cover all of post_seconds.
+    double required_write_rate() const { return write_rate; }
+    int buffered();
+    int events_written();
+    uint64_t dropped();
+
+private:
+    PreTriggerRecorder(const PreTriggerRecorder &) = delete;
+    PreTriggerRecorder &operator=(const PreTriggerRecorder &) = delete;
+
+    enum State
+    {
+        Armed,      // buffering, oldest sets overwritten
+        Triggered,  // after-trigger sets still to come
+        Flushing    // the event is complete and being written
+    };
+
+    struct Slot
+    {
+        FrameView views[3]; // color, depth, ir; data points into the arena
+    };
+
+    void flusher();
+    bool fits(const FrameLease &lease) const;
+    void copy_into(Slot &slot, const FrameLease &lease);
+
+    libfreenect2::Freenect2Device::IrCameraParams ir;
+    libfreenect2::Freenect2Device::ColorCameraParams color;
+    unsigned int frame_types;
+    bool lossless_depth;
+    int post_frames;
+
+    unsigned char *arena;
+    size_t arena_bytes;
+    size_t stream_offsets[3]; // of each stream within a slot
+    size_t stream_bytes[3];
+    size_t slot_bytes;
+    int history_slots;
+    int num_slots; // history plus spare slots
+    double write_rate;
+    std::vector<Slot> slots;
+
+    // Ring of `count` sets from `head`; the first `flush_count` of them
+    // belong to the event being written, at most `history_slots` of the
+    // rest are kept for the next one. Slots are filled by add() before
+    // they are counted and written by the flusher before they are freed,
+    // so neither touches the frame data under the mutex.
+    int head, count, flush_count;
+    State state;
+    int post_remaining;
+    std::string event_filename;
+    int events;
+    bool event_failed;
+    uint64_t dropped_sets;
+
+    bool stopping;
+    std::mutex mutex;
+    std::condition_variable work_ready;
+    std::condition_variable event_done;
+    std::thread thread;
+};
+
+#endif
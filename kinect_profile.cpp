@@ -0,0 +1,241 @@
+#include "kinect_profile.h"
+#include <iostream>
+#include <iomanip>
+#include <mutex>
+#include <vector>
+
+// One per thread that has recorded anything. They are linked into a list that
+// only ever grows, and are never freed so samples outlive their thread.
+struct ThreadProfile
+{
+    std::atomic<LatencyHistogram *> stages[PROFILE_MAX_STAGES];
+    ThreadProfile *next;
+};
+
+static std::atomic<ThreadProfile *> thread_profiles(nullptr);
+static thread_local ThreadProfile *current_thread_profile = nullptr;
+
+static ThreadProfile *threadProfile()
+{
+    if (current_thread_profile)
+        return current_thread_profile;
+
+    ThreadProfile *profile = new ThreadProfile();
+    for (int i = 0; i < PROFILE_MAX_STAGES; i++)
+    {
+        profile->stages[i].store(nullptr, std::memory_order_relaxed);
+    }
+
+    // Lock-free push onto the list of all threads
+    profile->next = thread_profiles.load(std::memory_order_relaxed);
+    while (!thread_profiles.compare_exchange_weak(profile->next, profile, std::memory_order_release,
+                                                  std::memory_order_relaxed))
+    {
+    }
+
+    current_thread_profile = profile;
+    return profile;
+}
+
+// Function-local so stages in any translation unit can register during static init
+static std::vector<ProfileStage *> &registeredStages()
+{
+    static std::vector<ProfileStage *> stages;
+    return stages;
+}
+
+static std::mutex &registrationMutex()
+{
+    static std::mutex mutex;
+    return mutex;
+}
+
+LatencyHistogram::LatencyHistogram()
+{
+    for (int i = 0; i < PROFILE_BUCKETS; i++)
+    {
+        counts[i].store(0, std::memory_order_relaxed);
+    }
+    total.store(0, std::memory_order_relaxed);
+    sum.store(0, std::memory_order_relaxed);
+    max.store(0, std::memory_order_relaxed);
+}
+
+int LatencyHistogram::bucket_index(uint64_t ns)
+{
+    if (ns < (uint64_t)PROFILE_SUB_BUCKETS)
+        return (int)ns;
+
+    const uint64_t largest = (1ULL << PROFILE_MAX_EXPONENT) - 1;
+    if (ns > largest)
+        ns = largest;
+
+    // Exponent of the leading bit, then the next 5 bits below it
+    int exponent = 63 - __builtin_clzll(ns);
+    int shift = exponent - PROFILE_SUB_BUCKET_BITS;
+    int sub_bucket = (int)((ns >> shift) & (PROFILE_SUB_BUCKETS - 1));
+    return (shift + 1) * PROFILE_SUB_BUCKETS + sub_bucket;
+}
+
+double LatencyHistogram::bucket_value(int index)
+{
+    if (index < PROFILE_SUB_BUCKETS)
+        return index;
+
+    // Middle of the bucket's range
+    int shift = index / PROFILE_SUB_BUCKETS - 1;
+    int sub_bucket = index % PROFILE_SUB_BUCKETS;
+    double low = (double)((uint64_t)(PROFILE_SUB_BUCKETS + sub_bucket) << shift);
+    return low + ((1ULL << shift) - 1) / 2.0;
+}
+
+void LatencyHistogram::record(uint64_t ns)
+{
+    // Only the owning thread writes, so load + store is enough
+    std::atomic<uint64_t> &bucket = counts[bucket_index(ns)];
+    bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    total.store(total.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    sum.store(sum.load(std::memory_order_relaxed) + ns, std::memory_order_relaxed);
+    if (ns > max.load(std::memory_order_relaxed))
+        max.store(ns, std::memory_order_relaxed);
+}
+
+void LatencyHistogram::merge_into(uint64_t *merged, uint64_t &merged_total, uint64_t &merged_sum, uint64_t &merged_max) const
+{
+    for (int i = 0; i < PROFILE_BUCKETS; i++)
+    {
+        merged[i] += counts[i].load(std::memory_order_relaxed);
+    }
+    merged_total += total.load(std::memory_order_relaxed);
+    merged_sum += sum.load(std::memory_order_relaxed);
+    uint64_t m = max.load(std::memory_order_relaxed);
+    if (m > merged_max)
+        merged_max = m;
+}
+
+ProfileStage::ProfileStage(const char *name) : stage_name(name), index(-1)
+{
+    std::lock_guard<std::mutex> lock(registrationMutex());
+    std::vector<ProfileStage *> &stages = registeredStages();
+    if (stages.size() >= (size_t)PROFILE_MAX_STAGES)
+    {
+        std::cout << "Too many profile stages, not timing " << name << std::endl;
+        return;
+    }
+    index = (int)stages.size();
+    stages.push_back(this);
+}
+
+void ProfileStage::record(uint64_t ns)
+{
+    if (index < 0)
+        return;
+
+    ThreadProfile *profile = threadProfile();
+    LatencyHistogram *histogram = profile->stages[index].load(std::memory_order_relaxed);
+    if (!histogram)
+    {
+        histogram = new LatencyHistogram();
+        profile->stages[index].store(histogram, std::memory_order_release);
+    }
+    histogram->record(ns);
+}
+
+LatencySummary ProfileStage::summary() const
+{
+    LatencySummary result = {};
+    if (index < 0)
+        return result;
+
+    std::vector<uint64_t> counts(PROFILE_BUCKETS, 0);
+    uint64_t total = 0, sum = 0, max = 0;
+    for (ThreadProfile *profile = thread_profiles.load(std::memory_order_acquire); profile; profile = profile->next)
+    {
+        LatencyHistogram *histogram = profile->stages[index].load(std::memory_order_acquire);
+        if (histogram)
+            histogram->merge_into(counts.data(), total, sum, max);
+    }
+
+    // Buckets and the total are read at slightly different times, so
+    // percentiles are taken against the buckets' own sum
+    uint64_t bucket_total = 0;
+    for (int i = 0; i < PROFILE_BUCKETS; i++)
+    {
+        bucket_total += counts[i];
+    }
+    if (bucket_total == 0)
+        return result;
+
+    result.count = total;
+    result.mean_ns = total ? (double)sum / total : 0;
+    result.max_ns = (double)max;
+
+    uint64_t p50_rank = (bucket_total + 1) / 2;
+    uint64_t p99_rank = bucket_total - bucket_total / 100;
+    uint64_t seen = 0;
+    bool have_p50 = false;
+    for (int i = 0; i < PROFILE_BUCKETS; i++)
+    {
+        seen += counts[i];
+        if (!have_p50 && seen >= p50_rank)
+        {
+            result.p50_ns = LatencyHistogram::bucket_value(i);
+            have_p50 = true;
+        }
+        if (seen >= p99_rank)
+        {
+            result.p99_ns = LatencyHistogram::bucket_value(i);
+            break;
+        }
+    }
+
+    // The bucket midpoint can overshoot the largest sample
+    if (result.p50_ns > result.max_ns)
+        result.p50_ns = result.max_ns;
+    if (result.p99_ns > result.max_ns)
+        result.p99_ns = result.max_ns;
+    return result;
+}
+
+void printProfile(std::ostream &out)
+{
+    std::vector<ProfileStage *> stages;
+    {
+        std::lock_guard<std::mutex> lock(registrationMutex());
+        stages = registeredStages();
+    }
+
+    std::ios::fmtflags flags = out.flags();
+    std::streamsize precision = out.precision();
+    out << std::fixed << std::setprecision(3);
+
+    out << "Stage latency (ms):" << std::endl;
+    out << "  " << std::left << std::setw(20) << "stage" << std::right << std::setw(10) << "count"
+        << std::setw(10) << "mean" << std::setw(10) << "p50" << std::setw(10) << "p99"
+        << std::setw(10) << "max" << std::endl;
+    for (size_t i = 0; i < stages.size(); i++)
+    {
+        LatencySummary s = stages[i]->summary();
+        if (s.count == 0)
+            continue;
+
+        out << "  " << std::left << std::setw(20) << stages[i]->name() << std::right << std::setw(10) << s.count
+            << std::setw(10) << s.mean_ns / 1e6 << std::setw(10) << s.p50_ns / 1e6
+            << std::setw(10) << s.p99_ns / 1e6 << std::setw(10) << s.max_ns / 1e6 << std::endl;
+    }
+
+    out.flags(flags);
+    out.precision(precision);
+}
+
+void printProfileEvery(double interval_seconds)
+{
+    static std::chrono::steady_clock::time_point last_report = std::chrono::steady_clock::now();
+
+    std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+    if (std::chrono::duration<double>(now - last_report).count() < interval_seconds)
+        return;
+
+    last_report = now;
+    printProfile(std::cout);
+}
@@ -0,0 +1,114 @@
+#ifndef KINECT_PROFILE_H
+#define KINECT_PROFILE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <ostream>
+#include <stdint.h>
+
+// Per-stage latency histograms. Build with -DKINECT_PROFILE to enable the
+// PROFILE_* macros; without it they expand to nothing.
+//
+//   PROFILE_STAGE(convert_stage, "convert");   // at namespace scope
+//   { PROFILE_SCOPE(convert_stage); ... }      // times the enclosing block
+//   PROFILE_REPORT(5.0);                       // print every 5 seconds
+//
+// Every thread records into its own histograms (plain relaxed stores, no
+// locks or read-modify-writes), and reports merge them on the fly.
+
+// Log-linear buckets: 32 per power of two (~3% resolution) up to 2^36 ns
+const int PROFILE_SUB_BUCKET_BITS = 5;
+const int PROFILE_SUB_BUCKETS = 1 << PROFILE_SUB_BUCKET_BITS;
+const int PROFILE_MAX_EXPONENT = 36;
+const int PROFILE_BUCKETS = (PROFILE_MAX_EXPONENT - PROFILE_SUB_BUCKET_BITS + 1) * PROFILE_SUB_BUCKETS;
+const int PROFILE_MAX_STAGES = 32;
+
+struct LatencySummary
+{
+    uint64_t count;
+    double mean_ns;
+    double p50_ns;
+    double p99_ns;
+    double max_ns;
+};
+
+// Histogram written by a single thread and readable from any thread
+class LatencyHistogram
+{
+public:
+    LatencyHistogram();
+
+    void record(uint64_t ns);
+
+    // Add this histogram's contents to the given totals
+    void merge_into(uint64_t *counts, uint64_t &total, uint64_t &sum, uint64_t &max) const;
+
+    static int bucket_index(uint64_t ns);
+    static double bucket_value(int index);
+
+private:
+    std::atomic<uint64_t> counts[PROFILE_BUCKETS];
+    std::atomic<uint64_t> total;
+    std::atomic<uint64_t> sum;
+    std::atomic<uint64_t> max;
+};
+
+// A named pipeline stage. Construct at namespace scope (PROFILE_STAGE); the
+// stage registers itself for reports.
+class ProfileStage
+{
+public:
+    explicit ProfileStage(const char *name);
+
+    void record(uint64_t ns);
+    LatencySummary summary() const;
+    const char *name() const { return stage_name; }
+
+private:
+    ProfileStage(const ProfileStage &) = delete;
+    ProfileStage &operator=(const ProfileStage &) = delete;
+
+    const char *stage_name;
+    int index;
+};
+
+class ScopedTimer
+{
+public:
+    explicit ScopedTimer(ProfileStage &stage) : stage(stage), start(std::chrono::steady_clock::now()) {}
+    ~ScopedTimer()
+    {
+        stage.record(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+    }
+
+private:
+    ScopedTimer(const ScopedTimer &) = delete;
+    ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+    ProfileStage &stage;
+    std::chrono::steady_clock::time_point start;
+};
+
+// Print count, mean, p50, p99 and max for every stage that has samples
+void printProfile(std::ostream &out);
+
+// Print at most once every `interval_seconds`; call from a main loop
+void printProfileEvery(double interval_seconds);
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+
+#ifdef KINECT_PROFILE
+#define PROFILE_STAGE(var, name) static ProfileStage var(name)
+#define PROFILE_SCOPE(var) ScopedTimer PROFILE_CONCAT(profile_timer_, __LINE__)(var)
+#define PROFILE_REPORT(interval_seconds) printProfileEvery(interval_seconds)
+#define PROFILE_PRINT() printProfile(std::cout)
+#else
+#define PROFILE_STAGE(var, name)
+#define PROFILE_SCOPE(var)
+#define PROFILE_REPORT(interval_seconds)
+#define PROFILE_PRINT()
+#endif
+
+#endif
@@ -0,0 +1,192 @@
+#include "kinect_raw_video.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Larger than any Kinect stream; a header beyond this is not a raw video
+static const int RAW_VIDEO_MAX_DIMENSION = 16384;
+static const int RAW_VIDEO_MAX_CHANNELS = 4;
+
+static bool validHeader(const RawVideoHeader &header)
+{
+    return header.width > 0 && header.width <= RAW_VIDEO_MAX_DIMENSION && header.height > 0 &&
+           header.height <= RAW_VIDEO_MAX_DIMENSION && header.channels > 0 &&
+           header.channels <= RAW_VIDEO_MAX_CHANNELS && header.num_frames >= 0;
+}
+
+RawVideoWriter::RawVideoWriter(const char *filename, int expected_frames)
+    : filename(filename), expected_frames(expected_frames), file(nullptr), failed(false)
+{
+    header.width = header.height = header.channels = header.num_frames = 0;
+}
+
+RawVideoWriter::~RawVideoWriter()
+{
+    close();
+}
+
+bool RawVideoWriter::write_frame(const unsigned char *data, int width, int height, int channels)
+{
+    if (!file)
+    {
+        header.width = width;
+        header.height = height;
+        header.channels = channels;
+        header.num_frames = 0;
+        size_t frame_bytes = (size_t)width * height * channels;
+        file = new DirectFileWriter(filename.c_str(), sizeof(header) + (uint64_t)expected_frames * frame_bytes);
+        if (!file->is_open())
+            std::cout << "Failed to create " << filename << std::endl;
+        failed = !file->is_open() || !file->write(&header, sizeof(header));
+    }
+    else if (width != header.width || height != header.height || channels != header.channels)
+    {
+        std::cout << "Frame size changed in " << filename << std::endl;
+        return false;
+    }
+
+    if (failed || !file->write(data, (size_t)width * height * channels))
+    {
+        failed = true;
+        return false;
+    }
+    header.num_frames++;
+    return true;
+}
+
+bool RawVideoWriter::close()
+{
+    if (!file)
+        return false;
+
+    file->patch(offsetof(RawVideoHeader, num_frames), &header.num_frames, sizeof(header.num_frames));
+    if (!file->close())
+        failed = true;
+    delete file;
+    file = nullptr;
+    return !failed;
+}
+
+RawVideoReader::RawVideoReader(const char *filename)
+    : data(nullptr), file_bytes(0), bytes_per_frame(0), num_frames(0), prefetch_frames(0), prefetched_until(0)
+{
+    header.width = header.height = header.channels = header.num_frames = 0;
+
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        std::cout << "Failed to open video " << filename << std::endl;
+        return;
+    }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < (off_t)sizeof(RawVideoHeader))
+    {
+        std::cout << "Not a raw video: " << filename << std::endl;
+        close(fd);
+        return;
+    }
+
+    void *mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd); // the mapping keeps the file open
+    if (mapped == MAP_FAILED)
+    {
+        std::cout << "Failed to map video " << filename << std::endl;
+        return;
+    }
+
+    memcpy(&header, mapped, sizeof(header));
+    if (!validHeader(header))
+    {
+        std::cout << "Not a raw video: " << filename << std::endl;
+        munmap(mapped, info.st_size);
+        header.width = header.height = header.channels = header.num_frames = 0;
+        return;
+    }
+
+    data = (unsigned char *)mapped;
+    file_bytes = info.st_size;
+    bytes_per_frame = (size_t)header.width * header.height * header.channels;
+
+    // Trust the header only as far as the file goes; an unfinished video
+    // has no count at all
+    size_t complete = (file_bytes - sizeof(RawVideoHeader)) / bytes_per_frame;
+    complete = std::min(complete, (size_t)INT32_MAX);
+    num_frames = header.num_frames > 0 ? std::min(header.num_frames, (int)complete) : (int)complete;
+    if (truncated())
+    {
+        std::cout << "Video " << filename << " was not finished, reading the " << num_frames
+                  << " complete frames" << std::endl;
+    }
+}
+
+RawVideoReader::~RawVideoReader()
+{
+    if (data)
+        munmap(data, file_bytes);
+}
+
+bool RawVideoReader::frame_range(int first, int count, size_t &offset, size_t &bytes) const
+{
+    first = std::max(first, 0);
+    int end = (int)std::min((int64_t)first + std::max(count, 0), (int64_t)num_frames);
+    if (!data || first >= end)
+        return false;
+
+    offset = sizeof(RawVideoHeader) + first * bytes_per_frame;
+    bytes = (end - first) * bytes_per_frame;
+    return true;
+}
+
+const unsigned char *RawVideoReader::frame(int i)
+{
+    if (!data || i < 0 || i >= num_frames)
+        return nullptr;
+
+    // Only ask for the frames past the previous window, so stepping through
+    // the video costs one madvise per frame rather than one per window
+    if (prefetch_frames > 0)
+    {
+        int end = (int)std::min((int64_t)i + 1 + prefetch_frames, (int64_t)num_frames);
+        int first = prefetched_until > i + 1 && prefetched_until <= end ? prefetched_until : i + 1;
+        if (first < end)
+        {
+            prefetch(first, end - first);
+            prefetched_until = end;
+        }
+    }
+
+    return data + sizeof(RawVideoHeader) + i * bytes_per_frame;
+}
+
+void RawVideoReader::advise(Access access, int prefetch_frames)
+{
+    this->prefetch_frames = std::max(prefetch_frames, 0);
+    prefetched_until = 0;
+    if (!data)
+        return;
+
+    int advice = MADV_NORMAL;
+    if (access == Sequential)
+        advice = MADV_SEQUENTIAL;
+    else if (access == Random)
+        advice = MADV_RANDOM;
+    madvise(data, file_bytes, advice);
+}
+
+void RawVideoReader::prefetch(int first, int count) const
+{
+    size_t offset, bytes;
+    if (!frame_range(first, count, offset, bytes))
+        return;
+
+    // madvise wants a page-aligned start
+    size_t page_bytes = sysconf(_SC_PAGESIZE);
+    size_t start = offset / page_bytes * page_bytes;
+    madvise(data + start, offset + bytes - start, MADV_WILLNEED);
+}
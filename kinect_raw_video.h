@@ -0,0 +1,121 @@
+#ifndef KINECT_RAW_VIDEO_H
+#define KINECT_RAW_VIDEO_H
+
+#include <cstddef>
+#include <stdint.h>
+#include <string>
+
+#include "kinect_direct_writer.h"
+
+// Header of a .raw video as written by script_record_video, followed by the
+// frames back to back (width * height * channels bytes each). num_frames is
+// filled in when the video is finished, so it is 0 in a video cut short.
+struct RawVideoHeader
+{
+    int32_t width;
+    int32_t height;
+    int32_t channels;
+    int32_t num_frames;
+};
+
+// Writes a .raw video with DirectFileWriter, so a multi-GB video streams to
+// disk without filling the page cache. The header is written with the first
+// frame, which sets the frame size, and close() fills in the frame count.
+class RawVideoWriter
+{
+public:
+    // Room for `expected_frames` (if known) is reserved on disk once the
+    // first frame gives the frame size
+    RawVideoWriter(const char *filename, int expected_frames = 0);
+    ~RawVideoWriter();
+
+    // False if the frame could not be written or differs in size from the first
+    bool write_frame(const unsigned char *data, int width, int height, int channels);
+
+    // Finish the video; false if any frame failed to write
+    bool close();
+
+    bool is_open() const { return file != nullptr; }
+    int frame_count() const { return header.num_frames; }
+
+    // Null until the first frame
+    const DirectFileWriter *writer() const { return file; }
+
+private:
+    RawVideoWriter(const RawVideoWriter &) = delete;
+    RawVideoWriter &operator=(const RawVideoWriter &) = delete;
+
+    std::string filename;
+    int expected_frames;
+    DirectFileWriter *file;
+    RawVideoHeader header;
+    bool failed;
+};
+
+// Random access to the frames of a .raw video without reading it: the file
+// is mapped and frame(i) points straight into the mapping, so jumping around
+// a multi-GB video only pages in the frames that are looked at.
+//
+// A video truncated by a crash is still readable: a header without a frame
+// count, or with more frames than the file holds, is replaced by the number
+// of complete frames on disk, and a partly written last frame is ignored.
+class RawVideoReader
+{
+public:
+    // How the frames will be read, passed on to the kernel with madvise.
+    // Sequential reads ahead aggressively and frees pages once read; Random
+    // turns readahead off, so only the frames asked for (and prefetched) are
+    // read from disk.
+    enum Access
+    {
+        Normal,
+        Sequential,
+        Random
+    };
+
+    RawVideoReader(const char *filename);
+    ~RawVideoReader();
+
+    bool is_open() const { return data != nullptr; }
+
+    int width() const { return header.width; }
+    int height() const { return header.height; }
+    int channels() const { return header.channels; }
+    size_t frame_bytes() const { return bytes_per_frame; }
+
+    // Complete frames in the file
+    int frame_count() const { return num_frames; }
+
+    // True if the header's frame count did not match the file, i.e. the
+    // video was not finished
+    bool truncated() const { return header.num_frames != num_frames; }
+
+    // Frame `i`, valid while the reader is open; null if out of range. With
+    // a prefetch distance set, also starts reading the frames after it.
+    const unsigned char *frame(int i);
+
+    // Hint the access pattern, and keep the next `prefetch_frames` frames
+    // after each one read by frame() on their way in from disk
+    void advise(Access access, int prefetch_frames = 0);
+
+    // Start reading frames [first, first + count) from disk in the background
+    void prefetch(int first, int count) const;
+
+private:
+    RawVideoReader(const RawVideoReader &) = delete;
+    RawVideoReader &operator=(const RawVideoReader &) = delete;
+
+    // Byte range of frames [first, first + count), clipped to the video
+    bool frame_range(int first, int count, size_t &offset, size_t &bytes) const;
+
+    unsigned char *data;
+    size_t file_bytes;
+    RawVideoHeader header;
+    size_t bytes_per_frame;
+    int num_frames;
+
+    int prefetch_frames;
+    int prefetched_until; // frames before this were already prefetched
+};
+
+#endif
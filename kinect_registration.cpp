@@ -0,0 +1,145 @@
+#include "kinect_registration.h"
+#include "kinect_profile.h"
+#include <cstring>
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define KINECT_REGISTRATION_X86 1
+#include <immintrin.h>
+#endif
+
+DepthRayTable::DepthRayTable(const libfreenect2::Freenect2Device::IrCameraParams &params)
+    : rays(DEPTH_WIDTH * DEPTH_HEIGHT * 4)
+{
+    // Same pinhole model as Registration::getPointXYZ, with the mm -> m scale folded in
+    for (int y = 0; y < DEPTH_HEIGHT; y++)
+    {
+        for (int x = 0; x < DEPTH_WIDTH; x++)
+        {
+            float *r = &rays[(y * DEPTH_WIDTH + x) * 4];
+            r[0] = (float)((x + 0.5 - params.cx) / params.fx / 1000.0);
+            r[1] = (float)((y + 0.5 - params.cy) / params.fy / 1000.0);
+            r[2] = 1.0f / 1000.0f;
+            r[3] = 0.0f;
+        }
+    }
+}
+
+// Write point `n` unconditionally. Both stores are 4 wide and spill one
+// element into the next slot, which the next point overwrites.
+static inline void emitPoint(const DepthRayTable &rays, const unsigned char *registered,
+                             int idx, float d, int n, float *points, unsigned char *colors)
+{
+#ifdef KINECT_REGISTRATION_X86
+    _mm_storeu_ps(points + n * 3, _mm_mul_ps(_mm_set1_ps(d), _mm_loadu_ps(rays.ray(idx))));
+#else
+    rays.unproject(idx, d, points[n * 3 + 0], points[n * 3 + 1], points[n * 3 + 2]);
+#endif
+
+    // BGRX -> RGB in a register
+    uint32_t bgrx;
+    memcpy(&bgrx, registered + idx * 4, 4);
+    uint32_t rgb = ((bgrx >> 16) & 0xff) | (bgrx & 0xff00) | ((bgrx & 0xff) << 16);
+    memcpy(colors + n * 3, &rgb, 4);
+}
+
+static int unprojectDepthScalar(const DepthRayTable &rays, const float *depth, const unsigned char *registered,
+                                const DepthRange &range, int begin, int end, int n,
+                                float *points, unsigned char *colors)
+{
+    for (int idx = begin; idx < end; idx++)
+    {
+        float d = depth[idx];
+        emitPoint(rays, registered, idx, d, n, points, colors);
+        n += (d > range.min_mm) & (d < range.max_mm);
+    }
+    return n;
+}
+
+#ifdef KINECT_REGISTRATION_X86
+
+// Test 16 pixels at a time and compress the in-range ones before emitting
+__attribute__((target("avx512f"))) static int unprojectDepthAVX512(const DepthRayTable &rays, const float *depth,
+                                                                   const unsigned char *registered,
+                                                                   const DepthRange &range, int begin, int end,
+                                                                   float *points, unsigned char *colors)
+{
+    const __m512 lo = _mm512_set1_ps(range.min_mm);
+    const __m512 hi = _mm512_set1_ps(range.max_mm);
+    const __m512i step = _mm512_set1_epi32(16);
+    __m512i pixel = _mm512_add_epi32(_mm512_set1_epi32(begin),
+                                     _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+
+    int idx_buf[16];
+    float depth_buf[16];
+    int n = 0;
+    int i = begin;
+
+    for (; i + 16 <= end; i += 16)
+    {
+        __m512 d = _mm512_loadu_ps(depth + i);
+        __mmask16 valid = _mm512_cmp_ps_mask(d, lo, _CMP_GT_OQ) & _mm512_cmp_ps_mask(d, hi, _CMP_LT_OQ);
+        _mm512_mask_compressstoreu_epi32(idx_buf, valid, pixel);
+        _mm512_mask_compressstoreu_ps(depth_buf, valid, d);
+        pixel = _mm512_add_epi32(pixel, step);
+
+        int count = __builtin_popcount(valid);
+        for (int k = 0; k < count; k++)
+        {
+            emitPoint(rays, registered, idx_buf[k], depth_buf[k], n + k, points, colors);
+        }
+        n += count;
+    }
+
+    return unprojectDepthScalar(rays, depth, registered, range, i, end, n, points, colors);
+}
+
+#endif
+
+int unprojectDepthRows(const DepthRayTable &rays, const float *depth, const unsigned char *registered,
+                       const DepthRange &range, int row_begin, int row_end,
+                       float *points, unsigned char *colors)
+{
+    int begin = row_begin * DEPTH_WIDTH;
+    int end = row_end * DEPTH_WIDTH;
+
+#ifdef KINECT_REGISTRATION_X86
+    static const bool has_avx512 = __builtin_cpu_supports("avx512f");
+    if (has_avx512)
+        return unprojectDepthAVX512(rays, depth, registered, range, begin, end, points, colors);
+#endif
+    return unprojectDepthScalar(rays, depth, registered, range, begin, end, 0, points, colors);
+}
+
+int unprojectDepth(const DepthRayTable &rays, const float *depth, const unsigned char *registered,
+                   const DepthRange &range, float *points, unsigned char *colors)
+{
+    return unprojectDepthRows(rays, depth, registered, range, 0, DEPTH_HEIGHT, points, colors);
+}
+
+RegistrationContext::RegistrationContext(const libfreenect2::Freenect2Device::IrCameraParams &ir_params,
+                                         const libfreenect2::Freenect2Device::ColorCameraParams &color_params)
+    : registration(new libfreenect2::Registration(ir_params, color_params)),
+      ray_table(ir_params),
+      undistorted_frame(DEPTH_WIDTH, DEPTH_HEIGHT, 4),
+      registered_frame(DEPTH_WIDTH, DEPTH_HEIGHT, 4)
+{
+}
+
+RegistrationContext::~RegistrationContext()
+{
+    delete registration;
+}
+
+PROFILE_STAGE(registration_stage, "registration_apply");
+
+void RegistrationContext::apply(const libfreenect2::Frame *rgb, const libfreenect2::Frame *depth)
+{
+    PROFILE_SCOPE(registration_stage);
+    registration->apply(rgb, depth, &undistorted_frame, &registered_frame);
+}
+
+int RegistrationContext::unproject(const DepthRange &range, float *points, unsigned char *colors) const
+{
+    return unprojectDepth(ray_table, undistorted(), registered(), range, points, colors);
+}
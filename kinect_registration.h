@@ -0,0 +1,96 @@
+#ifndef KINECT_REGISTRATION_H
+#define KINECT_REGISTRATION_H
+
+#include <vector>
+#include <libfreenect2/libfreenect2.hpp>
+#include <libfreenect2/registration.h>
+
+// Size of the depth/IR image and of the undistorted/registered frames
+const int DEPTH_WIDTH = 512;
+const int DEPTH_HEIGHT = 424;
+
+// Worst-case point cloud buffer sizes. Points and colors are written with
+// 4-wide stores that spill one element, so each row gets one spare element;
+// that lets rows be unprojected in parallel and compacted afterwards.
+const int MAX_CLOUD_POINTS = DEPTH_WIDTH * DEPTH_HEIGHT;
+const int CLOUD_ROW_STRIDE = DEPTH_WIDTH * 3 + 1;
+const int CLOUD_POINTS_FLOATS = CLOUD_ROW_STRIDE * DEPTH_HEIGHT;
+const int CLOUD_COLORS_BYTES = CLOUD_ROW_STRIDE * DEPTH_HEIGHT;
+
+// Depth values (mm) kept when building a point cloud: min_mm < d < max_mm
+struct DepthRange
+{
+    DepthRange(float min_mm = 0.0f, float max_mm = 4500.0f) : min_mm(min_mm), max_mm(max_mm) {}
+
+    float min_mm;
+    float max_mm;
+};
+
+// Per-pixel unprojection rays for the undistorted depth image, built once from
+// the IR intrinsics. Multiplying a depth value in millimeters by its ray gives
+// the same point in meters as Registration::getPointXYZ.
+class DepthRayTable
+{
+public:
+    DepthRayTable(const libfreenect2::Freenect2Device::IrCameraParams &params);
+
+    // Ray for pixel `idx` (y * DEPTH_WIDTH + x) as {x/z, y/z, 1, 0} scaled by 1/1000
+    const float *ray(int idx) const { return &rays[idx * 4]; }
+
+    void unproject(int idx, float depth_mm, float &x, float &y, float &z) const
+    {
+        const float *r = ray(idx);
+        x = depth_mm * r[0];
+        y = depth_mm * r[1];
+        z = depth_mm * r[2];
+    }
+
+private:
+    std::vector<float> rays;
+};
+
+// Unproject every in-range pixel of an undistorted depth image in a single
+// branch-free pass, writing packed XYZ points and the matching RGB colors from
+// the registered BGRX image. `points` and `colors` must be sized with
+// CLOUD_POINTS_FLOATS / CLOUD_COLORS_BYTES. Returns the number of points.
+int unprojectDepth(const DepthRayTable &rays, const float *depth, const unsigned char *registered,
+                   const DepthRange &range, float *points, unsigned char *colors);
+
+// Same for rows [row_begin, row_end) only. Needs room for the rows' pixels
+// plus one spare element (CLOUD_ROW_STRIDE per row is always enough).
+int unprojectDepthRows(const DepthRayTable &rays, const float *depth, const unsigned char *registered,
+                       const DepthRange &range, int row_begin, int row_end,
+                       float *points, unsigned char *colors);
+
+// Reusable registration workspace: owns the Registration, its ray table and
+// the undistorted/registered frames so per-frame registration allocates
+// nothing. apply() overwrites the frames, so use one context per thread.
+class RegistrationContext
+{
+public:
+    RegistrationContext(const libfreenect2::Freenect2Device::IrCameraParams &ir_params,
+                        const libfreenect2::Freenect2Device::ColorCameraParams &color_params);
+    ~RegistrationContext();
+
+    // Undistort depth and map color onto it, into the owned frames
+    void apply(const libfreenect2::Frame *rgb, const libfreenect2::Frame *depth);
+
+    // Unproject the last applied frame (see unprojectDepth)
+    int unproject(const DepthRange &range, float *points, unsigned char *colors) const;
+
+    libfreenect2::Registration *get_registration() const { return registration; }
+    const DepthRayTable &rays() const { return ray_table; }
+    const float *undistorted() const { return (const float *)undistorted_frame.data; }
+    const unsigned char *registered() const { return registered_frame.data; }
+
+private:
+    RegistrationContext(const RegistrationContext &) = delete;
+    RegistrationContext &operator=(const RegistrationContext &) = delete;
+
+    libfreenect2::Registration *registration;
+    DepthRayTable ray_table;
+    libfreenect2::Frame undistorted_frame;
+    libfreenect2::Frame registered_frame;
+};
+
+#endif
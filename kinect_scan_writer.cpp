@@ -0,0 +1,73 @@
+#include "kinect_scan_writer.h"
+
+AsyncScanWriter::AsyncScanWriter(size_t max_queued)
+    : max_queued(max_queued < 1 ? 1 : max_queued), writing(false), stopping(false)
+{
+    thread = std::thread(&AsyncScanWriter::worker, this);
+}
+
+AsyncScanWriter::~AsyncScanWriter()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    job_ready.notify_all();
+    thread.join();
+}
+
+void AsyncScanWriter::write(const std::string &filename, PooledPointCloud &&cloud)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    // Backpressure: wait for the writer to catch up. The cloud being
+    // written still holds its buffers, so it counts against the bound.
+    slot_free.wait(lock, [this]
+                   { return queue.size() + (writing ? 1 : 0) < max_queued; });
+
+    Job job;
+    job.filename = filename;
+    job.cloud = std::move(cloud);
+    queue.push_back(std::move(job));
+    job_ready.notify_one();
+}
+
+void AsyncScanWriter::flush()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    slot_free.wait(lock, [this]
+                   { return queue.empty() && !writing; });
+}
+
+size_t AsyncScanWriter::pending()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return queue.size() + (writing ? 1 : 0);
+}
+
+void AsyncScanWriter::worker()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (true)
+    {
+        job_ready.wait(lock, [this]
+                       { return stopping || !queue.empty(); });
+
+        // Drain the queue before honouring a stop request
+        if (queue.empty())
+            return;
+
+        Job job = std::move(queue.front());
+        queue.pop_front();
+        writing = true;
+
+        lock.unlock();
+        savePointCloudPLY(job.filename.c_str(), job.cloud.cloud);
+        job = Job(); // return the buffers to their pool before reporting done
+        lock.lock();
+
+        writing = false;
+        slot_free.notify_all();
+    }
+}
@@ -0,0 +1,55 @@
+#ifndef KINECT_SCAN_WRITER_H
+#define KINECT_SCAN_WRITER_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "kinect_capture.h"
+
+// Saves point clouds as PLY on a background thread so capture overlaps disk
+// I/O. The queue is bounded: write() blocks while max_queued clouds are
+// queued or being written. Everything queued is written before the
+// destructor returns.
+class AsyncScanWriter
+{
+public:
+    // Two slots by default: one cloud being written, one waiting
+    explicit AsyncScanWriter(size_t max_queued = 2);
+    ~AsyncScanWriter();
+
+    // Queue a cloud, taking over its pooled buffers. They go back to their
+    // pool once the file is written.
+    void write(const std::string &filename, PooledPointCloud &&cloud);
+
+    // Block until every queued cloud has been written
+    void flush();
+
+    // Clouds queued or being written
+    size_t pending();
+
+private:
+    struct Job
+    {
+        std::string filename;
+        PooledPointCloud cloud;
+    };
+
+    void worker();
+
+    AsyncScanWriter(const AsyncScanWriter &) = delete;
+    AsyncScanWriter &operator=(const AsyncScanWriter &) = delete;
+
+    size_t max_queued;
+    std::deque<Job> queue;
+    bool writing;
+    bool stopping;
+    std::mutex mutex;
+    std::condition_variable job_ready;
+    std::condition_variable slot_free;
+    std::thread thread;
+};
+
+#endif
@@ -0,0 +1,693 @@
+#include "kinect_source.h"
+#include "kinect_depth_codec.h"
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+static const char RECORDING_MAGIC[8] = {'K', 'F', 'R', 'A', 'M', 'E', 'S', '1'};
+static const char RECORDING_INDEX_MAGIC[8] = {'K', 'F', 'R', 'I', 'N', 'D', 'E', 'X'};
+
+// Largest frame a recording may contain (1920x1080 BGRX)
+static const size_t MAX_RECORDED_FRAME_BYTES = 1920 * 1080 * 4;
+
+// In real-time replay, frame sets more than this far behind the clock are dropped
+static const std::chrono::milliseconds REPLAY_MAX_LAG(50);
+
+static bool readAll(int fd, void *data, size_t bytes)
+{
+    unsigned char *dst = (unsigned char *)data;
+    while (bytes > 0)
+    {
+        ssize_t n = read(fd, dst, bytes);
+        if (n <= 0)
+            return false;
+        dst += n;
+        bytes -= n;
+    }
+    return true;
+}
+
+LiveFrameSource::LiveFrameSource(unsigned int frame_types, libfreenect2::PacketPipeline *pipeline,
+                                 const std::string &serial)
+    : dev(nullptr), device_serial(serial), listener(nullptr), streams(frame_types), color_only(false)
+{
+    if (!pipeline)
+        pipeline = new libfreenect2::CpuPacketPipeline();
+
+    color_only = dynamic_cast<libfreenect2::DumpPacketPipeline *>(pipeline) != nullptr;
+    if (color_only && (frame_types & (libfreenect2::Frame::Depth | libfreenect2::Frame::Ir)))
+    {
+        std::cout << "DumpPacketPipeline only supports the Color stream, use PassthroughColorPipeline for "
+                     "compressed color with depth"
+                  << std::endl;
+        delete pipeline;
+        return;
+    }
+
+    if (freenect2.enumerateDevices() == 0)
+    {
+        std::cout << "No Kinect detected" << std::endl;
+        delete pipeline;
+        return;
+    }
+
+    if (device_serial.empty())
+        device_serial = freenect2.getDefaultDeviceSerialNumber();
+    std::cout << "Opening device: " << device_serial << std::endl;
+
+    dev = freenect2.openDevice(device_serial, pipeline);
+    if (!dev)
+    {
+        std::cout << "Failed to open device" << std::endl;
+        return;
+    }
+
+    if (!start_streams())
+    {
+        std::cout << "Failed to start device" << std::endl;
+        close_device();
+    }
+}
+
+LiveFrameSource::~LiveFrameSource()
+{
+    if (dev)
+    {
+        dev->stop();
+        close_device();
+    }
+    delete listener;
+}
+
+void LiveFrameSource::close_device()
+{
+    dev->close();
+    delete dev;
+    dev = nullptr;
+}
+
+bool LiveFrameSource::start_streams()
+{
+    bool color = (streams & libfreenect2::Frame::Color) != 0;
+    bool depth = (streams & (libfreenect2::Frame::Depth | libfreenect2::Frame::Ir)) != 0;
+
+    // The device is stopped here, so nothing is still calling the old listener
+    delete listener;
+    listener = new libfreenect2::SyncMultiFrameListener(streams);
+    dev->setColorFrameListener(color ? listener : nullptr);
+    dev->setIrAndDepthFrameListener(depth ? listener : nullptr);
+
+    return dev->startStreams(color, depth);
+}
+
+bool LiveFrameSource::select_streams(unsigned int frame_types)
+{
+    if (!dev)
+        return false;
+    if (frame_types == streams)
+        return true;
+    if ((frame_types & (libfreenect2::Frame::Color | libfreenect2::Frame::Depth | libfreenect2::Frame::Ir)) == 0)
+    {
+        std::cout << "No streams selected" << std::endl;
+        return false;
+    }
+    if (color_only && (frame_types & (libfreenect2::Frame::Depth | libfreenect2::Frame::Ir)))
+    {
+        std::cout << "DumpPacketPipeline only supports the Color stream" << std::endl;
+        return false;
+    }
+
+    dev->stop();
+    streams = frame_types;
+    if (!start_streams())
+    {
+        std::cout << "Failed to restart device" << std::endl;
+        close_device();
+        return false;
+    }
+    return true;
+}
+
+PassthroughColorPipeline::PassthroughColorPipeline(libfreenect2::PacketPipeline *depth_pipeline)
+    : color_pipeline(new libfreenect2::DumpPacketPipeline()),
+      depth_pipeline(depth_pipeline ? depth_pipeline : new libfreenect2::CpuPacketPipeline())
+{
+}
+
+PassthroughColorPipeline::~PassthroughColorPipeline()
+{
+    delete depth_pipeline;
+    delete color_pipeline;
+}
+
+libfreenect2::PacketPipeline::PacketParser *PassthroughColorPipeline::getRgbPacketParser() const
+{
+    return color_pipeline->getRgbPacketParser();
+}
+
+libfreenect2::PacketPipeline::PacketParser *PassthroughColorPipeline::getIrPacketParser() const
+{
+    return depth_pipeline->getIrPacketParser();
+}
+
+libfreenect2::RgbPacketProcessor *PassthroughColorPipeline::getRgbPacketProcessor() const
+{
+    return color_pipeline->getRgbPacketProcessor();
+}
+
+libfreenect2::DepthPacketProcessor *PassthroughColorPipeline::getDepthPacketProcessor() const
+{
+    return depth_pipeline->getDepthPacketProcessor();
+}
+
+std::vector<std::string> connectedDeviceSerials()
+{
+    libfreenect2::Freenect2 freenect2;
+    std::vector<std::string> serials;
+    int count = freenect2.enumerateDevices();
+    for (int i = 0; i < count; i++)
+    {
+        serials.push_back(freenect2.getDeviceSerialNumber(i));
+    }
+    return serials;
+}
+
+StreamSelection parseStreams(const std::string &names)
+{
+    StreamSelection selection = {0, false, false};
+    selection.compressed_color = names.find("jpeg") != std::string::npos;
+    selection.lossless_depth = names.find("depth16") != std::string::npos;
+    if (names.find("color") != std::string::npos || selection.compressed_color)
+        selection.frame_types |= libfreenect2::Frame::Color;
+    if (names.find("depth") != std::string::npos)
+        selection.frame_types |= libfreenect2::Frame::Depth;
+    if (names.find("ir") != std::string::npos)
+        selection.frame_types |= libfreenect2::Frame::Ir;
+    return selection;
+}
+
+bool LiveFrameSource::wait_for_frames(libfreenect2::FrameMap &frames, int timeout_ms)
+{
+    return listener && listener->waitForNewFrame(frames, timeout_ms);
+}
+
+void LiveFrameSource::release(libfreenect2::FrameMap &frames)
+{
+    listener->release(frames);
+}
+
+libfreenect2::Freenect2Device::IrCameraParams LiveFrameSource::ir_params()
+{
+    return dev->getIrCameraParams();
+}
+
+libfreenect2::Freenect2Device::ColorCameraParams LiveFrameSource::color_params()
+{
+    return dev->getColorCameraParams();
+}
+
+FrameSetWriter::FrameSetWriter(const char *filename,
+                               const libfreenect2::Freenect2Device::IrCameraParams &ir_params,
+                               const libfreenect2::Freenect2Device::ColorCameraParams &color_params,
+                               bool lossless_depth, size_t max_queued)
+    : file(filename), failed(false), lossless_depth(lossless_depth), offset(0), slots(std::max<size_t>(1, max_queued)),
+      head(0), queued(0), max_depth(0), stopping(false)
+{
+    if (!file.is_open())
+        return;
+
+    append(RECORDING_MAGIC, sizeof(RECORDING_MAGIC));
+    append(&ir_params, sizeof(ir_params));
+    append(&color_params, sizeof(color_params));
+
+    thread = std::thread(&FrameSetWriter::worker, this);
+}
+
+FrameSetWriter::~FrameSetWriter()
+{
+    close();
+}
+
+void FrameSetWriter::append(const void *data, size_t bytes)
+{
+    offset += bytes;
+    if (!file.write(data, bytes))
+        failed = true;
+}
+
+void FrameSetWriter::write(const FrameLease &lease)
+{
+    write(lease.color(), lease.depth(), lease.ir());
+}
+
+void FrameSetWriter::write(const FrameView &color, const FrameView &depth, const FrameView &ir)
+{
+    if (!file.is_open())
+        return;
+
+    const libfreenect2::Frame::Type types[3] = {libfreenect2::Frame::Color, libfreenect2::Frame::Depth,
+                                                libfreenect2::Frame::Ir};
+    const FrameView *views[3] = {&color, &depth, &ir};
+
+    std::unique_lock<std::mutex> lock(mutex);
+    slot_free.wait(lock, [&]
+                   { return queued < slots.size(); });
+    QueuedSet &set = slots[(head + queued) % slots.size()];
+    lock.unlock();
+
+    // Copy now, so the lease can go back to the device as soon as this returns
+    set.count = 0;
+    for (int i = 0; i < 3; i++)
+    {
+        const FrameView &view = *views[i];
+        if (!view.valid())
+            continue;
+
+        RecordedFrameHeader &header = set.headers[set.count];
+        header.type = types[i];
+        header.width = view.width;
+        header.height = view.height;
+        header.bytes_per_pixel = view.bytes_per_pixel;
+        header.format = view.format;
+        header.timestamp = view.timestamp;
+        header.sequence = view.sequence;
+        set.data[set.count++].assign(view.data, view.data + view.size());
+    }
+    if (set.count == 0)
+        return;
+
+    lock.lock();
+    queued++;
+    max_depth = std::max(max_depth, queued);
+    lock.unlock();
+    set_ready.notify_one();
+}
+
+void FrameSetWriter::worker()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        set_ready.wait(lock, [&]
+                       { return stopping || queued > 0; });
+        if (queued == 0)
+            return;
+
+        // Written outside the lock; the slot stays counted until it is done
+        const QueuedSet &set = slots[head];
+        lock.unlock();
+        write_set(set);
+        lock.lock();
+
+        head = (head + 1) % slots.size();
+        queued--;
+        slot_free.notify_one();
+    }
+}
+
+// All stream headers first so the reader can skip a set in one seek
+void FrameSetWriter::write_set(const QueuedSet &set)
+{
+    RecordedFrameHeader headers[3];
+    const unsigned char *data[3];
+    size_t bytes[3];
+    RecordedSetIndex entry = {};
+    entry.offset = offset;
+    entry.timestamp = set.headers[0].timestamp;
+    entry.sequence = set.headers[0].sequence;
+
+    for (uint32_t i = 0; i < set.count; i++)
+    {
+        const RecordedFrameHeader &h = set.headers[i];
+        headers[i] = h;
+        data[i] = set.data[i].data();
+        bytes[i] = (size_t)h.width * h.height * h.bytes_per_pixel;
+        entry.streams |= h.type;
+
+        if (lossless_depth && h.type == libfreenect2::Frame::Depth && h.format == libfreenect2::Frame::Float &&
+            h.bytes_per_pixel == sizeof(float))
+        {
+            encoded_depth.resize(depthCodecMaxBytes(h.width, h.height));
+            bytes[i] = encodeDepth((const float *)data[i], h.width, h.height, encoded_depth.data());
+            data[i] = encoded_depth.data();
+            headers[i].width = 1;
+            headers[i].height = 1;
+            headers[i].bytes_per_pixel = (uint32_t)bytes[i];
+            headers[i].format = RECORDED_FORMAT_LOSSLESS_DEPTH;
+        }
+    }
+
+    append(&set.count, sizeof(set.count));
+    append(headers, set.count * sizeof(RecordedFrameHeader));
+    for (uint32_t i = 0; i < set.count; i++)
+    {
+        append(data[i], bytes[i]);
+    }
+
+    // sets_written() reads the index from other threads
+    std::lock_guard<std::mutex> lock(mutex);
+    index.push_back(entry);
+}
+
+size_t FrameSetWriter::sets_written()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return index.size();
+}
+
+size_t FrameSetWriter::max_queue_depth()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return max_depth;
+}
+
+bool FrameSetWriter::close()
+{
+    if (!file.is_open())
+        return false;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    set_ready.notify_one();
+    thread.join();
+
+    // A zero stream count ends the frame sets for readers that ignore the index
+    uint32_t end_of_sets = 0;
+    append(&end_of_sets, sizeof(end_of_sets));
+
+    RecordingFooter footer;
+    footer.index_offset = offset;
+    footer.set_count = index.size();
+    memcpy(footer.magic, RECORDING_INDEX_MAGIC, sizeof(footer.magic));
+    if (!index.empty())
+        append(&index[0], index.size() * sizeof(RecordedSetIndex));
+    append(&footer, sizeof(footer));
+
+    if (!file.close())
+        failed = true;
+    return !failed;
+}
+
+ReplayFrameSource::ReplayFrameSource(const char *filename, bool real_time, bool loop)
+    : real_time(real_time), loop(loop), at_end(false), pending(false), first_frame_offset(0),
+      wanted_streams(libfreenect2::Frame::Color | libfreenect2::Frame::Depth | libfreenect2::Frame::Ir),
+      set_streams(0), clock_started(false), first_timestamp(0)
+{
+    fd = open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        std::cout << "Failed to open recording " << filename << std::endl;
+        return;
+    }
+
+    char magic[sizeof(RECORDING_MAGIC)];
+    if (!readAll(fd, magic, sizeof(magic)) || memcmp(magic, RECORDING_MAGIC, sizeof(magic)) != 0 ||
+        !readAll(fd, &ir, sizeof(ir)) || !readAll(fd, &color, sizeof(color)))
+    {
+        std::cout << "Not a frame recording: " << filename << std::endl;
+        ::close(fd);
+        fd = -1;
+        return;
+    }
+    first_frame_offset = lseek(fd, 0, SEEK_CUR);
+
+    read_index();
+    lseek(fd, first_frame_offset, SEEK_SET);
+}
+
+// The index is optional: without a valid footer the recording is played
+// front to back as before
+bool ReplayFrameSource::read_index()
+{
+    off_t end = lseek(fd, 0, SEEK_END);
+    RecordingFooter footer;
+    if (end < first_frame_offset + (off_t)sizeof(footer) ||
+        lseek(fd, end - sizeof(footer), SEEK_SET) < 0 || !readAll(fd, &footer, sizeof(footer)) ||
+        memcmp(footer.magic, RECORDING_INDEX_MAGIC, sizeof(footer.magic)) != 0)
+    {
+        return false;
+    }
+
+    if (footer.index_offset < (uint64_t)first_frame_offset ||
+        footer.index_offset + footer.set_count * sizeof(RecordedSetIndex) + sizeof(footer) != (uint64_t)end)
+    {
+        std::cout << "Ignoring a damaged recording index" << std::endl;
+        return false;
+    }
+
+    index.resize(footer.set_count);
+    if (footer.set_count > 0 &&
+        (lseek(fd, footer.index_offset, SEEK_SET) < 0 ||
+         !readAll(fd, &index[0], footer.set_count * sizeof(RecordedSetIndex))))
+    {
+        index.clear();
+        return false;
+    }
+    return true;
+}
+
+bool ReplayFrameSource::seek_set(int set)
+{
+    if (fd < 0 || set < 0 || set >= (int)index.size())
+        return false;
+
+    lseek(fd, index[set].offset, SEEK_SET);
+    pending = false;
+    at_end = false;
+    clock_started = false;
+    return true;
+}
+
+ReplayFrameSource::~ReplayFrameSource()
+{
+    for (std::map<uint32_t, libfreenect2::Frame *>::iterator it = frames_by_type.begin(); it != frames_by_type.end(); ++it)
+    {
+        delete it->second;
+    }
+    if (fd >= 0)
+        ::close(fd);
+}
+
+bool ReplayFrameSource::read_set_headers()
+{
+    if (!readAll(fd, &set_streams, sizeof(set_streams)) || set_streams < 1 || set_streams > 3 ||
+        !readAll(fd, headers, set_streams * sizeof(RecordedFrameHeader)))
+    {
+        return false;
+    }
+
+    // A set cut short by a crash (or garbage) ends the recording
+    for (uint32_t i = 0; i < set_streams; i++)
+    {
+        const RecordedFrameHeader &h = headers[i];
+        if ((h.type != libfreenect2::Frame::Color && h.type != libfreenect2::Frame::Depth &&
+             h.type != libfreenect2::Frame::Ir) ||
+            (size_t)h.width * h.height * h.bytes_per_pixel > MAX_RECORDED_FRAME_BYTES)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ReplayFrameSource::set_has_wanted_stream() const
+{
+    for (uint32_t i = 0; i < set_streams; i++)
+    {
+        if (headers[i].type & wanted_streams)
+            return true;
+    }
+    return false;
+}
+
+bool ReplayFrameSource::select_streams(unsigned int frame_types)
+{
+    if ((frame_types & (libfreenect2::Frame::Color | libfreenect2::Frame::Depth | libfreenect2::Frame::Ir)) == 0)
+    {
+        std::cout << "No streams selected" << std::endl;
+        return false;
+    }
+
+    wanted_streams = frame_types;
+    if (pending && !set_has_wanted_stream())
+    {
+        skip_set_data();
+        pending = false;
+    }
+    return true;
+}
+
+bool ReplayFrameSource::read_set_data()
+{
+    for (uint32_t i = 0; i < set_streams; i++)
+    {
+        const RecordedFrameHeader &h = headers[i];
+        size_t bytes = (size_t)h.width * h.height * h.bytes_per_pixel;
+        if (!(h.type & wanted_streams))
+        {
+            lseek(fd, (off_t)bytes, SEEK_CUR);
+            continue;
+        }
+
+        // Losslessly coded depth is read whole, then decoded into a Float frame
+        bool lossless_depth = h.format == RECORDED_FORMAT_LOSSLESS_DEPTH;
+        size_t width = h.width, height = h.height, bytes_per_pixel = h.bytes_per_pixel;
+        if (lossless_depth)
+        {
+            int coded_width, coded_height;
+            encoded_depth.resize(bytes);
+            if (!readAll(fd, encoded_depth.data(), bytes) ||
+                !depthCodecDimensions(encoded_depth.data(), bytes, coded_width, coded_height) ||
+                (size_t)coded_width * coded_height * sizeof(float) > MAX_RECORDED_FRAME_BYTES)
+            {
+                return false;
+            }
+            width = coded_width;
+            height = coded_height;
+            bytes_per_pixel = sizeof(float);
+        }
+
+        libfreenect2::Frame *&frame = frames_by_type[h.type];
+        if (frame && (frame->width != width || frame->height != height || frame->bytes_per_pixel != bytes_per_pixel))
+        {
+            delete frame;
+            frame = nullptr;
+        }
+        if (!frame)
+            frame = new libfreenect2::Frame(width, height, bytes_per_pixel);
+
+        if (lossless_depth)
+        {
+            if (!decodeDepth(encoded_depth.data(), bytes, (float *)frame->data, width, height))
+            {
+                std::cout << "Corrupt depth frame in recording" << std::endl;
+                return false;
+            }
+            frame->format = libfreenect2::Frame::Float;
+        }
+        else
+        {
+            if (!readAll(fd, frame->data, bytes))
+                return false;
+            frame->format = (libfreenect2::Frame::Format)h.format;
+        }
+        frame->timestamp = h.timestamp;
+        frame->sequence = h.sequence;
+    }
+    return true;
+}
+
+void ReplayFrameSource::skip_set_data()
+{
+    off_t bytes = 0;
+    for (uint32_t i = 0; i < set_streams; i++)
+    {
+        bytes += (off_t)headers[i].width * headers[i].height * headers[i].bytes_per_pixel;
+    }
+    lseek(fd, bytes, SEEK_CUR);
+}
+
+void ReplayFrameSource::rewind()
+{
+    lseek(fd, first_frame_offset, SEEK_SET);
+    clock_started = false;
+}
+
+bool ReplayFrameSource::next_set()
+{
+    bool rewound = false;
+    while (true)
+    {
+        if (read_set_headers())
+        {
+            if (set_has_wanted_stream())
+                return true;
+            skip_set_data();
+            continue;
+        }
+
+        // Rewind at most once, so a recording without the wanted streams ends
+        if (!loop || rewound)
+            break;
+        rewind();
+        rewound = true;
+    }
+
+    at_end = true;
+    return false;
+}
+
+bool ReplayFrameSource::wait_for_frames(libfreenect2::FrameMap &frames, int timeout_ms)
+{
+    if (fd < 0 || at_end)
+        return false;
+
+    if (!pending)
+    {
+        if (!next_set())
+            return false;
+        pending = true;
+    }
+
+    if (real_time)
+    {
+        std::chrono::steady_clock::time_point due;
+        while (true)
+        {
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            if (!clock_started)
+            {
+                clock_started = true;
+                first_timestamp = headers[0].timestamp;
+                start_time = now;
+            }
+
+            // Device timestamps count 0.1 ms ticks
+            due = start_time + std::chrono::microseconds((headers[0].timestamp - first_timestamp) * 100LL);
+            if (now - due <= REPLAY_MAX_LAG)
+                break;
+
+            skip_set_data();
+            pending = false;
+            if (!next_set())
+                return false;
+            pending = true;
+        }
+
+        std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+        if (due > deadline)
+        {
+            std::this_thread::sleep_until(deadline);
+            return false;
+        }
+        std::this_thread::sleep_until(due);
+    }
+
+    pending = false;
+    if (!read_set_data())
+    {
+        at_end = !loop;
+        if (loop)
+            rewind();
+        return false;
+    }
+
+    for (uint32_t i = 0; i < set_streams; i++)
+    {
+        if (headers[i].type & wanted_streams)
+            frames[(libfreenect2::Frame::Type)headers[i].type] = frames_by_type[headers[i].type];
+    }
+    return true;
+}
+
+void ReplayFrameSource::release(libfreenect2::FrameMap &frames)
+{
+    // The frames belong to the source and are refilled by the next set
+    frames.clear();
+}
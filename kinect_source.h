@@ -0,0 +1,285 @@
+#ifndef KINECT_SOURCE_H
+#define KINECT_SOURCE_H
+
+#include <libfreenect2/libfreenect2.hpp>
+#include <libfreenect2/frame_listener_impl.h>
+#include <libfreenect2/packet_pipeline.h>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "kinect_direct_writer.h"
+#include "kinect_frame.h"
+
+// A Kinect (the default one unless a serial is given), opened and started on
+// construction and stopped on destruction. Setup errors are printed; check
+// is_open() before use.
+//
+// Only the USB streams and packet processing the selected frame types need
+// are started: without Color no JPEG is decoded, without Depth and Ir no depth
+// packets are processed. Depth and IR come out of the same processing, so
+// either one costs the same as both.
+//
+// With a PassthroughColorPipeline the color frames are the camera's JPEGs,
+// passed through without decoding (see FrameView::compressed), alongside
+// processed depth and IR. A plain DumpPacketPipeline passes color through
+// too but leaves depth packets undecoded, so it is limited to the Color
+// stream.
+class LiveFrameSource : public FrameSource
+{
+public:
+    // Takes ownership of `pipeline` (CPU pipeline when null)
+    LiveFrameSource(unsigned int frame_types, libfreenect2::PacketPipeline *pipeline = nullptr,
+                    const std::string &serial = std::string());
+    ~LiveFrameSource();
+
+    bool is_open() const { return dev != nullptr; }
+    bool wait_for_frames(libfreenect2::FrameMap &frames, int timeout_ms);
+    void release(libfreenect2::FrameMap &frames);
+    libfreenect2::Freenect2Device::IrCameraParams ir_params();
+    libfreenect2::Freenect2Device::ColorCameraParams color_params();
+
+    // Restarts the device with a listener for just these streams
+    bool select_streams(unsigned int frame_types);
+    unsigned int selected_streams() const { return streams; }
+
+    libfreenect2::Freenect2Device *device() { return dev; }
+    const std::string &serial() const { return device_serial; }
+
+private:
+    LiveFrameSource(const LiveFrameSource &) = delete;
+    LiveFrameSource &operator=(const LiveFrameSource &) = delete;
+
+    // Attach a new listener for `streams` and start the streams it needs
+    bool start_streams();
+    void close_device();
+
+    libfreenect2::Freenect2 freenect2;
+    libfreenect2::Freenect2Device *dev;
+    std::string device_serial;
+    libfreenect2::SyncMultiFrameListener *listener;
+    unsigned int streams;
+    bool color_only; // DumpPacketPipeline
+};
+
+// Packet pipeline that hands color packets on as the camera's JPEGs, the way
+// DumpPacketPipeline does, while depth packets go through `depth_pipeline`
+// (the CPU pipeline when null). Each stream's parser and processor come from
+// the pipeline that handles it; the other halves are never fed.
+class PassthroughColorPipeline : public libfreenect2::PacketPipeline
+{
+public:
+    // Takes ownership of `depth_pipeline`
+    explicit PassthroughColorPipeline(libfreenect2::PacketPipeline *depth_pipeline = nullptr);
+    ~PassthroughColorPipeline();
+
+    PacketParser *getRgbPacketParser() const;
+    PacketParser *getIrPacketParser() const;
+    libfreenect2::RgbPacketProcessor *getRgbPacketProcessor() const;
+    libfreenect2::DepthPacketProcessor *getDepthPacketProcessor() const;
+
+private:
+    PassthroughColorPipeline(const PassthroughColorPipeline &) = delete;
+    PassthroughColorPipeline &operator=(const PassthroughColorPipeline &) = delete;
+
+    libfreenect2::DumpPacketPipeline *color_pipeline;
+    libfreenect2::PacketPipeline *depth_pipeline;
+};
+
+// Serial numbers of every connected Kinect
+std::vector<std::string> connectedDeviceSerials();
+
+// Streams named on a command line, e.g. "depth" or "color+depth". "jpeg" is
+// color passed through as the camera's JPEGs (see PassthroughColorPipeline)
+// and "depth16" depth stored with the lossless depth codec.
+struct StreamSelection
+{
+    unsigned int frame_types; // libfreenect2::Frame::Type bits, 0 if none are named
+    bool compressed_color;
+    bool lossless_depth;
+};
+
+StreamSelection parseStreams(const std::string &names);
+
+// Records frame sets in the format ReplayFrameSource reads: a header with the
+// calibration, then per frame set a stream count, one RecordedFrameHeader per
+// stream and the raw libfreenect2 frame data in the same order. Streams of a
+// set are interleaved, so every set covers the same moment. A closed
+// recording ends with a zero stream count, a RecordedSetIndex entry per set
+// and a RecordingFooter; one cut short by a crash has none of those but
+// still plays up to the last complete set.
+struct RecordedFrameHeader
+{
+    uint32_t type;
+    uint32_t width, height, bytes_per_pixel;
+    uint32_t format;
+    uint32_t timestamp;
+    uint32_t sequence;
+};
+
+struct RecordedSetIndex
+{
+    uint64_t offset;    // of the set's stream count
+    uint32_t timestamp; // first stream's device timestamp
+    uint32_t sequence;
+    uint32_t streams;   // libfreenect2::Frame::Type bits
+    uint32_t reserved;
+};
+
+// RecordedFrameHeader::format of depth stored with the lossless depth codec
+// (kinect_depth_codec.h). Like compressed color, the header has width and
+// height 1 and bytes_per_pixel is the encoded size; ReplayFrameSource hands
+// it out decoded, as Float millimeters.
+const uint32_t RECORDED_FORMAT_LOSSLESS_DEPTH = 0x100;
+
+struct RecordingFooter
+{
+    uint64_t index_offset;
+    uint64_t set_count;
+    char magic[8];
+};
+
+// Frames are copied out of the lease and written on a background thread, so
+// the lease can go straight back to the device and disk stalls do not hold up
+// capture. Up to `max_queued` sets wait for the disk in buffers that are
+// reused once they have grown to frame size; write() blocks while the queue
+// is full, and the device then drops frames (see FrameSource::frame_stats).
+//
+// The file is written with DirectFileWriter, bypassing the page cache, so
+// writeback flushes do not stall the writer thread either; a crash loses the
+// last few MB, which replay treats as a recording cut short.
+//
+// With `lossless_depth`, depth is stored as 16-bit millimeters with the
+// lossless depth codec, encoded on the writer thread: a fifth of the size of
+// the float frames or less.
+class FrameSetWriter
+{
+public:
+    FrameSetWriter(const char *filename,
+                   const libfreenect2::Freenect2Device::IrCameraParams &ir_params,
+                   const libfreenect2::Freenect2Device::ColorCameraParams &color_params,
+                   bool lossless_depth = false, size_t max_queued = 16);
+    ~FrameSetWriter();
+
+    bool is_open() const { return file.is_open(); }
+
+    // Queue a copy of every frame the lease holds. Call from one thread.
+    void write(const FrameLease &lease);
+
+    // The same for frames held elsewhere; invalid views are left out
+    void write(const FrameView &color, const FrameView &depth, const FrameView &ir);
+
+    // Write everything queued, then the index. Returns false if any write failed.
+    bool close();
+
+    size_t sets_written();
+    size_t max_queue_depth(); // most sets that were ever waiting at once
+
+private:
+    FrameSetWriter(const FrameSetWriter &) = delete;
+    FrameSetWriter &operator=(const FrameSetWriter &) = delete;
+
+    struct QueuedSet
+    {
+        uint32_t count;
+        RecordedFrameHeader headers[3];
+        std::vector<unsigned char> data[3]; // keep their capacity from set to set
+    };
+
+    void worker();
+    void write_set(const QueuedSet &set);
+    void append(const void *data, size_t bytes);
+
+    DirectFileWriter file;
+    bool failed;
+    bool lossless_depth;
+    std::vector<unsigned char> encoded_depth; // used by the worker only
+    uint64_t offset;
+    std::vector<RecordedSetIndex> index;
+
+    // Ring of queued sets: `queued` of them starting at `head`. A slot is
+    // filled by write() before it is counted, and written by the worker
+    // before it is freed, so neither touches it under the mutex.
+    std::vector<QueuedSet> slots;
+    size_t head, queued;
+    size_t max_depth;
+    bool stopping;
+    std::mutex mutex;
+    std::condition_variable set_ready;
+    std::condition_variable slot_free;
+    std::thread thread;
+};
+
+// Plays back a FrameSetWriter recording. In real-time mode frame sets are
+// paced by their device timestamps and sets the consumer fell behind on are
+// skipped, like a live device would; otherwise they come out as fast as they
+// are read. Only one frame set can be leased at a time.
+class ReplayFrameSource : public FrameSource
+{
+public:
+    ReplayFrameSource(const char *filename, bool real_time = true, bool loop = false);
+    ~ReplayFrameSource();
+
+    bool is_open() const { return fd >= 0; }
+    bool wait_for_frames(libfreenect2::FrameMap &frames, int timeout_ms);
+    void release(libfreenect2::FrameMap &frames);
+    libfreenect2::Freenect2Device::IrCameraParams ir_params() { return ir; }
+    libfreenect2::Freenect2Device::ColorCameraParams color_params() { return color; }
+
+    // Streams that are not selected are skipped over instead of read
+    bool select_streams(unsigned int frame_types);
+    unsigned int selected_streams() const { return wanted_streams; }
+
+    // True once a non-looping recording has been played to the end
+    bool finished() const { return at_end; }
+
+    // Number of frame sets in the recording's index; -1 for a recording
+    // without one (cut short, or written before the index existed)
+    int set_count() const { return index.empty() ? -1 : (int)index.size(); }
+    const RecordedSetIndex &set_index(int set) const { return index[set]; }
+
+    // Continue playing from frame set `set`. Needs the index.
+    bool seek_set(int set);
+
+private:
+    ReplayFrameSource(const ReplayFrameSource &) = delete;
+    ReplayFrameSource &operator=(const ReplayFrameSource &) = delete;
+
+    // Read the headers of the next frame set with a selected stream,
+    // rewinding first when looping. False at the end of the recording.
+    bool next_set();
+    bool read_index();
+    bool read_set_headers();
+    bool set_has_wanted_stream() const;
+    bool read_set_data();
+    void skip_set_data();
+    void rewind();
+
+    int fd;
+    bool real_time;
+    bool loop;
+    bool at_end;
+    bool pending; // headers of the next set are read but not its data
+    long long first_frame_offset;
+
+    libfreenect2::Freenect2Device::IrCameraParams ir;
+    libfreenect2::Freenect2Device::ColorCameraParams color;
+    std::vector<RecordedSetIndex> index;
+
+    unsigned int wanted_streams;
+    uint32_t set_streams;
+    RecordedFrameHeader headers[3];
+    std::map<uint32_t, libfreenect2::Frame *> frames_by_type;
+    std::vector<unsigned char> encoded_depth;
+
+    // Wall clock time the first frame set was played at, for pacing
+    bool clock_started;
+    uint32_t first_timestamp;
+    std::chrono::steady_clock::time_point start_time;
+};
+
+#endif
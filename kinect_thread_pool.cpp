@@ -0,0 +1,121 @@
+#include "kinect_thread_pool.h"
+#include <algorithm>
+
+ThreadPool::ThreadPool(int num_threads) : num_threads(num_threads), stopping(false)
+{
+    if (this->num_threads <= 0)
+        this->num_threads = std::max(1, (int)std::thread::hardware_concurrency());
+
+    for (int i = 1; i < this->num_threads; i++)
+    {
+        workers.push_back(std::thread(&ThreadPool::worker, this));
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    task_ready.notify_all();
+
+    for (size_t i = 0; i < workers.size(); i++)
+    {
+        workers[i].join();
+    }
+}
+
+void ThreadPool::run_task(const Task &task)
+{
+    task.batch->jobs[task.job](task.batch->job_contexts[task.job], task.row_begin, task.row_end);
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (--task.batch->pending == 0)
+        task_done.notify_all();
+}
+
+void ThreadPool::worker()
+{
+    while (true)
+    {
+        Task task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            task_ready.wait(lock, [this]
+                            { return stopping || !tasks.empty(); });
+            if (stopping)
+                return;
+            task = tasks.back();
+            tasks.pop_back();
+        }
+        run_task(task);
+    }
+}
+
+RowBatch::RowBatch(ThreadPool &pool) : pool(pool), num_jobs(0), pending(0) {}
+
+void RowBatch::add(int rows, RowFunction fn, void *context)
+{
+    if (num_jobs == MAX_JOBS)
+    {
+        // Batch is full; flush what is queued so far
+        run();
+    }
+
+    jobs[num_jobs] = fn;
+    job_contexts[num_jobs] = context;
+    job_rows[num_jobs] = rows;
+    num_jobs++;
+}
+
+void RowBatch::run()
+{
+    if (pool.num_threads == 1)
+    {
+        for (int j = 0; j < num_jobs; j++)
+        {
+            jobs[j](job_contexts[j], 0, job_rows[j]);
+        }
+        num_jobs = 0;
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        for (int j = 0; j < num_jobs; j++)
+        {
+            // A couple of bands per thread evens out uneven rows
+            int bands = std::min(job_rows[j], pool.num_threads * 2);
+            for (int b = 0; b < bands; b++)
+            {
+                ThreadPool::Task task = {this, j, job_rows[j] * b / bands, job_rows[j] * (b + 1) / bands};
+                pool.tasks.push_back(task);
+                pending++;
+            }
+        }
+    }
+    pool.task_ready.notify_all();
+
+    // Help out on this thread until the queue is drained, then wait for stragglers
+    while (true)
+    {
+        ThreadPool::Task task;
+        {
+            std::unique_lock<std::mutex> lock(pool.mutex);
+            if (pending == 0)
+                break;
+            if (pool.tasks.empty())
+            {
+                pool.task_done.wait(lock, [this]
+                                    { return pending == 0; });
+                break;
+            }
+            task = pool.tasks.back();
+            pool.tasks.pop_back();
+        }
+        pool.run_task(task);
+    }
+
+    num_jobs = 0;
+}
@@ -0,0 +1,78 @@
+#ifndef KINECT_THREAD_POOL_H
+#define KINECT_THREAD_POOL_H
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class RowBatch;
+
+// A row-band job: converts rows [row_begin, row_end) of whatever `context`
+// points at. A plain function and pointer, so queueing one never allocates.
+typedef void (*RowFunction)(void *context, int row_begin, int row_end);
+
+// Persistent worker threads for splitting frame conversions into row bands.
+// The thread that runs a batch also works on it, so a pool of N threads
+// starts N - 1 background workers.
+class ThreadPool
+{
+public:
+    // 0 = one thread per hardware core
+    explicit ThreadPool(int num_threads = 0);
+    ~ThreadPool();
+
+    int thread_count() const { return num_threads; }
+
+private:
+    friend class RowBatch;
+
+    struct Task
+    {
+        RowBatch *batch;
+        int job;
+        int row_begin, row_end;
+    };
+
+    void worker();
+    void run_task(const Task &task);
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    int num_threads;
+    std::vector<std::thread> workers;
+    std::vector<Task> tasks;
+    std::mutex mutex;
+    std::condition_variable task_ready;
+    std::condition_variable task_done;
+    bool stopping;
+};
+
+// A set of row-band jobs that run together. Jobs added to the same batch
+// (e.g. the color and depth conversion of one FrameMap) run concurrently.
+class RowBatch
+{
+public:
+    explicit RowBatch(ThreadPool &pool);
+
+    // Queue fn(context, ...) over rows [0, rows), split into bands. Nothing
+    // runs until run(), and `context` must stay valid until then.
+    void add(int rows, RowFunction fn, void *context);
+
+    // Run all queued jobs and block until they are done
+    void run();
+
+private:
+    friend class ThreadPool;
+    static const int MAX_JOBS = 8;
+
+    ThreadPool &pool;
+    RowFunction jobs[MAX_JOBS];
+    void *job_contexts[MAX_JOBS];
+    int job_rows[MAX_JOBS];
+    int num_jobs;
+    int pending; // guarded by pool.mutex
+};
+
+#endif
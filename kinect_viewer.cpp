@@ -150,16 +150,15 @@ void setup_camera_view(const CameraState &cam)
 }
 
 void render_point_cloud(libfreenect2::Frame *depth, libfreenect2::Frame *rgb,
-                        libfreenect2::Registration *registration)
+                        RegistrationContext &registration)
 {
-    libfreenect2::Frame undistorted(512, 424, 4);
-    libfreenect2::Frame registered(512, 424, 4);
-    registration->apply(rgb, depth, &undistorted, &registered);
+    registration.apply(rgb, depth);
 
     glBegin(GL_POINTS);
 
-    float *depth_data = (float *)undistorted.data;
-    unsigned char *rgb_data = registered.data;
+    const DepthRayTable &rays = registration.rays();
+    const float *depth_data = registration.undistorted();
+    const unsigned char *rgb_data = registration.registered();
 
     for (int y = 0; y < 424; y += 1)
     {
@@ -171,7 +170,7 @@ void render_point_cloud(libfreenect2::Frame *depth, libfreenect2::Frame *rgb,
             if (d > 0 && d < 4500)
             {
                 float px, py, pz;
-                registration->getPointXYZ(&undistorted, y, x, px, py, pz);
+                rays.unproject(idx, d, px, py, pz);
 
                 float r = rgb_data[idx * 4 + 2] / 255.0f;
                 float g = rgb_data[idx * 4 + 1] / 255.0f;
@@ -6,6 +6,8 @@
 #include <libfreenect2/frame_listener_impl.h>
 #include <libfreenect2/registration.h>
 
+#include "kinect_registration.h"
+
 // Camera state
 struct CameraState
 {
@@ -35,6 +37,6 @@ void key_callback(GLFWwindow *window, int key, int scancode, int action, int mod
 // Rendering
 void setup_camera_view(const CameraState &cam);
 void render_point_cloud(libfreenect2::Frame *depth, libfreenect2::Frame *rgb,
-                        libfreenect2::Registration *registration);
+                        RegistrationContext &registration);
 
 #endif
\ No newline at end of file
@@ -7,6 +7,12 @@
 #include <Eigen/Dense>
 #include <Eigen/SVD>
 
+#include "kinect_icp.h"
+#include "kinect_ply.h"
+#include "kinect_profile.h"
+
+PROFILE_STAGE(icp_stage, "icp_iteration");
+
 struct Point
 {
     float x, y, z;
@@ -68,34 +74,17 @@ PointCloud loadPLY(const std::string &filename)
 
 void savePLY(const std::string &filename, const PointCloud &cloud)
 {
-    std::ofstream file(filename, std::ios::binary);
-
-    std::string header =
-        "ply\n"
-        "format binary_little_endian 1.0\n"
-        "element vertex " +
-        std::to_string(cloud.points.size()) + "\n"
-                                              "property float x\n"
-                                              "property float y\n"
-                                              "property float z\n"
-                                              "property uchar red\n"
-                                              "property uchar green\n"
-                                              "property uchar blue\n"
-                                              "end_header\n";
-
-    file.write(header.c_str(), header.size());
+    PLYWriter writer(filename.c_str(), cloud.points.size());
 
     for (const auto &p : cloud.points)
     {
-        file.write((char *)&p.x, sizeof(float));
-        file.write((char *)&p.y, sizeof(float));
-        file.write((char *)&p.z, sizeof(float));
-        file.write((char *)&p.r, 1);
-        file.write((char *)&p.g, 1);
-        file.write((char *)&p.b, 1);
+        writer.add(p.x, p.y, p.z, p.r, p.g, p.b);
     }
 
-    file.close();
+    if (!writer.close())
+    {
+        std::cout << "Failed to write " << filename << std::endl;
+    }
 }
 
 // Downsample point cloud
@@ -125,118 +114,35 @@ Eigen::Matrix4f fastICP(const PointCloud &source, const PointCloud &target, int
 
     for (int iter = 0; iter < max_iterations; iter++)
     {
-        std::vector<std::pair<int, int>> correspondences;
-        float total_error = 0;
-
-        // Find closest points with early termination
-        for (size_t i = 0; i < transformed.points.size(); i++)
+        ICPStep step;
         {
-            float min_dist = std::numeric_limits<float>::max();
-            int closest_idx = -1;
-
-            for (size_t j = 0; j < target_down.points.size(); j++)
-            {
-                float dx = transformed.points[i].x - target_down.points[j].x;
-                float dy = transformed.points[i].y - target_down.points[j].y;
-                float dz = transformed.points[i].z - target_down.points[j].z;
-                float dist = dx * dx + dy * dy + dz * dz;
-
-                if (dist < min_dist)
-                {
-                    min_dist = dist;
-                    closest_idx = j;
-                }
-
-                // Early exit if we found a really close match
-                if (dist < 0.001f)
-                    break;
-            }
-
-            if (closest_idx >= 0 && min_dist < 0.25f)
-            { // 50cm threshold
-                correspondences.push_back({i, closest_idx});
-                total_error += min_dist;
-            }
+            PROFILE_SCOPE(icp_stage);
+            step = icpStep(transformed.points, target_down.points);
         }
 
-        if (correspondences.empty() || correspondences.size() < 10)
+        if (step.correspondences < 10)
         {
             std::cout << "  Iteration " << iter << ": Too few correspondences, stopping" << std::endl;
             break;
         }
 
-        std::cout << "  Iteration " << iter << ": " << correspondences.size()
-                  << " correspondences, avg error: " << sqrt(total_error / correspondences.size()) << "m" << std::endl;
-
-        // Compute centroids
-        Eigen::Vector3f centroid_source(0, 0, 0);
-        Eigen::Vector3f centroid_target(0, 0, 0);
-
-        for (const auto &pair : correspondences)
-        {
-            centroid_source += Eigen::Vector3f(
-                transformed.points[pair.first].x,
-                transformed.points[pair.first].y,
-                transformed.points[pair.first].z);
-            centroid_target += Eigen::Vector3f(
-                target_down.points[pair.second].x,
-                target_down.points[pair.second].y,
-                target_down.points[pair.second].z);
-        }
-
-        centroid_source /= correspondences.size();
-        centroid_target /= correspondences.size();
-
-        // Compute cross-covariance matrix
-        Eigen::Matrix3f H = Eigen::Matrix3f::Zero();
-
-        for (const auto &pair : correspondences)
-        {
-            Eigen::Vector3f p_source(
-                transformed.points[pair.first].x - centroid_source.x(),
-                transformed.points[pair.first].y - centroid_source.y(),
-                transformed.points[pair.first].z - centroid_source.z());
-            Eigen::Vector3f p_target(
-                target_down.points[pair.second].x - centroid_target.x(),
-                target_down.points[pair.second].y - centroid_target.y(),
-                target_down.points[pair.second].z - centroid_target.z());
-
-            H += p_source * p_target.transpose();
-        }
-
-        // SVD to get rotation
-        Eigen::JacobiSVD<Eigen::Matrix3f> svd(H, Eigen::ComputeFullU | Eigen::ComputeFullV);
-        Eigen::Matrix3f R = svd.matrixV() * svd.matrixU().transpose();
-
-        // Handle reflection case
-        if (R.determinant() < 0)
-        {
-            Eigen::Matrix3f V = svd.matrixV();
-            V.col(2) *= -1;
-            R = V * svd.matrixU().transpose();
-        }
-
-        Eigen::Vector3f t = centroid_target - R * centroid_source;
-
-        // Build transformation matrix
-        Eigen::Matrix4f iter_transform = Eigen::Matrix4f::Identity();
-        iter_transform.block<3, 3>(0, 0) = R;
-        iter_transform.block<3, 1>(0, 3) = t;
+        std::cout << "  Iteration " << iter << ": " << step.correspondences
+                  << " correspondences, avg error: " << sqrt(step.total_error / step.correspondences) << "m" << std::endl;
 
         // Apply transformation
         for (auto &p : transformed.points)
         {
             Eigen::Vector4f point(p.x, p.y, p.z, 1.0f);
-            Eigen::Vector4f transformed_point = iter_transform * point;
+            Eigen::Vector4f transformed_point = step.transform * point;
             p.x = transformed_point.x();
             p.y = transformed_point.y();
             p.z = transformed_point.z();
         }
 
-        transformation = iter_transform * transformation;
+        transformation = step.transform * transformation;
 
         // Check convergence
-        if (sqrt(total_error / correspondences.size()) < 0.01f)
+        if (sqrt(step.total_error / step.correspondences) < 0.01f)
         {
             std::cout << "  Converged!" << std::endl;
             break;
@@ -303,5 +209,6 @@ int main()
     savePLY("scans/merged.ply", merged);
     std::cout << "Saved merged.ply with " << merged.points.size() << " points" << std::endl;
 
+    PROFILE_PRINT();
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,840 @@
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iterator>
+#include <algorithm>
+#include <thread>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "kinect_capture.h"
+#include "kinect_convert.h"
+#include "kinect_depth_codec.h"
+#include "kinect_direct_writer.h"
+#include "kinect_icp.h"
+#include "kinect_ply.h"
+#include "kinect_raw_video.h"
+#include "kinect_registration.h"
+
+// Synthetic frames match the Kinect v2 streams
+const int COLOR_WIDTH = 1920;
+const int COLOR_HEIGHT = 1080;
+const int COLOR_PIXELS = COLOR_WIDTH * COLOR_HEIGHT;
+const int DEPTH_PIXELS = DEPTH_WIDTH * DEPTH_HEIGHT;
+
+// Point count of a typical full-frame scan
+const int BENCH_POINTS = 200000;
+
+// Roughly a full scan downsampled by 10, as script_align_scans uses
+const int ICP_POINTS = 5000;
+
+// Four seconds of 30 fps color, about 750 MB per writer
+const int WRITE_FRAMES = 120;
+
+// Each kernel is repeated until it has run for at least this long
+const double BENCH_MIN_SECONDS = 0.25;
+
+struct BenchResult
+{
+    std::string name;
+    double seconds;    // per frame (or per call)
+    double bytes;      // input bytes per frame
+    double points;     // points per frame, 0 if not meaningful
+};
+
+static std::vector<BenchResult> results;
+
+static void report(const std::string &name, double seconds, double bytes, double points = 0)
+{
+    BenchResult result = {name, seconds, bytes, points};
+    results.push_back(result);
+
+    std::cout << "  " << name << ": " << seconds * 1e9 << " ns/frame, "
+              << bytes / (1024.0 * 1024.0) / seconds << " MB/s";
+    if (points > 0)
+        std::cout << ", " << points / seconds / 1e6 << " Mpoints/s";
+    std::cout << std::endl;
+}
+
+static bool writeJSON(const char *filename)
+{
+    std::ofstream file(filename);
+    if (!file.is_open())
+        return false;
+
+    file << std::fixed << std::setprecision(1);
+    file << "{\n  \"convert_kernel\": \"" << convertKernelName(activeConvertKernel()) << "\",\n";
+    file << "  \"benchmarks\": [\n";
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        const BenchResult &r = results[i];
+        file << "    {\"name\": \"" << r.name << "\", \"ns_per_frame\": " << r.seconds * 1e9
+             << ", \"mb_per_s\": " << r.bytes / (1024.0 * 1024.0) / r.seconds
+             << ", \"points_per_s\": " << (r.points > 0 ? r.points / r.seconds : 0) << "}"
+             << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    file << "  ]\n}\n";
+    return file.good();
+}
+
+// The original per-field ofstream writer, kept as the baseline
+static void savePLYPerField(const char *filename, const float *points, const unsigned char *colors, int num_points)
+{
+    std::ofstream file(filename, std::ios::binary);
+
+    std::string header =
+        "ply\n"
+        "format binary_little_endian 1.0\n"
+        "element vertex " +
+        std::to_string(num_points) + "\n"
+                                     "property float x\n"
+                                     "property float y\n"
+                                     "property float z\n"
+                                     "property uchar red\n"
+                                     "property uchar green\n"
+                                     "property uchar blue\n"
+                                     "end_header\n";
+
+    file.write(header.c_str(), header.size());
+
+    for (int i = 0; i < num_points; i++)
+    {
+        file.write((char *)&points[i * 3 + 0], sizeof(float));
+        file.write((char *)&points[i * 3 + 1], sizeof(float));
+        file.write((char *)&points[i * 3 + 2], sizeof(float));
+        file.write((char *)&colors[i * 3 + 0], 1);
+        file.write((char *)&colors[i * 3 + 1], 1);
+        file.write((char *)&colors[i * 3 + 2], 1);
+    }
+
+    file.close();
+}
+
+static bool sameContents(const char *a, const char *b)
+{
+    std::ifstream fa(a, std::ios::binary), fb(b, std::ios::binary);
+    std::string da((std::istreambuf_iterator<char>(fa)), std::istreambuf_iterator<char>());
+    std::string db((std::istreambuf_iterator<char>(fb)), std::istreambuf_iterator<char>());
+    return da == db;
+}
+
+// Seconds per call, after one warm-up call
+template <typename Fn>
+static double timeKernel(Fn fn)
+{
+    fn();
+
+    long long runs = 0;
+    long long batch = 1;
+    std::chrono::duration<double> elapsed(0);
+    auto start = std::chrono::steady_clock::now();
+    while (elapsed.count() < BENCH_MIN_SECONDS)
+    {
+        for (long long i = 0; i < batch; i++)
+        {
+            fn();
+        }
+        runs += batch;
+        batch *= 2;
+        elapsed = std::chrono::steady_clock::now() - start;
+    }
+    return elapsed.count() / runs;
+}
+
+// Depth in mm over a typical indoor range, with ~10% invalid (zero) pixels
+static std::vector<float> syntheticDepth()
+{
+    std::vector<float> depth(DEPTH_PIXELS);
+    for (int i = 0; i < DEPTH_PIXELS; i++)
+    {
+        depth[i] = rand() % 10 == 0 ? 0.0f : 400.0f + rand() % 4000;
+    }
+    return depth;
+}
+
+// Typical Kinect v2 calibration
+static libfreenect2::Freenect2Device::IrCameraParams typicalIrParams()
+{
+    libfreenect2::Freenect2Device::IrCameraParams params = {};
+    params.fx = 365.5f;
+    params.fy = 365.5f;
+    params.cx = 257.1f;
+    params.cy = 205.3f;
+    return params;
+}
+
+static libfreenect2::Freenect2Device::ColorCameraParams typicalColorParams()
+{
+    libfreenect2::Freenect2Device::ColorCameraParams params = {};
+    params.fx = 1081.37f;
+    params.fy = 1081.37f;
+    params.cx = 959.5f;
+    params.cy = 539.5f;
+    params.shift_d = 863.0f;
+    params.shift_m = 52.0f;
+    return params;
+}
+
+// Hands out the same synthetic BGRX color, depth and IR frames every time,
+// so the capture functions can be run without a Kinect or a recording
+class SyntheticFrameSource : public FrameSource
+{
+public:
+    SyntheticFrameSource()
+        : color(COLOR_WIDTH, COLOR_HEIGHT, 4), depth(DEPTH_WIDTH, DEPTH_HEIGHT, sizeof(float)),
+          ir(DEPTH_WIDTH, DEPTH_HEIGHT, sizeof(float)),
+          streams(libfreenect2::Frame::Color | libfreenect2::Frame::Depth | libfreenect2::Frame::Ir)
+    {
+        color.format = libfreenect2::Frame::BGRX;
+        depth.format = libfreenect2::Frame::Float;
+        ir.format = libfreenect2::Frame::Float;
+        for (int i = 0; i < COLOR_PIXELS * 4; i++)
+        {
+            color.data[i] = rand() % 256;
+        }
+        std::vector<float> depth_mm = syntheticDepth();
+        std::copy(depth_mm.begin(), depth_mm.end(), (float *)depth.data);
+        for (int i = 0; i < DEPTH_PIXELS; i++)
+        {
+            ((float *)ir.data)[i] = rand() % 65536;
+        }
+    }
+
+    bool is_open() const { return true; }
+
+    bool wait_for_frames(libfreenect2::FrameMap &frames, int)
+    {
+        frames.clear();
+        if (streams & libfreenect2::Frame::Color)
+            frames[libfreenect2::Frame::Color] = &color;
+        if (streams & libfreenect2::Frame::Depth)
+            frames[libfreenect2::Frame::Depth] = &depth;
+        if (streams & libfreenect2::Frame::Ir)
+            frames[libfreenect2::Frame::Ir] = &ir;
+        return true;
+    }
+
+    void release(libfreenect2::FrameMap &frames) { frames.clear(); }
+
+    libfreenect2::Freenect2Device::IrCameraParams ir_params() { return typicalIrParams(); }
+    libfreenect2::Freenect2Device::ColorCameraParams color_params() { return typicalColorParams(); }
+
+    bool select_streams(unsigned int frame_types)
+    {
+        streams = frame_types;
+        return true;
+    }
+    unsigned int selected_streams() const { return streams; }
+
+private:
+    libfreenect2::Frame color, depth, ir;
+    unsigned int streams;
+};
+
+// Checks run before any timing. Prints each one and returns false on a
+// mismatch.
+static bool check(const std::string &name, bool ok)
+{
+    std::cout << "  " << name << ": " << (ok ? "ok" : "MISMATCH") << std::endl;
+    return ok;
+}
+
+static std::vector<unsigned char> randomBytes(size_t bytes)
+{
+    std::vector<unsigned char> data(bytes);
+    for (size_t i = 0; i < bytes; i++)
+    {
+        data[i] = rand() % 256;
+    }
+    return data;
+}
+
+// Every SIMD kernel must match the scalar one bit for bit. Sizes are chosen
+// to leave tails for the scalar remainder loops, and outputs start filled
+// with a sentinel so a kernel that skips or overruns pixels shows up too.
+static int verifyConversions()
+{
+    int failures = 0;
+    const ConvertKernel kernels[2] = {CONVERT_SSSE3, CONVERT_AVX2};
+
+    std::cout << "Kernels against scalar" << std::endl;
+    const size_t pixel_counts[8] = {0, 1, 15, 16, 17, 33, 65, (size_t)COLOR_PIXELS + 7};
+    std::vector<unsigned char> bgrx = randomBytes(((size_t)COLOR_PIXELS + 7) * 4);
+    for (int k = 0; k < 2; k++)
+    {
+        if (kernels[k] > activeConvertKernel())
+            continue;
+
+        bool same = true;
+        for (int c = 0; c < 8; c++)
+        {
+            std::vector<unsigned char> expected(pixel_counts[c] * 3 + 16, 0xa5), got(expected);
+            convertBGRXToRGB(bgrx.data(), expected.data(), pixel_counts[c], CONVERT_SCALAR);
+            convertBGRXToRGB(bgrx.data(), got.data(), pixel_counts[c], kernels[k]);
+            same = same && got == expected;
+        }
+        failures += !check(std::string("bgrx_swizzle_") + convertKernelName(kernels[k]), same);
+    }
+
+    // Odd sizes leave partial boxes and an odd NV12 row and column
+    const int sizes[3][2] = {{COLOR_WIDTH, COLOR_HEIGHT}, {641, 479}, {37, 23}};
+    const ColorOutput formats[9] = {ColorOutput(1), ColorOutput(2), ColorOutput(4),
+                                    ColorOutput(1, COLOR_LAYOUT_PLANAR), ColorOutput(2, COLOR_LAYOUT_PLANAR),
+                                    ColorOutput(4, COLOR_LAYOUT_PLANAR), ColorOutput(1, COLOR_LAYOUT_NV12),
+                                    ColorOutput(2, COLOR_LAYOUT_NV12), ColorOutput(4, COLOR_LAYOUT_NV12)};
+    const char *format_names[9] = {"rgb", "half_rgb", "quarter_rgb", "planar", "half_planar", "quarter_planar",
+                                   "nv12", "half_nv12", "quarter_nv12"};
+    for (int f = 0; f < 9; f++)
+    {
+        bool same[2] = {true, true};
+        bool banded = true;
+        for (int s = 0; s < 3; s++)
+        {
+            int width = sizes[s][0], height = sizes[s][1];
+            int out_height = colorOutputHeight(height, formats[f]);
+            size_t out_bytes = colorOutputBytes(width, height, formats[f]);
+            std::vector<unsigned char> expected(out_bytes + 16, 0xa5);
+            convertBGRX(bgrx.data(), width, height, expected.data(), formats[f], 0, height, CONVERT_SCALAR);
+
+            // Split into two bands at an even row, as the capture thread pool does
+            std::vector<unsigned char> bands(expected.size(), 0xa5);
+            int split = out_height / 4 * 2;
+            convertBGRX(bgrx.data(), width, height, bands.data(), formats[f], 0, split, CONVERT_SCALAR);
+            convertBGRX(bgrx.data(), width, height, bands.data(), formats[f], split, height, CONVERT_SCALAR);
+            banded = banded && bands == expected;
+
+            for (int k = 0; k < 2; k++)
+            {
+                if (kernels[k] > activeConvertKernel())
+                    continue;
+                std::vector<unsigned char> got(expected.size(), 0xa5);
+                convertBGRX(bgrx.data(), width, height, got.data(), formats[f], 0, height, kernels[k]);
+                same[k] = same[k] && got == expected;
+            }
+        }
+
+        failures += !check(std::string("bgrx_") + format_names[f] + "_bands", banded);
+        for (int k = 0; k < 2; k++)
+        {
+            if (kernels[k] <= activeConvertKernel())
+                failures += !check(std::string("bgrx_") + format_names[f] + "_" + convertKernelName(kernels[k]),
+                                   same[k]);
+        }
+    }
+
+    // The scalar outputs against plain references: full-size planar is the
+    // RGB channels split up, and half-size RGB is each 2x2 box averaged with
+    // rounding
+    {
+        int width = 641, height = 479;
+        std::vector<unsigned char> rgb(colorOutputBytes(width, height, ColorOutput(1)));
+        std::vector<unsigned char> planar(colorOutputBytes(width, height, ColorOutput(1, COLOR_LAYOUT_PLANAR)));
+        convertBGRX(bgrx.data(), width, height, rgb.data(), ColorOutput(1), 0, height, CONVERT_SCALAR);
+        convertBGRX(bgrx.data(), width, height, planar.data(), ColorOutput(1, COLOR_LAYOUT_PLANAR), 0, height,
+                    CONVERT_SCALAR);
+        size_t plane = (size_t)width * height;
+        bool same = true;
+        for (size_t i = 0; i < plane; i++)
+        {
+            for (int c = 0; c < 3; c++)
+            {
+                same = same && planar[c * plane + i] == rgb[i * 3 + c];
+            }
+        }
+        failures += !check("bgrx_planar_reference", same);
+
+        int half_width = width / 2, half_height = height / 2;
+        std::vector<unsigned char> half(colorOutputBytes(width, height, ColorOutput(2)));
+        convertBGRX(bgrx.data(), width, height, half.data(), ColorOutput(2), 0, height, CONVERT_SCALAR);
+        same = true;
+        for (int y = 0; y < half_height; y++)
+        {
+            for (int x = 0; x < half_width; x++)
+            {
+                for (int c = 0; c < 3; c++)
+                {
+                    int channel = 2 - c; // BGRX -> RGB
+                    const unsigned char *p = &bgrx[((size_t)y * 2 * width + x * 2) * 4 + channel];
+                    int sum = p[0] + p[4] + p[width * 4] + p[width * 4 + 4];
+                    same = same && half[((size_t)y * half_width + x) * 3 + c] == (sum + 2) >> 2;
+                }
+            }
+        }
+        failures += !check("bgrx_half_rgb_reference", same);
+    }
+
+    // IR with negative, zero and above-max values, scaled by a range of maxima
+    std::vector<float> ir(DEPTH_PIXELS + 3);
+    for (size_t i = 0; i < ir.size(); i++)
+    {
+        ir[i] = (float)(rand() % 70000) - 1000.0f + (rand() % 100) / 100.0f;
+    }
+    const size_t ir_counts[7] = {0, 1, 7, 8, 17, 33, ir.size()};
+    const float maxima[4] = {0.0f, -1.0f, 1000.0f, 65535.0f};
+    for (int k = 0; k < 2; k++)
+    {
+        if (kernels[k] > activeConvertKernel())
+            continue;
+
+        bool same_max = true, same_scale = true;
+        for (int c = 0; c < 7; c++)
+        {
+            same_max = same_max && maxIR(ir.data(), ir_counts[c], kernels[k]) ==
+                                       maxIR(ir.data(), ir_counts[c], CONVERT_SCALAR);
+            for (int m = 0; m < 4; m++)
+            {
+                std::vector<unsigned char> expected(ir_counts[c] + 16, 0xa5), got(expected);
+                float expected_max = scaleIR(ir.data(), expected.data(), ir_counts[c], maxima[m], CONVERT_SCALAR);
+                float got_max = scaleIR(ir.data(), got.data(), ir_counts[c], maxima[m], kernels[k]);
+                same_scale = same_scale && got == expected && got_max == expected_max;
+            }
+        }
+        failures += !check(std::string("ir_max_") + convertKernelName(kernels[k]), same_max);
+        failures += !check(std::string("ir_scale_") + convertKernelName(kernels[k]), same_scale);
+    }
+
+    return failures;
+}
+
+// The ray table and unprojectDepth against libfreenect2's own
+// Registration::getPointXYZ. The table folds the mm -> m scale into the
+// rays, so points agree to float rounding rather than bit for bit.
+static int verifyRayTable()
+{
+    libfreenect2::Freenect2Device::IrCameraParams ir_params = typicalIrParams();
+    libfreenect2::Registration registration(ir_params, typicalColorParams());
+    DepthRayTable rays(ir_params);
+
+    std::vector<float> depth = syntheticDepth();
+    libfreenect2::Frame undistorted(DEPTH_WIDTH, DEPTH_HEIGHT, sizeof(float), (unsigned char *)depth.data());
+    std::vector<unsigned char> registered = randomBytes(DEPTH_PIXELS * 4);
+    std::vector<float> points(CLOUD_POINTS_FLOATS);
+    std::vector<unsigned char> colors(CLOUD_COLORS_BYTES);
+    int num_points = unprojectDepth(rays, depth.data(), registered.data(), DepthRange(0.0f, 1e9f), points.data(),
+                                    colors.data());
+
+    std::cout << "Ray table against Registration::getPointXYZ" << std::endl;
+    bool table_same = true, cloud_same = true;
+    float max_error = 0;
+    int n = 0;
+    for (int y = 0; y < DEPTH_HEIGHT; y++)
+    {
+        for (int x = 0; x < DEPTH_WIDTH; x++)
+        {
+            int idx = y * DEPTH_WIDTH + x;
+            float expected[3], got[3];
+            registration.getPointXYZ(&undistorted, y, x, expected[0], expected[1], expected[2]);
+            rays.unproject(idx, depth[idx], got[0], got[1], got[2]);
+            if (std::isnan(expected[2]))
+                continue; // invalid depth, which unprojectDepth leaves out too
+
+            for (int c = 0; c < 3; c++)
+            {
+                float error = std::fabs(got[c] - expected[c]);
+                max_error = std::max(max_error, error);
+                table_same = table_same && error <= 1e-6f * std::max(1.0f, std::fabs(expected[c]));
+            }
+
+            // unprojectDepth keeps the valid pixels in order, with BGRX -> RGB colors
+            cloud_same = cloud_same && n < num_points && points[n * 3 + 0] == got[0] &&
+                         points[n * 3 + 1] == got[1] && points[n * 3 + 2] == got[2] &&
+                         colors[n * 3 + 0] == registered[idx * 4 + 2] && colors[n * 3 + 1] == registered[idx * 4 + 1] &&
+                         colors[n * 3 + 2] == registered[idx * 4 + 0];
+            n++;
+        }
+    }
+    cloud_same = cloud_same && n == num_points;
+
+    int failures = !check("ray_table", table_same);
+    std::cout << "    (largest difference " << max_error * 1e6f << " um)" << std::endl;
+    failures += !check("unproject_depth", cloud_same);
+    return failures;
+}
+
+// The pooled capture functions must stop allocating once the pool holds a
+// frame's worth of buffers, whether the outputs are reused in place or
+// created fresh for every frame (their buffers go back to the pool).
+static int verifyPooledAllocations()
+{
+    std::cout << "Pooled capture allocations" << std::endl;
+
+    SyntheticFrameSource source;
+    RegistrationContext registration(source.ir_params(), source.color_params());
+    FrameBufferPool pool(32);
+    const int frames = 10;
+    bool captured = true;
+    size_t after_first = 0;
+    int failures = 0;
+    {
+        PooledFrameCapture capture;
+        PooledRGBFrame rgb;
+        PooledDepthFrame depth;
+        PooledIRFrame ir;
+        PooledPointCloud cloud;
+        for (int i = 0; i < frames; i++)
+        {
+            captured = getFrame(source, pool, capture) && getRGBFrame(source, pool, rgb) &&
+                       getDepthFrame(source, pool, depth) && getIRFrame(source, pool, ir) &&
+                       getPointCloud(source, registration, pool, cloud) && captured;
+            if (i == 0)
+                after_first = pool.allocation_count();
+        }
+        failures += !check("pooled_in_place", captured && pool.allocation_count() == after_first);
+    }
+
+    for (int i = 0; i < frames; i++)
+    {
+        PooledFrameCapture fresh_capture;
+        PooledPointCloud fresh_cloud;
+        captured = getFrame(source, pool, fresh_capture) &&
+                   getPointCloud(source, registration, pool, fresh_cloud) && captured;
+    }
+    failures += !check("pooled_fresh_outputs", captured && pool.allocation_count() == after_first);
+    std::cout << "    (" << after_first << " buffers allocated by the first frame, " << pool.allocation_count()
+              << " by the last)" << std::endl;
+    return failures;
+}
+
+static void benchConversions()
+{
+    std::vector<unsigned char> bgrx(COLOR_PIXELS * 4);
+    std::vector<unsigned char> rgb(COLOR_PIXELS * 3);
+    for (size_t i = 0; i < bgrx.size(); i++)
+    {
+        bgrx[i] = rand() % 256;
+    }
+
+    std::cout << "BGRX swizzle (" << COLOR_WIDTH << "x" << COLOR_HEIGHT << ")" << std::endl;
+    const ConvertKernel kernels[3] = {CONVERT_SCALAR, CONVERT_SSSE3, CONVERT_AVX2};
+    for (int k = 0; k < 3; k++)
+    {
+        // Forcing an unsupported kernel falls back to scalar; skip those
+        if (kernels[k] > activeConvertKernel())
+            continue;
+
+        double t = timeKernel([&]
+                              { convertBGRXToRGB(bgrx.data(), rgb.data(), COLOR_PIXELS, kernels[k]); });
+        report(std::string("bgrx_swizzle_") + convertKernelName(kernels[k]), t, bgrx.size());
+    }
+
+    // Fused downscale + swizzle, against the full-size swizzle above
+    std::vector<unsigned char> scaled(COLOR_PIXELS * 3);
+    const ColorOutput formats[5] = {ColorOutput(2), ColorOutput(4), ColorOutput(1, COLOR_LAYOUT_PLANAR),
+                                    ColorOutput(1, COLOR_LAYOUT_NV12), ColorOutput(2, COLOR_LAYOUT_NV12)};
+    const char *format_names[5] = {"bgrx_half_rgb", "bgrx_quarter_rgb", "bgrx_planar", "bgrx_nv12",
+                                   "bgrx_half_nv12"};
+    for (int f = 0; f < 5; f++)
+    {
+        double t = timeKernel([&]
+                              { convertBGRX(bgrx.data(), COLOR_WIDTH, COLOR_HEIGHT, scaled.data(), formats[f], 0,
+                                            COLOR_HEIGHT); });
+        report(format_names[f], t, bgrx.size());
+    }
+
+    std::vector<float> depth = syntheticDepth();
+    std::vector<float> ir(DEPTH_PIXELS);
+    std::vector<unsigned char> out(DEPTH_PIXELS);
+    for (int i = 0; i < DEPTH_PIXELS; i++)
+    {
+        ir[i] = rand() % 65536;
+    }
+
+    std::cout << "Depth/IR (" << DEPTH_WIDTH << "x" << DEPTH_HEIGHT << ")" << std::endl;
+    double t = timeKernel([&]
+                          { convertDepthToBytes(depth.data(), out.data(), DEPTH_PIXELS); });
+    report("depth_quantize", t, DEPTH_PIXELS * sizeof(float));
+
+    IRNormalizer two_pass;
+    t = timeKernel([&]
+                   { two_pass.normalize(ir.data(), out.data(), DEPTH_PIXELS); });
+    report("ir_normalize", t, DEPTH_PIXELS * sizeof(float));
+
+    IRNormalizer single_pass(true);
+    t = timeKernel([&]
+                   { single_pass.normalize(ir.data(), out.data(), DEPTH_PIXELS); });
+    report("ir_normalize_single_pass", t, DEPTH_PIXELS * sizeof(float));
+}
+
+// A scene rather than noise, so compression is meaningful: a sloped floor
+// and a wall with a few millimeters of sensor noise, a box in front, and
+// invalid (zero) pixels along the left edge and scattered through it
+static std::vector<float> syntheticDepthScene()
+{
+    std::vector<float> depth(DEPTH_PIXELS);
+    for (int y = 0; y < DEPTH_HEIGHT; y++)
+    {
+        for (int x = 0; x < DEPTH_WIDTH; x++)
+        {
+            float d = y > DEPTH_HEIGHT / 2 ? 3500.0f - (y - DEPTH_HEIGHT / 2) * 12.0f : 3500.0f;
+            if (x > 300 && x < 420 && y > 120 && y < 320)
+                d = 1800.0f + (x - 300) * 2.0f;
+            d += rand() % 5 - 2;
+            if (x < 8 || rand() % 100 == 0)
+                d = 0.0f;
+            depth[y * DEPTH_WIDTH + x] = d;
+        }
+    }
+    return depth;
+}
+
+static void benchDepthCodec()
+{
+    std::vector<float> depth = syntheticDepthScene();
+    std::vector<unsigned char> encoded(depthCodecMaxBytes(DEPTH_WIDTH, DEPTH_HEIGHT));
+    std::vector<float> decoded(DEPTH_PIXELS);
+    size_t bytes = 0;
+
+    std::cout << "Lossless depth codec (" << DEPTH_WIDTH << "x" << DEPTH_HEIGHT << ")" << std::endl;
+    double t = timeKernel([&]
+                          { bytes = encodeDepth(depth.data(), DEPTH_WIDTH, DEPTH_HEIGHT, encoded.data()); });
+    report("depth_encode", t, DEPTH_PIXELS * sizeof(float));
+    t = timeKernel([&]
+                   { decodeDepth(encoded.data(), bytes, decoded.data(), DEPTH_WIDTH, DEPTH_HEIGHT); });
+    report("depth_decode", t, DEPTH_PIXELS * sizeof(float));
+    std::cout << "  (" << bytes << " bytes, " << DEPTH_PIXELS * 2.0 / bytes << "x smaller than 16-bit)" << std::endl;
+
+    for (int i = 0; i < DEPTH_PIXELS; i++)
+    {
+        if (decoded[i] != depth[i])
+        {
+            std::cout << "  WARNING: decoded depth differs" << std::endl;
+            break;
+        }
+    }
+}
+
+static void benchPointCloud()
+{
+    DepthRayTable rays(typicalIrParams());
+
+    std::vector<float> depth = syntheticDepth();
+    std::vector<unsigned char> registered(DEPTH_PIXELS * 4);
+    for (size_t i = 0; i < registered.size(); i++)
+    {
+        registered[i] = rand() % 256;
+    }
+
+    std::vector<float> points(CLOUD_POINTS_FLOATS);
+    std::vector<unsigned char> colors(CLOUD_COLORS_BYTES);
+    int num_points = 0;
+
+    std::cout << "Point cloud extraction (" << DEPTH_WIDTH << "x" << DEPTH_HEIGHT << ")" << std::endl;
+    double t = timeKernel([&]
+                          { num_points = unprojectDepth(rays, depth.data(), registered.data(), DepthRange(),
+                                                        points.data(), colors.data()); });
+    report("point_cloud_extract", t, DEPTH_PIXELS * (sizeof(float) + 4), num_points);
+}
+
+// Whole-frame conversion and unprojection on the shared conversion pool at
+// 1, 2, 4 and one thread per core. Registration itself runs on the calling
+// thread, so unprojection scales less than conversion.
+static void benchThreadScaling()
+{
+    int cores = std::max(1, (int)std::thread::hardware_concurrency());
+    std::vector<int> thread_counts;
+    const int counts[4] = {1, 2, 4, cores};
+    for (int i = 0; i < 4; i++)
+    {
+        if (std::find(thread_counts.begin(), thread_counts.end(), counts[i]) == thread_counts.end())
+            thread_counts.push_back(counts[i]);
+    }
+
+    SyntheticFrameSource source;
+    RegistrationContext registration(source.ir_params(), source.color_params());
+    FrameBufferPool pool;
+    PooledFrameCapture capture;
+    PooledPointCloud cloud;
+    FrameLease lease;
+    lease.acquire(source);
+    double frame_bytes = COLOR_PIXELS * 4 + DEPTH_PIXELS * 2 * sizeof(float);
+
+    std::cout << "Conversion threads (" << cores << " cores)" << std::endl;
+    double convert_single = 0, unproject_single = 0;
+    for (size_t i = 0; i < thread_counts.size(); i++)
+    {
+        int n = thread_counts[i];
+        setConversionThreads(n);
+
+        double convert = timeKernel([&]
+                                    { convertLease(lease, pool, capture); });
+        report("convert_lease_" + std::to_string(n) + "t", convert, frame_bytes);
+        double unproject = timeKernel([&]
+                                      { unprojectLease(lease, registration, pool, cloud); });
+        report("unproject_lease_" + std::to_string(n) + "t", unproject, DEPTH_PIXELS * (sizeof(float) + 4),
+               cloud.cloud.num_points);
+
+        if (n == 1)
+        {
+            convert_single = convert;
+            unproject_single = unproject;
+        }
+        std::cout << "  (" << convert_single / convert << "x convert, " << unproject_single / unproject
+                  << "x unproject against 1 thread)" << std::endl;
+    }
+    setConversionThreads(0);
+}
+
+static void benchPLYWrite()
+{
+    std::vector<float> points(BENCH_POINTS * 3);
+    std::vector<unsigned char> colors(BENCH_POINTS * 3);
+    for (size_t i = 0; i < points.size(); i++)
+    {
+        points[i] = (rand() % 4000) / 1000.0f;
+        colors[i] = rand() % 256;
+    }
+
+    const char *baseline_file = "benchmark/ply_per_field.ply";
+    const char *bulk_file = "benchmark/ply_bulk.ply";
+    double bytes = BENCH_POINTS * (3 * sizeof(float) + 3);
+
+    std::cout << "PLY write (" << BENCH_POINTS << " points)" << std::endl;
+    double t = timeKernel([&]
+                          { savePLYPerField(baseline_file, points.data(), colors.data(), BENCH_POINTS); });
+    report("ply_write_per_field", t, bytes, BENCH_POINTS);
+    t = timeKernel([&]
+                   { writePointCloudPLY(bulk_file, points.data(), colors.data(), BENCH_POINTS); });
+    report("ply_write_bulk", t, bytes, BENCH_POINTS);
+
+    if (!sameContents(baseline_file, bulk_file))
+    {
+        std::cout << "  WARNING: outputs differ" << std::endl;
+    }
+}
+
+// Sustained raw video writing: 1080p RGB frames back to back, as
+// script_record_video exports them (about 187 MB/s at 30 fps). Reports the
+// throughput including close() and the slowest single frame, which is what
+// would hold up a capture loop.
+template <typename WriteFrame, typename Close>
+static void timeVideoWrite(const std::string &name, WriteFrame write_frame, Close close)
+{
+    double worst = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < WRITE_FRAMES; i++)
+    {
+        auto frame_start = std::chrono::steady_clock::now();
+        write_frame(i);
+        worst = std::max(worst, std::chrono::duration<double>(std::chrono::steady_clock::now() - frame_start).count());
+    }
+    close();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    report(name, seconds / WRITE_FRAMES, COLOR_PIXELS * 3);
+    std::cout << "  (slowest frame " << worst * 1000 << " ms)" << std::endl;
+}
+
+static void benchVideoWrite(const std::string &dir)
+{
+    std::vector<std::vector<unsigned char>> frames(4, std::vector<unsigned char>(COLOR_PIXELS * 3));
+    for (size_t f = 0; f < frames.size(); f++)
+        for (size_t i = 0; i < frames[f].size(); i++)
+            frames[f][i] = rand() % 256;
+    size_t frame_bytes = frames[0].size();
+    RawVideoHeader header = {COLOR_WIDTH, COLOR_HEIGHT, 3, WRITE_FRAMES};
+    std::string filename = dir + "/bench_video.raw";
+
+    std::cout << "Raw video write (" << WRITE_FRAMES << " frames of 1920x1080 RGB to " << dir << ")" << std::endl;
+    {
+        std::ofstream file(filename.c_str(), std::ios::binary);
+        file.write((const char *)&header, sizeof(header));
+        timeVideoWrite("video_write_ofstream", [&](int i)
+                       { file.write((const char *)frames[i % frames.size()].data(), frame_bytes); },
+                       [&]
+                       { file.close(); });
+    }
+
+    const char *names[2] = {"video_write_direct_io_uring", "video_write_direct_thread"};
+    for (int backend = 0; backend < 2; backend++)
+    {
+        DirectFileWriter file(filename.c_str(), sizeof(header) + (uint64_t)WRITE_FRAMES * frame_bytes,
+                              4 * 1024 * 1024, 8, backend == 0);
+        if (backend == 0 && file.backend() != DirectFileWriter::IoUringQueue)
+            continue;
+        file.write(&header, sizeof(header));
+        bool ok = true;
+        timeVideoWrite(names[backend], [&](int i)
+                       { ok = file.write(frames[i % frames.size()].data(), frame_bytes) && ok; },
+                       [&]
+                       { ok = file.close() && ok; });
+        std::cout << "  (" << (file.direct() ? "O_DIRECT" : "page cache") << ", waited for the disk "
+                  << file.stalls() << " times, " << file.stall_ms() << " ms)" << std::endl;
+        if (!ok)
+            std::cout << "  WARNING: write failed" << std::endl;
+    }
+    unlink(filename.c_str());
+}
+
+struct BenchPoint
+{
+    float x, y, z;
+};
+
+static void benchICP()
+{
+    // Target: points scattered through a room-sized volume. Source: the same
+    // points moved by a few centimeters, as between consecutive scans.
+    std::vector<BenchPoint> target(ICP_POINTS);
+    std::vector<BenchPoint> source(ICP_POINTS);
+    for (int i = 0; i < ICP_POINTS; i++)
+    {
+        target[i].x = (rand() % 4000) / 1000.0f - 2.0f;
+        target[i].y = (rand() % 3000) / 1000.0f - 1.5f;
+        target[i].z = 0.5f + (rand() % 3500) / 1000.0f;
+        source[i].x = target[i].x + 0.03f;
+        source[i].y = target[i].y - 0.01f;
+        source[i].z = target[i].z + 0.02f;
+    }
+
+    std::cout << "ICP iteration (" << ICP_POINTS << " x " << ICP_POINTS << " points)" << std::endl;
+    ICPStep step;
+    double t = timeKernel([&]
+                          { step = icpStep(source, target); });
+    report("icp_iteration", t, ICP_POINTS * sizeof(BenchPoint), ICP_POINTS);
+    std::cout << "  (" << step.correspondences << " correspondences)" << std::endl;
+}
+
+// Usage: script_benchmark [results.json] [write_dir]
+// where write_dir is where the video write benchmark puts its file, e.g. a
+// tmpfs or the disk recordings go to (default benchmark/)
+//
+// Every SIMD kernel is first checked against its scalar version, and pooled
+// capture for allocations after the first frame; nothing is timed if a
+// check fails.
+int main(int argc, char *argv[])
+{
+    mkdir("benchmark", 0755);
+    srand(1);
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << "Convert kernel: " << convertKernelName(activeConvertKernel()) << std::endl;
+
+    // A benchmark of a wrong kernel means nothing
+    if (verifyConversions() + verifyRayTable() + verifyPooledAllocations() > 0)
+    {
+        std::cout << "Verification failed" << std::endl;
+        return -1;
+    }
+
+    benchConversions();
+    benchDepthCodec();
+    benchPointCloud();
+    benchThreadScaling();
+    benchPLYWrite();
+    benchVideoWrite(argc > 2 ? argv[2] : "benchmark");
+    benchICP();
+
+    const char *json_file = argc > 1 ? argv[1] : "benchmark/results.json";
+    if (!writeJSON(json_file))
+    {
+        std::cout << "Failed to write " << json_file << std::endl;
+        return -1;
+    }
+    std::cout << "Results written to " << json_file << std::endl;
+
+    return 0;
+}
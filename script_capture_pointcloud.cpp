@@ -1,4 +1,5 @@
 #include <iostream>
+#include <memory>
 #include <sys/stat.h>
 #include <chrono>
 #include <thread>
@@ -8,47 +9,28 @@
 #include <libfreenect2/registration.h>
 
 #include "kinect_capture.h"
+#include "kinect_profile.h"
+#include "kinect_source.h"
+#include "kinect_scan_writer.h"
 
-int main()
+int main(int argc, char *argv[])
 {
     mkdir("scans", 0755);
 
-    libfreenect2::Freenect2 freenect2;
-    libfreenect2::Freenect2Device *dev = nullptr;
+    // Replay a recording when one is given, otherwise use the Kinect
+    std::unique_ptr<FrameSource> source;
+    if (argc > 1)
+        source.reset(new ReplayFrameSource(argv[1]));
+    else
+        source.reset(new LiveFrameSource(libfreenect2::Frame::Color | libfreenect2::Frame::Depth));
 
-    if (freenect2.enumerateDevices() == 0)
-    {
-        std::cout << "No Kinect detected" << std::endl;
-        return -1;
-    }
-
-    std::string serial = freenect2.getDefaultDeviceSerialNumber();
-    std::cout << "Opening device: " << serial << std::endl;
-
-    libfreenect2::PacketPipeline *pipeline = new libfreenect2::CpuPacketPipeline();
-    dev = freenect2.openDevice(serial, pipeline);
-
-    if (!dev)
-    {
-        std::cout << "Failed to open device" << std::endl;
-        return -1;
-    }
-
-    libfreenect2::SyncMultiFrameListener listener(
-        libfreenect2::Frame::Color | libfreenect2::Frame::Depth);
-    dev->setColorFrameListener(&listener);
-    dev->setIrAndDepthFrameListener(&listener);
-
-    if (!dev->start())
-    {
-        std::cout << "Failed to start device" << std::endl;
+    if (!source->is_open())
         return -1;
-    }
 
     // Get camera parameters and create registration
-    libfreenect2::Freenect2Device::IrCameraParams ir_params = dev->getIrCameraParams();
-    libfreenect2::Freenect2Device::ColorCameraParams color_params = dev->getColorCameraParams();
-    libfreenect2::Registration *registration = new libfreenect2::Registration(ir_params, color_params);
+    libfreenect2::Freenect2Device::IrCameraParams ir_params = source->ir_params();
+    libfreenect2::Freenect2Device::ColorCameraParams color_params = source->color_params();
+    RegistrationContext registration(ir_params, color_params);
 
     int num_scans = 8;
     int delay_seconds = 5;
@@ -56,6 +38,12 @@ int main()
     std::cout << "Will capture " << num_scans << " scans with " << delay_seconds << " seconds between each." << std::endl;
     std::cout << "Position yourself for the first scan..." << std::endl;
 
+    FrameBufferPool pool;
+    PooledPointCloud cloud;
+
+    // Scans are written in the background so the next countdown starts right away
+    AsyncScanWriter writer;
+
     for (int i = 0; i < num_scans; i++)
     {
         std::cout << "\nCapture " << (i + 1) << "/" << num_scans << " in:" << std::endl;
@@ -67,13 +55,10 @@ int main()
         }
         std::cout << "CAPTURING!" << std::endl;
 
-        PointCloudData cloud = getPointCloud(dev, listener, registration);
-
-        if (cloud.num_points > 0)
+        if (getPointCloud(*source, registration, pool, cloud) && cloud.cloud.num_points > 0)
         {
             std::string filename = "scans/scan_" + std::to_string(i) + ".ply";
-            savePointCloudPLY(filename.c_str(), cloud);
-            freePointCloud(cloud);
+            writer.write(filename, std::move(cloud));
         }
         else
         {
@@ -86,16 +71,19 @@ int main()
         }
     }
 
+    if (writer.pending() > 0)
+    {
+        std::cout << "\nWaiting for " << writer.pending() << " scan(s) to finish writing..." << std::endl;
+    }
+    writer.flush();
+
     std::cout << "\nDone! Captured " << num_scans << " scans." << std::endl;
     std::cout << "Use CloudCompare or MeshLab to align and merge the point clouds:" << std::endl;
     std::cout << "  1. Import all scan_*.ply files" << std::endl;
     std::cout << "  2. Use ICP (Iterative Closest Point) alignment" << std::endl;
     std::cout << "  3. Merge into single mesh" << std::endl;
 
-    delete registration;
-    dev->stop();
-    dev->close();
-    delete dev;
-
+    source->frame_stats().print(std::cout);
+    PROFILE_PRINT();
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,86 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <chrono>
+#include <algorithm>
+#include <sys/stat.h>
+
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+#include "kinect_raw_video.h"
+
+// Saves frames of a .raw video from script_record_video as PNGs, jumping
+// straight to them rather than reading the video up to that point.
+//
+// Usage: script_extract_frames <video.raw> [first] [count] [step]
+// e.g. "videos/depth_video.raw 1000 10 30" saves one frame per second from
+// frame 1000 on. 16-bit depth (depth16_video.raw) is scaled to 0-4.5 m.
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        std::cout << "Usage: " << argv[0] << " <video.raw> [first] [count] [step]" << std::endl;
+        return -1;
+    }
+
+    RawVideoReader video(argv[1]);
+    if (!video.is_open())
+        return -1;
+
+    int first = argc > 2 ? atoi(argv[2]) : 0;
+    int count = argc > 3 ? atoi(argv[3]) : 10;
+    int step = argc > 4 ? std::max(atoi(argv[4]), 1) : 1;
+    std::cout << video.width() << "x" << video.height() << ", " << video.channels() << " bytes per pixel, "
+              << video.frame_count() << " frames" << std::endl;
+
+    // Consecutive frames stream in with readahead; when skipping, readahead
+    // would only read frames that are never looked at, so each frame is
+    // prefetched while the one before it is being saved
+    if (step == 1)
+        video.advise(RawVideoReader::Sequential, 4);
+    else
+        video.advise(RawVideoReader::Random);
+
+    mkdir("frames", 0755);
+    std::string name = argv[1];
+    name = name.substr(name.find_last_of('/') + 1);
+    name = name.substr(0, name.find_last_of('.'));
+
+    std::vector<unsigned char> depth8;
+    int saved = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = first; saved < count; i += step)
+    {
+        const unsigned char *frame = video.frame(i);
+        if (!frame)
+            break;
+        if (step > 1)
+            video.prefetch(i + step, 1);
+
+        std::string filename = "frames/" + name + "_" + std::to_string(i) + ".png";
+        int pixels = video.width() * video.height();
+        if (video.channels() == 2)
+        {
+            // Little-endian millimeters
+            depth8.resize(pixels);
+            for (int p = 0; p < pixels; p++)
+            {
+                int mm = frame[2 * p] | frame[2 * p + 1] << 8;
+                depth8[p] = (unsigned char)(std::min(mm, 4500) * 255 / 4500);
+            }
+            stbi_write_png(filename.c_str(), video.width(), video.height(), 1, depth8.data(), video.width());
+        }
+        else
+        {
+            stbi_write_png(filename.c_str(), video.width(), video.height(), video.channels(), frame,
+                           video.width() * video.channels());
+        }
+        saved++;
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cout << "Saved " << saved << " frames to frames/ in " << seconds << " s" << std::endl;
+    return 0;
+}
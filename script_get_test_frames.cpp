@@ -1,82 +1,75 @@
+#include <algorithm>
 #include <iostream>
+#include <memory>
+#include <string>
+#include <cstdlib>
 #include <sys/stat.h>
 #include <libfreenect2/libfreenect2.hpp>
 #include <libfreenect2/frame_listener_impl.h>
 #include <libfreenect2/packet_pipeline.h>
 
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-#include "stb_image_write.h"
-
-#include "kinect_capture.h"
-
-int main()
+#include "kinect_png_export.h"
+#include "kinect_profile.h"
+#include "kinect_source.h"
+
+// Saves frame sets as PNGs in testframes/. Frames are encoded on a pool of
+// threads while capture carries on, so a long dump keeps the device rate as
+// long as the encoders keep up; the export stats at the end show whether
+// they did.
+//
+// Usage: script_get_test_frames [recording|live] [num_frames] [compression_level] [threads] [queued_sets]
+// Compression levels are stb's (5 fastest to 9 and up, default 8). Each
+// queued set takes about 6.6 MB.
+int main(int argc, char *argv[])
 {
     mkdir("testframes", 0755);
 
-    libfreenect2::Freenect2 freenect2;
-    libfreenect2::Freenect2Device *dev = nullptr;
+    const unsigned int streams = libfreenect2::Frame::Color | libfreenect2::Frame::Depth | libfreenect2::Frame::Ir;
 
-    if (freenect2.enumerateDevices() == 0)
-    {
-        std::cout << "No Kinect detected" << std::endl;
-        return -1;
-    }
+    // Replay a recording when one is given, otherwise use the Kinect
+    std::unique_ptr<FrameSource> source;
+    if (argc > 1 && std::string(argv[1]) != "live")
+        source.reset(new ReplayFrameSource(argv[1]));
+    else
+        source.reset(new LiveFrameSource(streams));
 
-    std::string serial = freenect2.getDefaultDeviceSerialNumber();
-    std::cout << "Opening device: " << serial << std::endl;
-
-    libfreenect2::PacketPipeline *pipeline = new libfreenect2::CpuPacketPipeline();
-    dev = freenect2.openDevice(serial, pipeline);
-
-    if (!dev)
-    {
-        std::cout << "Failed to open device" << std::endl;
+    if (!source->is_open() || !source->select_streams(streams))
         return -1;
-    }
 
-    libfreenect2::SyncMultiFrameListener listener(
-        libfreenect2::Frame::Color | libfreenect2::Frame::Depth | libfreenect2::Frame::Ir);
-    dev->setColorFrameListener(&listener);
-    dev->setIrAndDepthFrameListener(&listener);
+    int num_frames = argc > 2 ? atoi(argv[2]) : 10;
+    int compression_level = argc > 3 ? atoi(argv[3]) : 8;
+    int num_threads = argc > 4 ? atoi(argv[4]) : 0;
+    int max_queued = argc > 5 ? atoi(argv[5]) : 30;
 
-    if (!dev->start())
-    {
-        std::cout << "Failed to start device" << std::endl;
+    PngExporter exporter("testframes", streams, num_threads, compression_level, std::min(num_frames, max_queued));
+    if (!exporter.is_ready())
         return -1;
-    }
 
-    std::cout << "Capturing frames..." << std::endl;
-
-    for (int i = 0; i < 10; i++)
+    std::cout << "Capturing " << num_frames << " frames on " << exporter.thread_count() << " encoder threads..."
+              << std::endl;
+    FrameLease lease;
+    int captured = 0;
+    while (captured < num_frames)
     {
-        FrameCapture capture = getFrame(dev, listener);
-
-        if (capture.rgb_data == nullptr)
+        if (!lease.acquire(*source))
         {
-            std::cout << "Failed to capture frame " << i << std::endl;
-            continue;
+            if (!source->finished())
+                std::cout << "Timeout waiting for frames!" << std::endl;
+            break;
         }
-
-        // Save frames
-        std::string rgb_filename = "testframes/rgb_" + std::to_string(i) + ".png";
-        std::string depth_filename = "testframes/depth_" + std::to_string(i) + ".png";
-        std::string ir_filename = "testframes/ir_" + std::to_string(i) + ".png";
-
-        stbi_write_png(rgb_filename.c_str(), capture.rgb_width, capture.rgb_height, 3,
-                       capture.rgb_data, capture.rgb_width * 3);
-        stbi_write_png(depth_filename.c_str(), capture.depth_width, capture.depth_height, 1,
-                       capture.depth_data, capture.depth_width);
-        stbi_write_png(ir_filename.c_str(), capture.ir_width, capture.ir_height, 1,
-                       capture.ir_data, capture.ir_width);
-
-        std::cout << "Saved frame " << i << std::endl;
-
-        freeFrameCapture(capture);
+        if (exporter.add(lease, captured))
+            captured++;
+        lease.release();
     }
+    if (captured < num_frames)
+        std::cout << "Captured " << captured << " of " << num_frames << " frames" << std::endl;
 
-    dev->stop();
-    dev->close();
-    delete dev;
+    std::cout << "Saving frames..." << std::endl;
+    if (exporter.finish())
+        std::cout << "Saved " << captured << " frames" << std::endl;
 
+    exporter.print_stats(std::cout);
+    source->frame_stats().print(std::cout);
+    PROFILE_PRINT();
     return 0;
-}
\ No newline at end of file
+}
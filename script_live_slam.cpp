@@ -1,4 +1,5 @@
 #include <iostream>
+#include <memory>
 #include <vector>
 #include <unordered_map>
 #include <GLFW/glfw3.h>
@@ -11,8 +12,16 @@
 #include <atomic>
 #include <mutex>
 
+#include "kinect_jpeg.h"
+#include "kinect_profile.h"
+#include "kinect_source.h"
 #include "kinect_viewer.h"
 
+PROFILE_STAGE(extract_stage, "extract");
+PROFILE_STAGE(align_stage, "align");
+PROFILE_STAGE(voxel_stage, "voxel_insert");
+PROFILE_STAGE(render_stage, "render");
+
 struct Point3D
 {
     float x, y, z;
@@ -95,16 +104,16 @@ public:
 };
 
 PointCloud extract_point_cloud(libfreenect2::Frame *depth, libfreenect2::Frame *rgb,
-                               libfreenect2::Registration *registration, int skip = 6)
+                               RegistrationContext &registration, int skip = 6)
 {
+    PROFILE_SCOPE(extract_stage);
     PointCloud cloud;
 
-    libfreenect2::Frame undistorted(512, 424, 4);
-    libfreenect2::Frame registered(512, 424, 4);
-    registration->apply(rgb, depth, &undistorted, &registered);
+    registration.apply(rgb, depth);
 
-    float *depth_data = (float *)undistorted.data;
-    unsigned char *rgb_data = registered.data;
+    const DepthRayTable &rays = registration.rays();
+    const float *depth_data = registration.undistorted();
+    const unsigned char *rgb_data = registration.registered();
 
     for (int y = 0; y < 424; y += skip)
     {
@@ -116,7 +125,7 @@ PointCloud extract_point_cloud(libfreenect2::Frame *depth, libfreenect2::Frame *
             if (d > 500 && d < 4000)
             {
                 float px, py, pz;
-                registration->getPointXYZ(&undistorted, y, x, px, py, pz);
+                rays.unproject(idx, d, px, py, pz);
 
                 Point3D p;
                 p.x = px;
@@ -136,6 +145,7 @@ PointCloud extract_point_cloud(libfreenect2::Frame *depth, libfreenect2::Frame *
 
 Eigen::Vector3f align_fast(const PointCloud &source, const PointCloud &target)
 {
+    PROFILE_SCOPE(align_stage);
     if (source.points.empty() || target.points.empty())
     {
         return Eigen::Vector3f(0, 0, 0);
@@ -172,41 +182,48 @@ void render_map(const PointCloud &map)
 
 // Background thread for SLAM processing
 void slam_thread(std::atomic<bool> &running, VoxelGrid &voxel_map,
-                 libfreenect2::Freenect2Device *dev,
-                 libfreenect2::Registration *registration)
+                 FrameSource *source,
+                 RegistrationContext *registration)
 {
-
-    libfreenect2::SyncMultiFrameListener listener(
-        libfreenect2::Frame::Color | libfreenect2::Frame::Depth);
-    dev->setColorFrameListener(&listener);
-    dev->setIrAndDepthFrameListener(&listener);
-
     PointCloud previous_cloud;
     Eigen::Vector3f cumulative_offset(0, 0, 0);
     bool has_previous = false;
     int frame_skip_counter = 0;
+    JpegDecoder jpeg_decoder; // for recordings with compressed color
 
     while (running)
     {
-        libfreenect2::FrameMap frames;
-        if (!listener.waitForNewFrame(frames, 1000))
+        FrameLease lease;
+        if (!lease.acquire(*source, 1000))
         {
+            // A replay that has run out has nothing more to give
+            if (source->finished())
+            {
+                std::cout << "Recording finished" << std::endl;
+                return;
+            }
             continue;
         }
 
-        libfreenect2::Frame *rgb = frames[libfreenect2::Frame::Color];
-        libfreenect2::Frame *depth = frames[libfreenect2::Frame::Depth];
+        libfreenect2::Frame *color = jpeg_decoder.color_frame(lease);
+        libfreenect2::Frame *depth = lease.frame(libfreenect2::Frame::Depth);
+        if (!color || !depth)
+            continue;
 
-        PointCloud current_cloud = extract_point_cloud(depth, rgb, registration, 8);
+        PointCloud current_cloud = extract_point_cloud(depth, color, *registration, 8);
+        lease.release();
 
         frame_skip_counter++;
         if (frame_skip_counter % 10 == 0)
         { // Process every 10th frame
             if (!has_previous)
             {
-                for (const auto &p : current_cloud.points)
                 {
-                    voxel_map.add_point(p);
+                    PROFILE_SCOPE(voxel_stage);
+                    for (const auto &p : current_cloud.points)
+                    {
+                        voxel_map.add_point(p);
+                    }
                 }
                 previous_cloud = current_cloud;
                 has_previous = true;
@@ -220,12 +237,15 @@ void slam_thread(std::atomic<bool> &running, VoxelGrid &voxel_map,
                 { // Reasonable movement
                     cumulative_offset += offset;
 
-                    for (auto p : current_cloud.points)
                     {
-                        p.x += cumulative_offset.x();
-                        p.y += cumulative_offset.y();
-                        p.z += cumulative_offset.z();
-                        voxel_map.add_point(p);
+                        PROFILE_SCOPE(voxel_stage);
+                        for (auto p : current_cloud.points)
+                        {
+                            p.x += cumulative_offset.x();
+                            p.y += cumulative_offset.y();
+                            p.z += cumulative_offset.z();
+                            voxel_map.add_point(p);
+                        }
                     }
 
                     previous_cloud = current_cloud;
@@ -233,12 +253,10 @@ void slam_thread(std::atomic<bool> &running, VoxelGrid &voxel_map,
                 }
             }
         }
-
-        listener.release(frames);
     }
 }
 
-int main()
+int main(int argc, char *argv[])
 {
     if (!glfwInit())
     {
@@ -271,34 +289,20 @@ int main()
     glPointSize(2.0f);
     glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
 
-    libfreenect2::Freenect2 freenect2;
-    libfreenect2::Freenect2Device *dev = nullptr;
-
-    if (freenect2.enumerateDevices() == 0)
-    {
-        std::cout << "No Kinect detected" << std::endl;
-        return -1;
-    }
-
-    std::string serial = freenect2.getDefaultDeviceSerialNumber();
-    libfreenect2::PacketPipeline *pipeline = new libfreenect2::OpenGLPacketPipeline();
-    dev = freenect2.openDevice(serial, pipeline);
-
-    if (!dev)
-    {
-        std::cout << "Failed to open device" << std::endl;
-        return -1;
-    }
+    // Replay a recording when one is given, otherwise use the Kinect
+    std::unique_ptr<FrameSource> source;
+    if (argc > 1)
+        source.reset(new ReplayFrameSource(argv[1]));
+    else
+        source.reset(new LiveFrameSource(libfreenect2::Frame::Color | libfreenect2::Frame::Depth,
+                                         new libfreenect2::OpenGLPacketPipeline()));
 
-    if (!dev->start())
-    {
-        std::cout << "Failed to start device" << std::endl;
+    if (!source->is_open())
         return -1;
-    }
 
-    libfreenect2::Freenect2Device::IrCameraParams ir_params = dev->getIrCameraParams();
-    libfreenect2::Freenect2Device::ColorCameraParams color_params = dev->getColorCameraParams();
-    libfreenect2::Registration *registration = new libfreenect2::Registration(ir_params, color_params);
+    libfreenect2::Freenect2Device::IrCameraParams ir_params = source->ir_params();
+    libfreenect2::Freenect2Device::ColorCameraParams color_params = source->color_params();
+    RegistrationContext registration(ir_params, color_params);
 
     std::cout << "Kinect SLAM - Background Processing" << std::endl;
     std::cout << "Move slowly. Map builds automatically." << std::endl;
@@ -307,7 +311,7 @@ int main()
     VoxelGrid voxel_map(0.03f);
     std::atomic<bool> slam_running(true);
 
-    std::thread slam_worker(slam_thread, std::ref(slam_running), std::ref(voxel_map), dev, registration);
+    std::thread slam_worker(slam_thread, std::ref(slam_running), std::ref(voxel_map), source.get(), &registration);
 
     while (!glfwWindowShouldClose(window))
     {
@@ -317,11 +321,15 @@ int main()
             std::cout << "Map cleared" << std::endl;
         }
 
-        PointCloud display_cloud = voxel_map.to_point_cloud();
+        {
+            PROFILE_SCOPE(render_stage);
+            PointCloud display_cloud = voxel_map.to_point_cloud();
 
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        setup_camera_view(camera);
-        render_map(display_cloud);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            setup_camera_view(camera);
+            render_map(display_cloud);
+        }
+        PROFILE_REPORT(5.0);
 
         glfwSwapBuffers(window);
         glfwPollEvents();
@@ -331,11 +339,11 @@ int main()
     slam_worker.join();
 
     std::cout << "Final: " << voxel_map.size() << " voxels" << std::endl;
+    source->frame_stats().print(std::cout);
+    PROFILE_PRINT();
 
-    delete registration;
-    dev->stop();
-    dev->close();
-    delete dev;
+    // Stop the device while its GL pipeline can still clean up
+    source.reset();
     glfwTerminate();
     return 0;
 }
\ No newline at end of file
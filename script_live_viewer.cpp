@@ -1,13 +1,19 @@
 #include <iostream>
+#include <memory>
 #include <GLFW/glfw3.h>
 #include <libfreenect2/libfreenect2.hpp>
 #include <libfreenect2/frame_listener_impl.h>
 #include <libfreenect2/packet_pipeline.h>
 #include <libfreenect2/registration.h>
 
+#include "kinect_jpeg.h"
+#include "kinect_profile.h"
+#include "kinect_source.h"
 #include "kinect_viewer.h"
 
-int main()
+PROFILE_STAGE(render_stage, "render");
+
+int main(int argc, char *argv[])
 {
     // Initialize GLFW
     if (!glfwInit())
@@ -42,41 +48,21 @@ int main()
     glPointSize(2.0f);
     glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
 
-    // Initialize Kinect
-    libfreenect2::Freenect2 freenect2;
-    libfreenect2::Freenect2Device *dev = nullptr;
-
-    if (freenect2.enumerateDevices() == 0)
-    {
-        std::cout << "No Kinect detected" << std::endl;
-        return -1;
-    }
-
-    std::string serial = freenect2.getDefaultDeviceSerialNumber();
-
-    libfreenect2::PacketPipeline *pipeline = new libfreenect2::OpenGLPacketPipeline();
-    dev = freenect2.openDevice(serial, pipeline);
+    // Replay a recording (looped) when one is given, otherwise use the Kinect
+    std::unique_ptr<FrameSource> source;
+    if (argc > 1)
+        source.reset(new ReplayFrameSource(argv[1], true, true));
+    else
+        source.reset(new LiveFrameSource(libfreenect2::Frame::Color | libfreenect2::Frame::Depth,
+                                         new libfreenect2::OpenGLPacketPipeline()));
 
-    if (!dev)
-    {
-        std::cout << "Failed to open device" << std::endl;
+    if (!source->is_open())
         return -1;
-    }
 
-    libfreenect2::SyncMultiFrameListener listener(
-        libfreenect2::Frame::Color | libfreenect2::Frame::Depth);
-    dev->setColorFrameListener(&listener);
-    dev->setIrAndDepthFrameListener(&listener);
-
-    if (!dev->start())
-    {
-        std::cout << "Failed to start device" << std::endl;
-        return -1;
-    }
-
-    libfreenect2::Freenect2Device::IrCameraParams ir_params = dev->getIrCameraParams();
-    libfreenect2::Freenect2Device::ColorCameraParams color_params = dev->getColorCameraParams();
-    libfreenect2::Registration *registration = new libfreenect2::Registration(ir_params, color_params);
+    libfreenect2::Freenect2Device::IrCameraParams ir_params = source->ir_params();
+    libfreenect2::Freenect2Device::ColorCameraParams color_params = source->color_params();
+    RegistrationContext registration(ir_params, color_params);
+    JpegDecoder jpeg_decoder; // for recordings with compressed color
 
     std::cout << "Kinect started!" << std::endl;
     std::cout << "Controls:" << std::endl;
@@ -90,32 +76,41 @@ int main()
     // Main loop
     while (!glfwWindowShouldClose(window))
     {
-        libfreenect2::FrameMap frames;
+        FrameLease lease;
 
-        if (!listener.waitForNewFrame(frames, 1000))
+        if (!lease.acquire(*source, 1000))
         {
             continue;
         }
 
-        libfreenect2::Frame *rgb = frames[libfreenect2::Frame::Color];
-        libfreenect2::Frame *depth = frames[libfreenect2::Frame::Depth];
+        libfreenect2::Frame *color = jpeg_decoder.color_frame(lease);
+        libfreenect2::Frame *depth = lease.frame(libfreenect2::Frame::Depth);
+        if (!color || !depth)
+        {
+            continue;
+        }
 
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        {
+            PROFILE_SCOPE(render_stage);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        setup_camera_view(camera);
-        render_point_cloud(depth, rgb, registration);
+            setup_camera_view(camera);
+            render_point_cloud(depth, color, registration);
+        }
 
-        listener.release(frames);
+        // Hand the frames back before swapping so the source can refill them
+        lease.release();
 
         glfwSwapBuffers(window);
         glfwPollEvents();
+        PROFILE_REPORT(5.0);
     }
 
-    delete registration;
-    dev->stop();
-    dev->close();
-    delete dev;
+    source->frame_stats().print(std::cout);
+    PROFILE_PRINT();
 
+    // Stop the device while its GL pipeline can still clean up
+    source.reset();
     glfwTerminate();
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,92 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <utility>
+#include <sys/stat.h>
+#include <libfreenect2/libfreenect2.hpp>
+
+#include "kinect_multi_capture.h"
+#include "kinect_profile.h"
+#include "kinect_source.h"
+
+// How long to capture from all devices
+const int CAPTURE_SECONDS = 10;
+
+// Captures point clouds from every connected Kinect at once and saves each
+// device's last cloud. Pass recordings to replay each one as a device instead.
+//
+// Usage: script_multi_capture [recording.kfr ...]
+int main(int argc, char *argv[])
+{
+    mkdir("scans", 0755);
+
+    MultiDeviceCapture capture(MULTI_CAPTURE_POINT_CLOUDS);
+    if (argc > 1)
+    {
+        for (int i = 1; i < argc; i++)
+        {
+            ReplayFrameSource *source = new ReplayFrameSource(argv[i]);
+            if (!source->is_open())
+            {
+                delete source;
+                return -1;
+            }
+            capture.add_source(source, argv[i]);
+        }
+    }
+    else if (capture.open_all_devices(libfreenect2::Frame::Color | libfreenect2::Frame::Depth) == 0)
+    {
+        return -1;
+    }
+
+    std::cout << "Capturing from " << capture.device_count() << " devices for " << CAPTURE_SECONDS << " seconds..."
+              << std::endl;
+    if (!capture.start())
+        return -1;
+
+    // The latest cloud of each device; the rest go straight back to the pool
+    std::vector<DeviceFrameSet> latest(capture.device_count());
+    std::vector<bool> have_cloud(capture.device_count(), false);
+    DeviceFrameSet set;
+
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now() + std::chrono::seconds(CAPTURE_SECONDS);
+    while (std::chrono::steady_clock::now() < end)
+    {
+        if (!capture.next(set, 1000))
+        {
+            bool finished = true;
+            for (int i = 0; i < capture.device_count(); i++)
+            {
+                finished = finished && capture.source(i).finished();
+            }
+            if (finished)
+                break;
+            continue;
+        }
+
+        if (set.cloud.cloud.num_points > 0)
+        {
+            int device = set.device;
+            std::swap(latest[device], set);
+            have_cloud[device] = true;
+        }
+        PROFILE_REPORT(5.0);
+    }
+    capture.stop();
+
+    for (int i = 0; i < capture.device_count(); i++)
+    {
+        if (!have_cloud[i])
+        {
+            std::cout << "No point cloud from device " << i << " (" << capture.device_name(i) << ")" << std::endl;
+            continue;
+        }
+        std::string filename = "scans/device_" + std::to_string(i) + ".ply";
+        savePointCloudPLY(filename.c_str(), latest[i].cloud.cloud);
+    }
+
+    capture.print_stats(std::cout);
+    PROFILE_PRINT();
+    return 0;
+}
@@ -0,0 +1,138 @@
+#include <iostream>
+#include <string>
+#include <cstdlib>
+#include <csignal>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <libfreenect2/libfreenect2.hpp>
+#include <libfreenect2/packet_pipeline.h>
+
+#include "kinect_pretrigger.h"
+#include "kinect_profile.h"
+#include "kinect_source.h"
+
+static volatile sig_atomic_t trigger_requested = 0;
+static volatile sig_atomic_t stop_requested = 0;
+
+static void onTriggerSignal(int)
+{
+    trigger_requested = 1;
+}
+
+static void onStopSignal(int)
+{
+    stop_requested = 1;
+}
+
+// True once a line has been typed, without waiting for one. Stdin at EOF
+// (e.g. /dev/null when started in the background) polls readable forever,
+// so it is ignored from then on.
+static bool enterPressed()
+{
+    static bool stdin_closed = false;
+    if (stdin_closed)
+        return false;
+
+    pollfd stdin_poll = {STDIN_FILENO, POLLIN, 0};
+    if (poll(&stdin_poll, 1, 0) <= 0)
+        return false;
+    std::string line;
+    if (!std::getline(std::cin, line) || std::cin.eof())
+    {
+        stdin_closed = true;
+        return false;
+    }
+    return true;
+}
+
+// Keeps the last few seconds of frames in memory and saves them, plus the
+// seconds after, whenever Enter is pressed or the process gets SIGUSR1
+// (e.g. `kill -USR1 <pid>` from another program watching for the event).
+// Ctrl-C ends the event being saved where it is and exits.
+//
+// Usage: script_pretrigger_record [pre_seconds] [post_seconds] [streams]
+// with streams as for script_record_frames (default all three). The buffer
+// holds pre_seconds of every selected stream plus up to a second of spare
+// sets; all three take about 10 MB per frame set, 3.3 GB for 10 seconds, so
+// select fewer streams to keep more. Saving all three without dropping sets
+// also needs a disk that sustains about 230 MB/s (for 5 s after the
+// trigger); the rate needed is printed at startup.
+int main(int argc, char *argv[])
+{
+    mkdir("recordings", 0755);
+
+    double pre_seconds = argc > 1 ? atof(argv[1]) : 10.0;
+    double post_seconds = argc > 2 ? atof(argv[2]) : 5.0;
+    StreamSelection streams = parseStreams(argc > 3 ? argv[3] : "color+depth+ir");
+    if (streams.frame_types == 0)
+    {
+        std::cout << "Unknown streams " << argv[3] << ", expected e.g. color+depth+ir" << std::endl;
+        return -1;
+    }
+
+    LiveFrameSource source(streams.frame_types, streams.compressed_color ? new PassthroughColorPipeline() : nullptr);
+    if (!source.is_open())
+        return -1;
+
+    PreTriggerRecorder recorder(source.ir_params(), source.color_params(), streams.frame_types, pre_seconds,
+                                post_seconds, streams.lossless_depth);
+    if (!recorder.is_ready())
+        return -1;
+
+    std::signal(SIGUSR1, onTriggerSignal);
+    std::signal(SIGINT, onStopSignal);
+    std::cout << "Buffering " << pre_seconds << " s (" << recorder.capacity() << " frame sets, "
+              << recorder.reserved_bytes() / (1024 * 1024) << " MB). Press Enter or send SIGUSR1 to pid "
+              << getpid() << " to save, Ctrl-C to quit." << std::endl;
+    if (recorder.required_write_rate() > 0)
+        std::cout << "Saving an event without dropping frame sets needs up to "
+                  << (int)(recorder.required_write_rate() / (1024 * 1024)) << " MB/s of sustained disk writes"
+                  << std::endl;
+
+    FrameLease lease;
+    int next_event = 0;
+    bool was_busy = false;
+    while (!stop_requested)
+    {
+        if (!lease.acquire(source))
+        {
+            std::cout << "Timeout waiting for frames!" << std::endl;
+            continue;
+        }
+        recorder.add(lease);
+        lease.release();
+
+        if (enterPressed() || trigger_requested)
+        {
+            trigger_requested = 0;
+            std::string filename = "recordings/event_" + std::to_string(next_event) + ".kfr";
+            if (recorder.trigger(filename))
+            {
+                std::cout << "Saving " << recorder.buffered() << " buffered frame sets and the next "
+                          << post_seconds << " s to " << filename << std::endl;
+                next_event++;
+            }
+            else
+            {
+                std::cout << "Still saving the previous event" << std::endl;
+            }
+        }
+
+        bool busy = recorder.busy();
+        if (was_busy && !busy)
+            std::cout << "Event saved" << std::endl;
+        was_busy = busy;
+    }
+
+    std::cout << std::endl;
+    if (recorder.busy())
+        std::cout << "Saving the event so far..." << std::endl;
+    recorder.finish();
+
+    std::cout << "Saved " << recorder.events_written() << " events, dropped " << recorder.dropped()
+              << " frame sets while the disk caught up" << std::endl;
+    source.frame_stats().print(std::cout);
+    PROFILE_PRINT();
+    return 0;
+}
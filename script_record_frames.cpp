@@ -0,0 +1,77 @@
+#include <iostream>
+#include <memory>
+#include <string>
+#include <cstdlib>
+#include <sys/stat.h>
+#include <libfreenect2/libfreenect2.hpp>
+#include <libfreenect2/packet_pipeline.h>
+
+#include "kinect_profile.h"
+#include "kinect_source.h"
+
+// Records raw frame sets (BGRX color, float depth and IR) for replay with
+// ReplayFrameSource. Pass a recording as the first argument of the other
+// scripts to run them without a Kinect.
+//
+// Usage: script_record_frames [num_frames] [file] [streams]
+// where streams is e.g. "depth" or "color+depth" (default all three). Only
+// the selected streams are processed, so a depth-only recording skips the
+// JPEG decoding of the color stream. "jpeg" records color as the camera's own
+// JPEGs without decoding them (a tenth of the size of BGRX), and "depth16"
+// stores depth as 16-bit millimeters with the lossless depth codec (a fifth
+// of the size of float depth or less); "jpeg+depth16+ir" is the most compact
+// recording of all three streams.
+int main(int argc, char *argv[])
+{
+    mkdir("recordings", 0755);
+
+    int num_frames = argc > 1 ? atoi(argv[1]) : 300;
+    std::string filename = argc > 2 ? argv[2] : "recordings/frames.kfr";
+    StreamSelection streams = parseStreams(argc > 3 ? argv[3] : "color+depth+ir");
+    if (streams.frame_types == 0)
+    {
+        std::cout << "Unknown streams " << argv[3] << ", expected e.g. color+depth+ir" << std::endl;
+        return -1;
+    }
+
+    LiveFrameSource source(streams.frame_types, streams.compressed_color ? new PassthroughColorPipeline() : nullptr);
+    if (!source.is_open())
+        return -1;
+
+    FrameSetWriter writer(filename.c_str(), source.ir_params(), source.color_params(), streams.lossless_depth);
+    if (!writer.is_open())
+    {
+        std::cout << "Failed to create " << filename << std::endl;
+        return -1;
+    }
+
+    std::cout << "Recording " << num_frames << " frame sets to " << filename << "..." << std::endl;
+
+    FrameLease lease;
+    for (int i = 0; i < num_frames; i++)
+    {
+        if (!lease.acquire(source))
+        {
+            std::cout << "Timeout waiting for frames!" << std::endl;
+            continue;
+        }
+
+        writer.write(lease);
+        lease.release();
+        std::cout << "Recorded frame set " << i + 1 << "/" << num_frames << "\r" << std::flush;
+    }
+    std::cout << std::endl;
+
+    if (!writer.close())
+    {
+        std::cout << "Failed to write " << filename << std::endl;
+        return -1;
+    }
+
+    std::cout << "Wrote " << writer.sets_written() << " frame sets, at most " << writer.max_queue_depth()
+              << " waiting for the disk" << std::endl;
+    std::cout << "Done! Replay with e.g. debug/script_live_viewer " << filename << std::endl;
+    source.frame_stats().print(std::cout);
+    PROFILE_PRINT();
+    return 0;
+}
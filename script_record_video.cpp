@@ -1,120 +1,163 @@
 #include <iostream>
 #include <fstream>
+#include <string>
+#include <vector>
+#include <algorithm>
 #include <sys/stat.h>
 #include <libfreenect2/libfreenect2.hpp>
 #include <libfreenect2/frame_listener_impl.h>
 #include <libfreenect2/packet_pipeline.h>
 
 #include "kinect_capture.h"
-
-void writeRawVideo(const char *filename, int width, int height, int channels, int num_frames,
-                   libfreenect2::Freenect2Device *dev, libfreenect2::SyncMultiFrameListener &listener,
-                   int frame_type)
+#include "kinect_depth_codec.h"
+#include "kinect_profile.h"
+#include "kinect_raw_video.h"
+#include "kinect_source.h"
+
+// Record every stream at once into one container, so the videos exported
+// from it cover the same moments. Color is kept as the camera's JPEGs and
+// depth at full precision with the lossless depth codec, which takes about a
+// fifth of the bandwidth of BGRX color and float depth.
+bool recordFrameSets(const char *filename, int num_frames)
 {
-    std::ofstream file(filename, std::ios::binary);
+    LiveFrameSource source(libfreenect2::Frame::Color | libfreenect2::Frame::Depth | libfreenect2::Frame::Ir,
+                           new PassthroughColorPipeline());
+    if (!source.is_open())
+        return false;
 
-    // Write header info (width, height, channels, num_frames)
-    file.write((char *)&width, sizeof(int));
-    file.write((char *)&height, sizeof(int));
-    file.write((char *)&channels, sizeof(int));
-    file.write((char *)&num_frames, sizeof(int));
+    FrameSetWriter writer(filename, source.ir_params(), source.color_params(), true);
+    if (!writer.is_open())
+    {
+        std::cout << "Failed to create " << filename << std::endl;
+        return false;
+    }
 
+    FrameLease lease;
     for (int i = 0; i < num_frames; i++)
     {
-        if (frame_type == 0)
-        { // RGB
-            RGBFrame frame = getRGBFrame(dev, listener);
-            if (frame.data)
-            {
-                file.write((char *)frame.data, width * height * channels);
-                freeRGBFrame(frame);
-                std::cout << "Captured RGB frame " << i << "/" << num_frames << "\r" << std::flush;
-            }
-        }
-        else if (frame_type == 1)
-        { // Depth
-            DepthFrame frame = getDepthFrame(dev, listener);
-            if (frame.data)
-            {
-                file.write((char *)frame.data, width * height * channels);
-                freeDepthFrame(frame);
-                std::cout << "Captured depth frame " << i << "/" << num_frames << "\r" << std::flush;
-            }
-        }
-        else if (frame_type == 2)
-        { // IR
-            IRFrame frame = getIRFrame(dev, listener);
-            if (frame.data)
-            {
-                file.write((char *)frame.data, width * height * channels);
-                freeIRFrame(frame);
-                std::cout << "Captured IR frame " << i << "/" << num_frames << "\r" << std::flush;
-            }
+        if (!lease.acquire(source))
+        {
+            std::cout << "Timeout waiting for frames!" << std::endl;
+            continue;
         }
-    }
 
-    file.close();
+        writer.write(lease);
+        lease.release();
+        std::cout << "Captured frame set " << i + 1 << "/" << num_frames << "\r" << std::flush;
+    }
     std::cout << std::endl;
+
+    if (!writer.close())
+    {
+        std::cout << "Failed to write " << filename << std::endl;
+        return false;
+    }
+    std::cout << "Wrote " << writer.sets_written() << " frame sets, at most " << writer.max_queue_depth()
+              << " waiting for the disk" << std::endl;
+    source.frame_stats().print(std::cout);
+    return true;
 }
 
-int main()
+// Split a recording into one .raw video per stream (read them back with
+// RawVideoReader or script_extract_frames). The camera's JPEGs (as recorded
+// here, or with the "jpeg" streams of script_record_frames) are written back
+// to back, which is an MJPEG stream: nothing is re-encoded. Depth goes out
+// twice: scaled to 8 bits for viewing, and as 16-bit millimeters
+// (little-endian, 2 channels' worth of bytes per pixel).
+void exportVideos(ReplayFrameSource &source, bool &wrote_rgb, bool &wrote_mjpeg, bool &wrote_depth, bool &wrote_ir)
 {
-    mkdir("videos", 0755);
-
-    libfreenect2::Freenect2 freenect2;
-    libfreenect2::Freenect2Device *dev = nullptr;
-
-    if (freenect2.enumerateDevices() == 0)
+    int expected_frames = std::max(source.set_count(), 0);
+    RawVideoWriter rgb_video("videos/rgb_video.raw", expected_frames);
+    RawVideoWriter depth_video("videos/depth_video.raw", expected_frames);
+    RawVideoWriter depth16_video("videos/depth16_video.raw", expected_frames);
+    RawVideoWriter ir_video("videos/ir_video.raw", expected_frames);
+    std::vector<uint16_t> depth16;
+    std::ofstream mjpeg;
+
+    FrameBufferPool pool;
+    PooledRGBFrame rgb_frame;
+    PooledDepthFrame depth_frame;
+    PooledIRFrame ir_frame;
+
+    FrameLease lease;
+    int sets = 0;
+    while (lease.acquire(source))
     {
-        std::cout << "No Kinect detected" << std::endl;
-        return -1;
-    }
+        FrameView color = lease.color();
+        if (color.compressed())
+        {
+            if (!mjpeg.is_open())
+                mjpeg.open("videos/rgb_video.mjpeg", std::ios::binary);
+            mjpeg.write((const char *)color.data, color.size());
+        }
+        else if (color.valid())
+        {
+            convertRGBView(color, pool, rgb_frame);
+            rgb_video.write_frame(rgb_frame.frame.data, rgb_frame.frame.width, rgb_frame.frame.height, 3);
+        }
 
-    std::string serial = freenect2.getDefaultDeviceSerialNumber();
-    std::cout << "Opening device: " << serial << std::endl;
+        FrameView depth = lease.depth();
+        if (depth.valid())
+        {
+            convertDepthView(depth, pool, depth_frame);
+            depth_video.write_frame(depth_frame.frame.data, depth_frame.frame.width, depth_frame.frame.height, 1);
 
-    libfreenect2::PacketPipeline *pipeline = new libfreenect2::CpuPacketPipeline();
-    dev = freenect2.openDevice(serial, pipeline);
+            depth16.resize((size_t)depth.width * depth.height);
+            depthToMillimeters(depth.floats(), depth16.data(), depth16.size());
+            depth16_video.write_frame((const unsigned char *)depth16.data(), depth.width, depth.height, 2);
+        }
 
-    if (!dev)
-    {
-        std::cout << "Failed to open device" << std::endl;
-        return -1;
+        if (lease.ir().valid())
+        {
+            convertIRView(lease.ir(), pool, ir_frame);
+            ir_video.write_frame(ir_frame.frame.data, ir_frame.frame.width, ir_frame.frame.height, 1);
+        }
+
+        std::cout << "Exported frame set " << ++sets << "\r" << std::flush;
     }
+    std::cout << std::endl;
 
-    libfreenect2::SyncMultiFrameListener listener(
-        libfreenect2::Frame::Color | libfreenect2::Frame::Depth | libfreenect2::Frame::Ir);
-    dev->setColorFrameListener(&listener);
-    dev->setIrAndDepthFrameListener(&listener);
+    wrote_rgb = rgb_video.close();
+    wrote_mjpeg = mjpeg.is_open();
+    wrote_depth = depth_video.close();
+    depth16_video.close();
+    wrote_ir = ir_video.close();
+}
+
+int main(int argc, char *argv[])
+{
+    mkdir("videos", 0755);
 
-    if (!dev->start())
+    // Export a recording when one is given, otherwise record one first
+    std::string recording = argc > 1 ? argv[1] : "videos/recording.kfr";
+    if (argc <= 1)
     {
-        std::cout << "Failed to start device" << std::endl;
-        return -1;
+        std::cout << "Recording 300 frame sets (~10 seconds at 30fps)..." << std::endl;
+        if (!recordFrameSets(recording.c_str(), 300))
+            return -1;
     }
 
-    std::cout << "Recording 300 frames (~10 seconds at 30fps)..." << std::endl;
-
-    // Record RGB video
-    std::cout << "Recording RGB..." << std::endl;
-    writeRawVideo("videos/rgb_video.raw", 1920, 1080, 3, 300, dev, listener, 0);
-
-    // Record depth video
-    std::cout << "Recording depth..." << std::endl;
-    writeRawVideo("videos/depth_video.raw", 512, 424, 1, 300, dev, listener, 1);
+    ReplayFrameSource source(recording.c_str(), false);
+    if (!source.is_open())
+        return -1;
 
-    // Record IR video
-    std::cout << "Recording IR..." << std::endl;
-    writeRawVideo("videos/ir_video.raw", 512, 424, 1, 300, dev, listener, 2);
+    std::cout << "Exporting videos from " << recording << "..." << std::endl;
+    bool wrote_rgb, wrote_mjpeg, wrote_depth, wrote_ir;
+    exportVideos(source, wrote_rgb, wrote_mjpeg, wrote_depth, wrote_ir);
 
     std::cout << "Done! Use FFmpeg to convert to playable video:" << std::endl;
-    std::cout << "ffmpeg -f rawvideo -pixel_format rgb24 -video_size 1920x1080 -framerate 30 -i videos/rgb_video.raw videos/rgb_output.mp4" << std::endl;
-    std::cout << "ffmpeg -f rawvideo -pixel_format gray -video_size 512x424 -framerate 30 -i videos/depth_video.raw videos/depth_output.mp4" << std::endl;
-    std::cout << "ffmpeg -f rawvideo -pixel_format gray -video_size 512x424 -framerate 30 -i videos/ir_video.raw videos/ir_output.mp4" << std::endl;
-
-    dev->stop();
-    dev->close();
-    delete dev;
+    if (wrote_mjpeg)
+        std::cout << "ffmpeg -f mjpeg -framerate 30 -i videos/rgb_video.mjpeg videos/rgb_output.mp4" << std::endl;
+    if (wrote_rgb)
+        std::cout << "ffmpeg -f rawvideo -pixel_format rgb24 -video_size 1920x1080 -framerate 30 -i videos/rgb_video.raw videos/rgb_output.mp4" << std::endl;
+    if (wrote_depth)
+    {
+        std::cout << "ffmpeg -f rawvideo -pixel_format gray -video_size 512x424 -framerate 30 -i videos/depth_video.raw videos/depth_output.mp4" << std::endl;
+        std::cout << "ffmpeg -f rawvideo -pixel_format gray16le -video_size 512x424 -framerate 30 -i videos/depth16_video.raw -c:v ffv1 videos/depth16_output.mkv" << std::endl;
+    }
+    if (wrote_ir)
+        std::cout << "ffmpeg -f rawvideo -pixel_format gray -video_size 512x424 -framerate 30 -i videos/ir_video.raw videos/ir_output.mp4" << std::endl;
 
+    PROFILE_PRINT();
     return 0;
-}
\ No newline at end of file
+}